@@ -1,14 +1,17 @@
 
 #include <sys/stat.h>
 
-#include <QString>
 #include <climits>
 #include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <string>
 #include <vector>
+
+#include "blockreader.h"
+#include "outputfile.h"
 namespace fs = std::filesystem;
 using namespace std;
 
@@ -184,34 +187,55 @@ public:
     return true;
   }
 
-  size_t extractMP3File(const string &filename, size_t fileStart,
-                        int &fileCount, function<void(QString)> logCallback,
-                        function<bool()> cancelCheck)
+  // Follows frames from `fileStart`. Returns the offset just past the
+  // stream, or 0 when it was too short or long to keep. The outcome is left
+  // in lastOutputPath, lastBytesWritten and lastError for the caller to report.
+  size_t extractMP3File(BlockReader &reader, size_t fileStart)
   {
-    ifstream file(filename, ios::binary);
     size_t current_offset = fileStart; // track the absolute byte offset
-    if (!file)
+    size_t readOffset = fileStart;
+    lastOutputPath.clear();
+    lastError.clear();
+    lastBytesWritten = 0;
+    lastBitrate = 0;
+
+    const size_t minSize = 20 * 1024;        // Convert to bytes
+    const size_t maxSize = 20 * 1024 * 1024; // Convert to bytes
+
+    // Frames are staged in memory until the chain is long enough to keep,
+    // so short runs of false syncs never create a file.
+    vector<unsigned char> staged;
+    string outFileName;
+    ofstream outFile;
+    auto writeFrame = [&](const unsigned char *frame, size_t size)
     {
-      cout << "[MP3] Error: Failed to open file for MP3 extraction: "
-           << filename << endl;
-      logCallback("Failed to reopen file for MP3 extraction");
-      return current_offset;
-    }
-    file.clear();
-    file.seekg(fileStart, ios::beg);
-
-    // Ensure directory exists
-    fs::create_directories(outputDirectory + "/MP3");
-
-    string outFileName = outputDirectory + "/MP3/recoveredFile_" +
-                         to_string(fileCount) + ".mp3";
-    ofstream outFile(outFileName, ios::binary);
-    if (!outFile)
-    {
-      logCallback("Error: Failed to create MP3 output file: " +
-                  QString::fromStdString(outFileName));
-      return current_offset;
-    }
+      if (measureOnly)
+        return true;
+      if (outFile.is_open())
+      {
+        outFile.write(reinterpret_cast<const char *>(frame), size);
+        return true;
+      }
+      staged.insert(staged.end(), frame, frame + size);
+      if (staged.size() < minSize)
+        return true;
+      error_code ec;
+      fs::create_directories(outputDirectory + "/MP3", ec);
+      outFileName = claimOutputFile(outputDirectory + "/MP3",
+                                    carvedFileStem(fileStart), ".mp3");
+      if (!outFileName.empty())
+        outFile.open(outFileName, ios::binary);
+      if (outFileName.empty() || !outFile)
+      {
+        lastError = "Failed to create an MP3 output file in " + outputDirectory;
+        return false;
+      }
+      outFile.write(reinterpret_cast<const char *>(staged.data()),
+                    staged.size());
+      staged.clear();
+      staged.shrink_to_fit();
+      return true;
+    };
     // cout << "[MP3] Extracting file: " << outFileName << endl;
     const size_t BUFFER_SIZE = 4096;
     size_t overlap = 3; // carry last 3 bytes forward
@@ -221,7 +245,7 @@ public:
         4); // +4 to avoid out-of-bounds for header read
 
     size_t totalExtracted = 0;
-    int gapCount = 0;
+    size_t gapCount = 0;
 
     vector<int> frame_info_original;
     bool firstFrameFound = false;
@@ -229,10 +253,6 @@ public:
     // cout << "[MP3] Starting extraction from offset: " << fileStart << endl; // mark
     while (true)
     {
-      //   if (cancelCheck()) {
-      //     logCallback("Extraction cancelled");
-      //     break;
-      //   }
       // Move last `overlap` bytes to the front
       for (size_t i = 0; i < overlap; ++i)
       {
@@ -240,8 +260,9 @@ public:
       }
 
       // Read new data after the carried-forward bytes
-      file.read(reinterpret_cast<char *>(buffer.data() + overlap), BUFFER_SIZE);
-      size_t bytesRead = file.gcount();
+      size_t bytesRead =
+          reader.readAt(readOffset, buffer.data() + overlap, BUFFER_SIZE);
+      readOffset += bytesRead;
       if (bytesRead == 0)
         break;
       // cout << "checkpoint 1" << endl;
@@ -265,8 +286,8 @@ public:
              frame_info[0] > 0 && pos + frame_info[0] <= totalBytes))
         {
           // cout << "checkout 1.6.5" << endl;
-          outFile.write(reinterpret_cast<char *>(buffer.data() + pos),
-                        frame_info[0]);
+          if (!writeFrame(buffer.data() + pos, frame_info[0]))
+            return fileStart;
           current_offset += frame_info[0];
           pos += frame_info[0];
           totalExtracted += frame_info[0];
@@ -293,28 +314,33 @@ public:
     }
 
   extraction_finished:
-    outFile.close();
-    size_t minSize = 20 * 1024;        // Convert to bytes
-    size_t maxSize = 20 * 1024 * 1024; // Convert to bytes
+    if (outFile.is_open())
+      outFile.close();
+    lastBytesWritten = outFileName.empty() ? 0 : totalBytesWritten;
+    lastChainBytes = totalBytesWritten;
+    lastBitrate = frame_info_original.empty() ? 0 : frame_info_original[3] / 1000;
 
     // cout << "[MP3] Extraction finished. Total bytes written: "
     //  << totalBytesWritten << endl;
     if (totalBytesWritten < minSize || totalBytesWritten > maxSize)
     {
-      // logCallback("[SKIP] Deleted invalid size Mp3 file: (" +
-      //             QString::number(totalBytesWritten) + " bytes)");
-      remove(outFileName.c_str()); // Delete file
-      fileCount--;                 // Decrement file count to avoid gaps
+      if (!outFileName.empty())
+        remove(outFileName.c_str()); // Delete file
       return 0;
     }
-    else
-    {
-      logCallback("[OK] Recovered: " + QString::fromStdString(outFileName) +
-                  " (" + QString::number(totalBytesWritten / 1024) + " KB)");
-    }
+    lastOutputPath = outFileName;
     return current_offset;
   }
   string outputDirectory;
+  // Outcome of the last extractMP3File call.
+  size_t lastBytesWritten = 0; // written to the output, kept or not
+  size_t lastChainBytes = 0;   // frames followed, staged or written
+  string lastOutputPath;       // empty unless the file was kept
+  string lastError;            // set when the output could not be created
+  int lastBitrate = 0;         // kbit/s of the first frame
+  // Follow streams without writing them (catalog scans); the return value
+  // and lastChainBytes still say where a stream ends and whether it is kept.
+  bool measureOnly = false;
   Mp3(const string &outputDir) : outputDirectory(outputDir)
   {
     // Constructor can initialize logging and progress callbacks if needed
@@ -0,0 +1,188 @@
+#include "hexview.h"
+
+#include <QFontDatabase>
+#include <QKeyEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <QWheelEvent>
+#include <algorithm>
+#include <vector>
+
+#include "../pagecache.h"
+
+HexView::HexView(QWidget *parent) : QAbstractScrollArea(parent) {
+  setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  setFocusPolicy(Qt::StrongFocus);
+  setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+  connect(verticalScrollBar(), &QScrollBar::valueChanged, this,
+          &HexView::scrolled);
+}
+
+void HexView::setDevice(std::shared_ptr<PageCache> device) {
+  pages = device;
+  topLine = 0;
+  signatureBegin = signatureEnd = carveBegin = carveEnd = 0;
+  updateScrollBar();
+  viewport()->update();
+}
+
+void HexView::goTo(uint64_t offset) {
+  uint64_t line = offset / BYTES_PER_LINE;
+  setTopLine(line > 3 ? line - 3 : 0);
+}
+
+void HexView::setHighlight(uint64_t signatureStart, uint64_t signatureLength,
+                           uint64_t carveStart, uint64_t carveLength) {
+  signatureBegin = signatureStart;
+  signatureEnd = signatureStart + signatureLength;
+  carveBegin = carveStart;
+  carveEnd = carveStart + carveLength;
+  viewport()->update();
+}
+
+uint64_t HexView::lineCount() const {
+  return pages ? (pages->size() + BYTES_PER_LINE - 1) / BYTES_PER_LINE : 0;
+}
+
+uint64_t HexView::lastTopLine() const {
+  uint64_t lines = lineCount();
+  uint64_t visible = visibleLines();
+  return lines > visible ? lines - visible : 0;
+}
+
+int HexView::visibleLines() const {
+  return std::max(1, viewport()->height() / fontMetrics().height());
+}
+
+void HexView::setTopLine(uint64_t line) {
+  topLine = std::min(line, lastTopLine());
+  updateScrollBar();
+  viewport()->update();
+}
+
+void HexView::updateScrollBar() {
+  uint64_t last = lastTopLine();
+  QScrollBar *bar = verticalScrollBar();
+  syncingScrollBar = true;
+  if (last <= static_cast<uint64_t>(SCROLL_STEPS)) {
+    bar->setRange(0, static_cast<int>(last));
+    bar->setPageStep(visibleLines());
+    bar->setValue(static_cast<int>(topLine));
+  } else {
+    double scale = static_cast<double>(SCROLL_STEPS) / last;
+    bar->setRange(0, SCROLL_STEPS);
+    bar->setPageStep(std::max(1, static_cast<int>(visibleLines() * scale)));
+    bar->setValue(static_cast<int>(topLine * scale));
+  }
+  syncingScrollBar = false;
+}
+
+void HexView::scrolled(int value) {
+  if (syncingScrollBar) return;
+  uint64_t last = lastTopLine();
+  topLine = last <= static_cast<uint64_t>(SCROLL_STEPS)
+                ? static_cast<uint64_t>(value)
+                : std::min(last, static_cast<uint64_t>(
+                                     static_cast<double>(value) /
+                                     SCROLL_STEPS * last));
+  viewport()->update();
+}
+
+void HexView::paintEvent(QPaintEvent *) {
+  QPainter painter(viewport());
+  if (!pages) return;
+
+  QFontMetrics metrics(font());
+  int lineHeight = metrics.height();
+  int charWidth = metrics.horizontalAdvance(QLatin1Char('0'));
+  // 12 offset digits cover 256 TB; two spaces; "xx " per byte with a gap
+  // after the eighth; two spaces; the ASCII column.
+  int hexX = charWidth * 14;
+  int asciiX = hexX + charWidth * (BYTES_PER_LINE * 3 + 2);
+  QColor carveColor = palette().color(QPalette::Highlight);
+  QColor signatureColor = carveColor;
+  carveColor.setAlpha(60);
+  signatureColor.setAlpha(170);
+  painter.setPen(palette().color(QPalette::Text));
+
+  // The whole screen in one read; the page cache makes it a few memcpys.
+  uint64_t first = topLine * BYTES_PER_LINE;
+  std::vector<unsigned char> bytes(static_cast<size_t>(visibleLines() + 1) *
+                                   BYTES_PER_LINE);
+  size_t got = pages->readAt(first, bytes.data(), bytes.size());
+
+  for (size_t line = 0; line * BYTES_PER_LINE < got; ++line) {
+    int y = static_cast<int>(line) * lineHeight;
+    uint64_t lineStart = first + line * BYTES_PER_LINE;
+    size_t count =
+        std::min<size_t>(BYTES_PER_LINE, got - line * BYTES_PER_LINE);
+    const unsigned char *data = bytes.data() + line * BYTES_PER_LINE;
+
+    QString hex, ascii;
+    for (size_t i = 0; i < count; ++i) {
+      uint64_t at = lineStart + i;
+      int column = static_cast<int>(i * 3 + (i >= 8 ? 1 : 0));
+      const QColor *fill = nullptr;
+      if (at >= signatureBegin && at < signatureEnd)
+        fill = &signatureColor;
+      else if (at >= carveBegin && at < carveEnd)
+        fill = &carveColor;
+      if (fill) {
+        painter.fillRect(hexX + column * charWidth, y, charWidth * 2,
+                         lineHeight, *fill);
+        painter.fillRect(asciiX + static_cast<int>(i) * charWidth, y,
+                         charWidth, lineHeight, *fill);
+      }
+      hex += QString("%1 ").arg(uint(data[i]), 2, 16, QLatin1Char('0'));
+      if (i == 7) hex += ' ';
+      ascii +=
+          data[i] >= 0x20 && data[i] < 0x7F ? QChar(data[i]) : QChar('.');
+    }
+    int baseline = y + metrics.ascent();
+    painter.drawText(0, baseline,
+                     QString("%1").arg(lineStart, 12, 16, QLatin1Char('0')));
+    painter.drawText(hexX, baseline, hex);
+    painter.drawText(asciiX, baseline, ascii);
+  }
+}
+
+void HexView::resizeEvent(QResizeEvent *event) {
+  QAbstractScrollArea::resizeEvent(event);
+  setTopLine(topLine);
+}
+
+void HexView::keyPressEvent(QKeyEvent *event) {
+  uint64_t page = static_cast<uint64_t>(visibleLines());
+  switch (event->key()) {
+    case Qt::Key_Up:
+      setTopLine(topLine > 0 ? topLine - 1 : 0);
+      break;
+    case Qt::Key_Down:
+      setTopLine(topLine + 1);
+      break;
+    case Qt::Key_PageUp:
+      setTopLine(topLine > page ? topLine - page : 0);
+      break;
+    case Qt::Key_PageDown:
+      setTopLine(topLine + page);
+      break;
+    case Qt::Key_Home:
+      setTopLine(0);
+      break;
+    case Qt::Key_End:
+      setTopLine(lastTopLine());
+      break;
+    default:
+      QAbstractScrollArea::keyPressEvent(event);
+  }
+}
+
+// Three lines a notch, whatever the scroll bar's scale.
+void HexView::wheelEvent(QWheelEvent *event) {
+  int lines = event->angleDelta().y() / 40;
+  if (lines < 0)
+    setTopLine(topLine + static_cast<uint64_t>(-lines));
+  else
+    setTopLine(topLine > static_cast<uint64_t>(lines) ? topLine - lines : 0);
+  event->accept();
+}
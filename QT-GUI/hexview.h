@@ -0,0 +1,61 @@
+#ifndef HEXVIEW_H
+#define HEXVIEW_H
+
+#include <QAbstractScrollArea>
+#include <cstdint>
+#include <memory>
+
+class PageCache;
+
+// Offset, hex and ASCII columns over a whole device. Only the lines on
+// screen are read, through a PageCache, so a 10 TB disk opens as fast as a
+// small image and memory use does not grow with it. The bytes of a
+// candidate's signature and of its carve range are highlighted.
+class HexView : public QAbstractScrollArea {
+  Q_OBJECT
+
+ public:
+  static constexpr int BYTES_PER_LINE = 16;
+
+  explicit HexView(QWidget *parent = nullptr);
+
+  // Shows `device`, or nothing when it is null, from offset 0.
+  void setDevice(std::shared_ptr<PageCache> device);
+  std::shared_ptr<PageCache> device() const { return pages; }
+
+  // Scrolls so the line holding `offset` is near the top.
+  void goTo(uint64_t offset);
+
+  // Highlights [signatureStart, +signatureLength) strongly and
+  // [carveStart, +carveLength) lightly; zero lengths clear them.
+  void setHighlight(uint64_t signatureStart, uint64_t signatureLength,
+                    uint64_t carveStart, uint64_t carveLength);
+
+ protected:
+  void paintEvent(QPaintEvent *event) override;
+  void resizeEvent(QResizeEvent *event) override;
+  void keyPressEvent(QKeyEvent *event) override;
+  void wheelEvent(QWheelEvent *event) override;
+
+ private slots:
+  void scrolled(int value);
+
+ private:
+  // A scroll bar holds an int, and a large disk has more lines than that,
+  // so past SCROLL_STEPS the bar moves in proportion instead of by line.
+  static constexpr int SCROLL_STEPS = 1 << 30;
+
+  uint64_t lineCount() const;
+  uint64_t lastTopLine() const;
+  int visibleLines() const;
+  void setTopLine(uint64_t line);
+  void updateScrollBar();
+
+  std::shared_ptr<PageCache> pages;
+  uint64_t topLine = 0;
+  uint64_t signatureBegin = 0, signatureEnd = 0;
+  uint64_t carveBegin = 0, carveEnd = 0;
+  bool syncingScrollBar = false;
+};
+
+#endif  // HEXVIEW_H
@@ -1,20 +1,57 @@
 #include "mainwindow.h"
 
+#include <QDialog>
+#include <QDialogButtonBox>
 #include <QDir>
 #include <QFile>
 #include <QFileDialog>
-#include <QInputDialog>
+#include <QFileInfo>
+#include <QHeaderView>
+#include <QLabel>
+#include <QListWidget>
 #include <QMessageBox>
+#include <QPushButton>
 #include <QStorageInfo>
+#include <QPixmap>
+#include <QTextDocument>
+#include <QThread>
+#include <QVBoxLayout>
 #include <QtConcurrent>
+#include <algorithm>
 #include <iostream>
 #include <map>
 #include <string>
 #include <vector>
 
+#include "../catalog.h"
+#include "../pagecache.h"
 #include "../recoveryengine.h"  // adjust path as needed
+#include "../scanbatch.h"
 #include "ui_mainwindow.h"
 
+// One status-bar line: throughput, candidates and what became of them.
+static QString statsSummary(const ScanStats &stats) {
+  double seconds = stats.elapsedNanos / 1e9;
+  double readMB = stats[metric::BYTES_READ] / 1e6;
+  return QString("Read %1 MB (%2 MB/s) | %3 candidates: %4 kept, %5 rejected "
+                 "| %6 MB written | scan %7 s, carve %8 s, write %9 s")
+      .arg(readMB, 0, 'f', 1)
+      .arg(seconds > 0 ? readMB / seconds : 0.0, 0, 'f', 1)
+      .arg(stats.total(metric::CANDIDATES))
+      .arg(stats.total(metric::VALIDATED))
+      .arg(stats.total(metric::REJECTED))
+      .arg(stats[metric::BYTES_WRITTEN] / 1e6, 0, 'f', 1)
+      .arg(stats[metric::SCAN_NS] / 1e9, 0, 'f', 1)
+      .arg(stats[metric::CARVE_NS] / 1e9, 0, 'f', 1)
+      .arg(stats[metric::WRITE_NS] / 1e9, 0, 'f', 1);
+}
+
+static QString resultCount(const ResultsModel &results) {
+  return QString("%1 of %2 files")
+      .arg(results.matchCount())
+      .arg(results.totalCount());
+}
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent), ui(new Ui::MainWindow) {
   ui->setupUi(this);
@@ -22,6 +59,54 @@ MainWindow::MainWindow(QWidget *parent)
   ui->progressBar->setRange(0, 100);
   fileTypeCheckboxes = {ui->checkBoxJPEG, ui->checkBoxPNG, ui->checkBoxMP3,
                         ui->checkBoxPDF, ui->checkBoxZIP};
+
+  // Oldest lines are dropped once the log holds this many.
+  ui->logBox->document()->setMaximumBlockCount(5000);
+  drainTimer = new QTimer(this);
+  drainTimer->setInterval(100);
+  connect(drainTimer, &QTimer::timeout, this, &MainWindow::drainEvents);
+
+  // Recovered files also go to a table that can be sorted and filtered.
+  // Rows have one fixed height so the view never measures them.
+  results = new ResultsModel(this);
+  ui->resultsView->setModel(results);
+  ui->resultsView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+  ui->typeFilter->addItem("All types", ~0u);
+  for (int i = 0; i < metric::FORMATS; ++i) {
+    QString name = QString::fromStdString(RecoveryEngine::formatName(i));
+    for (QCheckBox *cb : fileTypeCheckboxes)
+      if (cb->text().trimmed() == name) ui->typeFilter->addItem(name, 1u << i);
+  }
+  connect(ui->typeFilter, QOverload<int>::of(&QComboBox::currentIndexChanged),
+          this, &MainWindow::applyResultFilter);
+  connect(ui->minSizeBox, QOverload<int>::of(&QSpinBox::valueChanged), this,
+          &MainWindow::applyResultFilter);
+  connect(ui->maxSizeBox, QOverload<int>::of(&QSpinBox::valueChanged), this,
+          &MainWindow::applyResultFilter);
+  applyResultFilter();
+
+  // Double-clicking a result shows its bytes on the device.
+  hexView = new HexView;
+  ui->resultTabs->addTab(hexView, "Hex");
+  connect(ui->resultsView, &QTableView::doubleClicked, this,
+          &MainWindow::showResultBytes);
+
+  // Thumbnails are made off the GUI thread for the rows on screen; the
+  // current row's preview is shown beside the table.
+  previews = new PreviewCache(this);
+  results->setPreviews(previews);
+  ui->resultsView->setIconSize(QSize(32, 32));
+  ui->resultsView->verticalHeader()->setDefaultSectionSize(
+      std::max(fontMetrics().height() + 6, 36));
+  connect(ui->resultsView->selectionModel(),
+          &QItemSelectionModel::currentRowChanged, this,
+          &MainWindow::showPreview);
+  connect(previews, &PreviewCache::previewReady, this,
+          &MainWindow::showPreview);
+
+  // The read limit also applies to a scan already running.
+  connect(ui->rateLimitBox, QOverload<int>::of(&QSpinBox::valueChanged), this,
+          &MainWindow::applyRateLimit);
 }
 
 MainWindow::~MainWindow() { delete ui; }
@@ -39,20 +124,49 @@ void MainWindow::on_selectDirButton_clicked() {
     devicePaths << "/dev/" + entry;
   }
 
-  if (devicePaths.isEmpty()) {
-    QMessageBox::information(
-        this, "No Devices",
-        "No raw block devices found (e.g., /dev/sdX, loop, etc.).");
-    return;
-  }
+  // Image files picked earlier stay in the list.
+  for (const QString &device : selectedDevices)
+    if (!devicePaths.contains(device)) devicePaths << device;
 
-  bool ok;
-  QString selectedDevice = QInputDialog::getItem(
-      this, "Select Raw Device", "Choose a device to scan:", devicePaths, 0,
-      false, &ok);
-  if (ok && !selectedDevice.isEmpty()) {
-    selectedDir = selectedDevice;
-    ui->logBox->append("Selected device: " + selectedDir);
+  // Several devices may be picked; they are scanned at the same time.
+  QDialog dialog(this);
+  dialog.setWindowTitle("Select Devices or Images");
+  auto *layout = new QVBoxLayout(&dialog);
+  layout->addWidget(new QLabel("Choose the devices or images to scan:"));
+  auto *list = new QListWidget;
+  list->setSelectionMode(QAbstractItemView::ExtendedSelection);
+  list->addItems(devicePaths);
+  for (int i = 0; i < list->count(); ++i)
+    list->item(i)->setSelected(selectedDevices.contains(list->item(i)->text()));
+  layout->addWidget(list);
+  auto *buttons =
+      new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel);
+  // Raw, split, gzip, zstd and qcow2 images are read in place.
+  QPushButton *addImages =
+      buttons->addButton("Add Image Files...", QDialogButtonBox::ActionRole);
+  connect(addImages, &QPushButton::clicked, &dialog, [&dialog, list]() {
+    QStringList files = QFileDialog::getOpenFileNames(
+        &dialog, "Select Disk Images", QString(),
+        "Disk images (*.img *.dd *.raw *.bin *.001 *.gz *.zst *.qcow2);;"
+        "All files (*)");
+    for (const QString &file : files) {
+      QList<QListWidgetItem *> existing = list->findItems(file, Qt::MatchExactly);
+      QListWidgetItem *item =
+          existing.isEmpty() ? new QListWidgetItem(file, list) : existing[0];
+      item->setSelected(true);
+    }
+  });
+  connect(buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+  connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+  layout->addWidget(buttons);
+  if (dialog.exec() != QDialog::Accepted) return;
+
+  QStringList chosen;
+  for (int i = 0; i < list->count(); ++i)
+    if (list->item(i)->isSelected()) chosen << list->item(i)->text();
+  if (!chosen.isEmpty()) {
+    selectedDevices = chosen;
+    ui->logBox->append("Selected devices: " + selectedDevices.join(", "));
   }
 }
 
@@ -91,7 +205,7 @@ void MainWindow::on_startRecoveryButton_clicked() {
                          "Please select at least one file format to recover.");
     return;
   }
-  if (selectedDir.isEmpty()) {
+  if (selectedDevices.isEmpty()) {
     QMessageBox::warning(this, "No Drive", "Please select the drive to scan.");
     return;
   }
@@ -102,35 +216,64 @@ void MainWindow::on_startRecoveryButton_clicked() {
   }
 
   ui->logBox->append("Starting recovery...");
-  ui->logBox->append("From: " + selectedDir);
+  ui->logBox->append("From: " + selectedDevices.join(", "));
   ui->logBox->append("To: " + outputDir);
   ui->logBox->append("Formats: " + selectedFormats.join(", "));
 
   ui->progressBar->setValue(0);
+  results->clear();
+  ui->resultCountLabel->setText(resultCount(*results));
   ui->startRecoveryButton->setEnabled(false);
   ui->cancelRecoveryButton->setEnabled(true);
   cancelRequested = false;
+  bool freeSpaceOnly = ui->checkBoxFreeSpace->isChecked();
+  bool metadataRecovery = ui->checkBoxMetadata->isChecked();
 
-  QtConcurrent::run([=]() {
-    RecoveryEngine engine(selectedDir, outputDir, File_Supported);
-
-    auto logCallback = [=](const QString &msg) {
-      QMetaObject::invokeMethod(ui->logBox, "append", Qt::QueuedConnection,
-                                Q_ARG(QString, msg));
-    };
+  std::vector<std::string> devices;
+  for (const QString &device : selectedDevices)
+    devices.push_back(device.toStdString());
+  auto batch = std::make_shared<ScanBatch>(devices, outputDir.toStdString(),
+                                           File_Supported);
+  batch->setFreeSpaceOnly(freeSpaceOnly);
+  batch->setMetadataRecovery(metadataRecovery);
+  if (ui->checkBoxBackground->isChecked()) {
+    batch->setIdleOnly(true);
+    IoPriority idle;
+    idle.ioClass = IoClass::Idle;
+    batch->setIoPriority(idle);
+  }
+  activeBatch = batch;
+  applyRateLimit();
+  scanDevices = selectedDevices;
+  previews->setDevices(scanDevices);
+  scanClock.start();
+  drainTimer->start();
 
-    auto progressCallback = [=](int percent) {
-      QMetaObject::invokeMethod(ui->progressBar, "setValue",
-                                Qt::QueuedConnection, Q_ARG(int, percent));
+  QtConcurrent::run([=]() {
+    // Candidates and rejections are not shown. Only the latest progress
+    // matters, so a full ring just drops it; anything else holds the scan
+    // back rather than losing a log line.
+    auto eventCallback = [=](const ScanEvent &event) {
+      if (event.type == ScanEvent::CandidateFound ||
+          event.type == ScanEvent::CandidateRejected)
+        return;
+      if (event.type == ScanEvent::Progress) {
+        events.tryPush(event);
+        return;
+      }
+      while (!events.tryPush(event)) QThread::msleep(1);
     };
 
     auto cancelCheck = [=]() -> bool { return cancelRequested.load(); };
 
-    bool success = engine.run(logCallback, progressCallback, cancelCheck);
+    bool success = batch->run(eventCallback, cancelCheck);
 
     QMetaObject::invokeMethod(
         this,
         [=]() {
+          drainEvents();
+          drainTimer->stop();
+          activeBatch.reset();
           ui->startRecoveryButton->setEnabled(true);
           ui->cancelRecoveryButton->setEnabled(false);
           ui->logBox->append(success ? "Recovery completed successfully."
@@ -146,3 +289,143 @@ void MainWindow::on_cancelRecoveryButton_clicked() {
   ui->logBox->append("[!] Cancel requested by user.");
   ui->cancelRecoveryButton->setEnabled(false);
 }
+
+void MainWindow::drainEvents() {
+  // At most one ring's worth per tick so a busy scan cannot starve the GUI.
+  QStringList lines;
+  std::vector<ScanEvent> carved;
+  int progress = -1;
+  ScanEvent event;
+  bool tagDevices = activeBatch && activeBatch->size() > 1;
+  for (int i = 0; i < EVENT_CAPACITY && events.tryPop(event); ++i) {
+    // The bar shows the whole batch; per-device progress is in the status.
+    if (event.type == ScanEvent::Progress) {
+      if (event.device < 0) progress = event.percent;
+      continue;
+    }
+    QString line = QString::fromStdString(describeEvent(event));
+    if (tagDevices && event.device >= 0)
+      line = "[" +
+             QFileInfo(QString::fromStdString(
+                           activeBatch->device(event.device)))
+                 .fileName() +
+             "] " + line;
+    lines << line;
+    if (event.type == ScanEvent::FileCarved) carved.push_back(event);
+  }
+  if (!lines.isEmpty()) ui->logBox->append(lines.join('\n'));
+  if (!carved.empty()) {
+    results->append(carved);
+    ui->resultCountLabel->setText(resultCount(*results));
+  }
+  if (progress >= 0) ui->progressBar->setValue(progress);
+
+  if (activeBatch) {
+    ScanStats stats = activeBatch->stats();
+    stats.elapsedNanos = scanClock.nsecsElapsed();
+    QString message = statsSummary(stats);
+    if (tagDevices) {
+      QStringList perDevice;
+      for (size_t i = 0; i < activeBatch->size(); ++i)
+        perDevice << QString("%1 %2%")
+                         .arg(QFileInfo(QString::fromStdString(
+                                            activeBatch->device(i)))
+                                  .fileName())
+                         .arg(activeBatch->progress(i));
+      message += " | " + perDevice.join(", ");
+    }
+    ui->statusBar->showMessage(message);
+  }
+}
+
+void MainWindow::applyRateLimit() {
+  if (activeBatch)
+    activeBatch->setTotalBandwidth(ui->rateLimitBox->value() * 1024.0 * 1024);
+}
+
+void MainWindow::applyResultFilter() {
+  uint32_t formatMask = ui->typeFilter->currentData().toUInt();
+  results->setFilter(formatMask, uint64_t(ui->minSizeBox->value()) * 1024,
+                     uint64_t(ui->maxSizeBox->value()) * 1024);
+  ui->resultCountLabel->setText(resultCount(*results));
+}
+
+void MainWindow::showResultBytes(const QModelIndex &index) {
+  if (!index.isValid()) return;
+  ResultsModel::Result result = results->result(index.row());
+  if (result.device < 0 || result.device >= scanDevices.size()) return;
+  QString path = scanDevices[result.device];
+  auto show = [this, result]() {
+    hexView->setHighlight(result.offset,
+                          RecoveryEngine::signatureLength(result.format),
+                          result.offset, result.length);
+    hexView->goTo(result.offset);
+    ui->resultTabs->setCurrentWidget(hexView);
+  };
+  if (path == hexDevicePath && hexView->device()) {
+    show();
+    return;
+  }
+
+  // Raw devices open at once, but a compressed image is indexed first, so
+  // the device is opened off the GUI thread.
+  ui->statusBar->showMessage("Opening " + path + "...");
+  QtConcurrent::run([=]() {
+    std::string error;
+    std::shared_ptr<PageCache> device =
+        PageCache::open(path.toStdString(), error);
+    QMetaObject::invokeMethod(
+        this,
+        [=]() {
+          if (!device) {
+            QMessageBox::warning(this, "Hex View",
+                                 QString::fromStdString(error));
+            return;
+          }
+          if (!error.empty())
+            ui->logBox->append(QString::fromStdString(error));
+          hexDevicePath = path;
+          hexView->setDevice(device);
+          show();
+        },
+        Qt::QueuedConnection);
+  });
+}
+
+// A catalog from a `--catalog` scan lists candidates without carving them;
+// they can be browsed and previewed here, straight from the device.
+void MainWindow::on_openCatalogButton_clicked() {
+  QString file = QFileDialog::getOpenFileName(
+      this, "Open Catalog", outputDir,
+      "Catalogs (*.idx);;All files (*)");
+  if (file.isEmpty()) return;
+  CatalogFile catalog;
+  std::string error;
+  if (!catalog.open(file.toStdString(), error)) {
+    QMessageBox::warning(this, "Open Catalog", QString::fromStdString(error));
+    return;
+  }
+  scanDevices = QStringList{QString::fromStdString(catalog.devicePath())};
+  previews->setDevices(scanDevices);
+  results->clear();
+  results->append(catalog.begin(), catalog.end(), 0);
+  ui->resultCountLabel->setText(resultCount(*results));
+  ui->logBox->append(QString("Loaded %1 candidates on %2 from %3")
+                         .arg(catalog.size())
+                         .arg(scanDevices[0])
+                         .arg(file));
+}
+
+void MainWindow::showPreview() {
+  QModelIndex current = ui->resultsView->currentIndex();
+  ui->previewImage->clear();
+  ui->previewText->clear();
+  if (!current.isValid()) return;
+  const ResultsModel::Result &result = results->result(current.row());
+  const PreviewCache::Preview *preview = previews->preview(
+      result.device, result.offset, result.length, result.format);
+  if (!preview) return;
+  if (!preview->image.isNull())
+    ui->previewImage->setPixmap(QPixmap::fromImage(preview->image));
+  ui->previewText->setText(preview->text);
+}
@@ -2,10 +2,21 @@
 #define MAINWINDOW_H
 
 #include <QCheckBox>
+#include <QElapsedTimer>
 #include <QFuture>
 #include <QMainWindow>
+#include <QTimer>
 #include <QtConcurrent>
 #include <atomic>
+#include <memory>
+
+#include "../mpscring.h"
+#include "../scanevent.h"
+#include "hexview.h"
+#include "previewcache.h"
+#include "resultsmodel.h"
+
+class ScanBatch;
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -25,13 +36,34 @@ class MainWindow : public QMainWindow {
   void on_selectOutputButton_clicked();
   void on_cancelRecoveryButton_clicked();
   void on_startRecoveryButton_clicked();
+  void drainEvents();
+  void applyResultFilter();
+  void showResultBytes(const QModelIndex &index);
+  void on_openCatalogButton_clicked();
+  void showPreview();
+  void applyRateLimit();
 
  private:
   Ui::MainWindow *ui;
   std::atomic_bool cancelRequested = false;
-  QString selectedDir;
+  QStringList selectedDevices;
   QString outputDir;
   QList<QCheckBox *> fileTypeCheckboxes;
+
+  // The scan threads push engine events here; drainTimer empties the ring
+  // on the GUI thread, so a dense disk cannot flood the event loop.
+  static const int EVENT_CAPACITY = 8192;
+  MpscRing<ScanEvent, EVENT_CAPACITY> events;
+  QTimer *drainTimer;
+  std::shared_ptr<ScanBatch> activeBatch;
+  QElapsedTimer scanClock;
+  ResultsModel *results;
+  // The devices of the last scan, which results refer to by position, and
+  // the one open in the hex view.
+  QStringList scanDevices;
+  QString hexDevicePath;
+  HexView *hexView;
+  PreviewCache *previews;
 };
 
 #endif  // MAINWINDOW_H
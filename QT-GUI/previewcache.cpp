@@ -0,0 +1,194 @@
+#include "previewcache.h"
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QtConcurrent>
+#include <algorithm>
+
+#ifdef HAVE_QTPDF
+#include <QPdfDocument>
+#endif
+
+#include "../imagereaders.h"
+#include "../mediainfo.h"
+#include "../recoveryengine.h"
+
+// Bytes read for a decoded preview; larger candidates are cut short, which
+// a thumbnail survives.
+static constexpr quint64 MAX_IMAGE_BYTES = 32 * 1024 * 1024;
+static constexpr quint64 MAX_PDF_BYTES = 64 * 1024 * 1024;
+
+static bool canPreview(const std::string &format) {
+  return format == "PNG" || format == "JPEG" || format == "PDF" ||
+         format == "MP3" || format == "MP4";
+}
+
+PreviewCache::PreviewCache(QObject *parent) : QObject(parent) {
+  cache.setMaxCost(MAX_KB);
+  // Previews share the disk with the scan; more readers would only seek.
+  pool.setMaxThreadCount(2);
+}
+
+PreviewCache::~PreviewCache() {
+  {
+    QMutexLocker guard(&lock);
+    pending.clear();
+  }
+  pool.waitForDone();
+}
+
+void PreviewCache::setDevices(const QStringList &paths) {
+  ++generation;
+  cache.clear();
+  requested.clear();
+  QMutexLocker guard(&lock);
+  pending.clear();
+  devicePaths = paths;
+  readers.clear();
+}
+
+const PreviewCache::Preview *PreviewCache::preview(int device, quint64 offset,
+                                                   quint64 length,
+                                                   int format) {
+  Key key(device, offset);
+  if (const Preview *ready = cache.object(key)) return ready;
+  if (requested.contains(key) ||
+      !canPreview(RecoveryEngine::formatName(format)))
+    return nullptr;
+
+  requested.insert(key);
+  {
+    QMutexLocker guard(&lock);
+    pending.push_front({key, length, format, generation});
+    if (pending.size() > static_cast<size_t>(MAX_PENDING)) {
+      requested.remove(pending.back().key);
+      pending.pop_back();
+    }
+  }
+  QtConcurrent::run(&pool, [this]() { work(); });
+  return nullptr;
+}
+
+// One request per call, the newest waiting.
+void PreviewCache::work() {
+  Request request;
+  {
+    QMutexLocker guard(&lock);
+    if (pending.empty()) return;
+    request = pending.front();
+    pending.pop_front();
+  }
+  if (request.generation != generation) return;
+
+  std::shared_ptr<BlockReader> device = reader(request.key.first);
+  Preview result;
+  if (device)
+    result = decode(request, *device);
+  else
+    result.text = "The device cannot be opened";
+
+  QMetaObject::invokeMethod(
+      this,
+      [this, request, result]() {
+        if (request.generation != generation) return;
+        requested.remove(request.key);
+        int cost = static_cast<int>(result.image.sizeInBytes() / 1024) + 1;
+        cache.insert(request.key, new Preview(result), cost);
+        emit previewReady(request.key.first, request.key.second);
+      },
+      Qt::QueuedConnection);
+}
+
+// Devices are opened on first use, off the GUI thread; a compressed image
+// is indexed then. A device that fails to open is not tried again.
+std::shared_ptr<BlockReader> PreviewCache::reader(int device) {
+  QString path;
+  quint64 openedFor = generation;
+  {
+    QMutexLocker guard(&lock);
+    auto it = readers.find(device);
+    if (it != readers.end()) return it->second;
+    if (device < 0 || device >= devicePaths.size()) return nullptr;
+    path = devicePaths[device];
+  }
+
+  uint64_t size = 0;
+  std::string error;
+  std::string file = path.toStdString();
+  std::shared_ptr<BlockReader> opened = openImage(
+      file, detectImageFormat(file), IoBackend::Pread, size, error);
+
+  QMutexLocker guard(&lock);
+  if (openedFor != generation) return nullptr;
+  return readers.emplace(device, opened).first->second;
+}
+
+PreviewCache::Preview PreviewCache::decode(const Request &request,
+                                           BlockReader &device) const {
+  Preview preview;
+  quint64 offset = request.key.second;
+  std::string format = RecoveryEngine::formatName(request.format);
+  auto readBytes = [&](quint64 limit) {
+    QByteArray bytes(static_cast<int>(std::min(request.length, limit)), '\0');
+    bytes.resize(static_cast<int>(device.readAt(
+        offset, reinterpret_cast<unsigned char *>(bytes.data()),
+        bytes.size())));
+    return bytes;
+  };
+
+  if (format == "PNG" || format == "JPEG") {
+    QByteArray bytes = readBytes(MAX_IMAGE_BYTES);
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader image(&buffer, format == "PNG" ? "png" : "jpeg");
+    QSize size = image.size();
+    // JPEG decodes straight to the smaller size, skipping most of the work.
+    if (size.width() > THUMBNAIL_SIZE || size.height() > THUMBNAIL_SIZE)
+      image.setScaledSize(
+          size.scaled(THUMBNAIL_SIZE, THUMBNAIL_SIZE, Qt::KeepAspectRatio));
+    preview.image = image.read();
+    preview.text = preview.image.isNull()
+                       ? QString("Cannot be decoded")
+                       : QString("%1 x %2").arg(size.width()).arg(size.height());
+  } else if (format == "PDF") {
+    QByteArray bytes = readBytes(MAX_PDF_BYTES);
+#ifdef HAVE_QTPDF
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::ReadOnly);
+    QPdfDocument document;
+    document.load(&buffer);
+    if (document.pageCount() > 0) {
+      QSize page = document.pagePointSize(0).toSize().scaled(
+          THUMBNAIL_SIZE, THUMBNAIL_SIZE, Qt::KeepAspectRatio);
+      preview.image = document.render(0, page);
+      preview.text = QString("%1 pages").arg(document.pageCount());
+    }
+#endif
+    if (preview.text.isEmpty() && bytes.startsWith("%PDF-"))
+      preview.text = "PDF " + QString::fromLatin1(bytes.mid(5, 3));
+  } else if (format == "MP3") {
+    Mp3Tags tags;
+    if (readMp3Tags(device, offset, request.length, tags)) {
+      QStringList fields;
+      for (const std::string &field : {tags.title, tags.artist, tags.album})
+        if (!field.empty()) fields << QString::fromStdString(field);
+      preview.text = fields.join(" - ");
+    } else {
+      preview.text = "No tags";
+    }
+  } else if (format == "MP4") {
+    Mp4Info info;
+    if (readMp4Info(device, offset, info)) {
+      preview.text = QString::fromStdString(info.brand).trimmed();
+      if (info.seconds > 0) {
+        qint64 seconds = static_cast<qint64>(info.seconds + 0.5);
+        preview.text += QString(", %1:%2")
+                            .arg(seconds / 60)
+                            .arg(seconds % 60, 2, 10, QLatin1Char('0'));
+      }
+    }
+  }
+  return preview;
+}
@@ -0,0 +1,84 @@
+#ifndef PREVIEWCACHE_H
+#define PREVIEWCACHE_H
+
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+
+class BlockReader;
+
+// Previews of results and catalog candidates: image thumbnails, the first
+// page of a PDF (when Qt was built with QtPdf), MP3 tags and MP4 brand and
+// duration. They are decoded on a small thread pool straight from the
+// candidate's bytes on the device; nothing is carved or written.
+//
+// Finished previews stay in a QCache bounded by MAX_KB, least recently used
+// first out. Requests are served newest first and only the latest
+// MAX_PENDING are kept, so scrolling quickly through thousands of rows only
+// decodes what ends up on screen.
+class PreviewCache : public QObject {
+  Q_OBJECT
+
+ public:
+  using Key = QPair<int, quint64>;  // device position, offset
+
+  struct Preview {
+    QImage image;  // at most THUMBNAIL_SIZE on a side; null without one
+    QString text;  // one line: dimensions, tags, duration, ...
+  };
+
+  static constexpr int THUMBNAIL_SIZE = 128;
+  static constexpr int MAX_KB = 64 * 1024;
+  static constexpr int MAX_PENDING = 256;
+
+  explicit PreviewCache(QObject *parent = nullptr);
+  ~PreviewCache();
+
+  // Devices that keys refer to by position. Clears the cache.
+  void setDevices(const QStringList &paths);
+
+  // The preview of the `format` candidate at `offset` on `device`, or null
+  // while it is being made; previewReady() follows. Must be called on the
+  // GUI thread.
+  const Preview *preview(int device, quint64 offset, quint64 length,
+                         int format);
+
+ signals:
+  void previewReady(int device, quint64 offset);
+
+ private:
+  struct Request {
+    Key key;
+    quint64 length;
+    int format;
+    quint64 generation;
+  };
+
+  void work();
+  Preview decode(const Request &request, BlockReader &device) const;
+  std::shared_ptr<BlockReader> reader(int device);
+
+  QCache<Key, Preview> cache;  // GUI thread only
+  QSet<Key> requested;         // GUI thread only: queued or decoding
+  QThreadPool pool;
+
+  QMutex lock;  // guards the members below
+  std::deque<Request> pending;  // newest first
+  QStringList devicePaths;
+  std::map<int, std::shared_ptr<BlockReader>> readers;
+  // Bumped by setDevices() so previews of the old devices are dropped.
+  std::atomic<quint64> generation{0};
+};
+
+#endif  // PREVIEWCACHE_H
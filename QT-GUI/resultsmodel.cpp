@@ -0,0 +1,268 @@
+#include "resultsmodel.h"
+
+#include <QLocale>
+#include <algorithm>
+
+#include "../recoveryengine.h"
+#include "previewcache.h"
+
+// Formats are looked up by index on every paint and every sort comparison,
+// so their names are converted once.
+static const QStringList &formatNames() {
+  static const QStringList names = []() {
+    QStringList list;
+    for (int i = 0; i < metric::FORMATS; ++i)
+      list << QString::fromStdString(RecoveryEngine::formatName(i));
+    return list;
+  }();
+  return names;
+}
+
+static QString typeName(int format) {
+  return format >= 0 && format < formatNames().size() ? formatNames()[format]
+                                                      : QString("?");
+}
+
+ResultsModel::ResultsModel(QObject *parent) : QAbstractTableModel(parent) {}
+
+int ResultsModel::rowCount(const QModelIndex &parent) const {
+  return parent.isValid() ? 0 : static_cast<int>(fetched);
+}
+
+int ResultsModel::columnCount(const QModelIndex &parent) const {
+  return parent.isValid() ? 0 : COLUMN_COUNT;
+}
+
+QVariant ResultsModel::data(const QModelIndex &index, int role) const {
+  if (!index.isValid() || index.row() >= static_cast<int>(fetched))
+    return QVariant();
+  const Result &row = result(index.row());
+  if (previews && index.column() == Type &&
+      (role == Qt::DecorationRole || role == Qt::ToolTipRole)) {
+    const PreviewCache::Preview *preview =
+        previews->preview(row.device, row.offset, row.length, row.format);
+    if (!preview) return QVariant();
+    if (role == Qt::ToolTipRole)
+      return preview->text.isEmpty() ? QVariant() : preview->text;
+    return preview->image.isNull() ? QVariant() : preview->image;
+  }
+  if (role == Qt::TextAlignmentRole)
+    return index.column() == Offset || index.column() == Size
+               ? QVariant(int(Qt::AlignRight | Qt::AlignVCenter))
+               : QVariant();
+  if (role == Qt::ToolTipRole && index.column() == Status)
+    return QString("confidence %1%").arg(qRound(row.confidence * 100));
+  if (role != Qt::DisplayRole) return QVariant();
+
+  switch (index.column()) {
+    case Offset:
+      return QString("0x%1").arg(row.offset, 0, 16);
+    case Size:
+      return QLocale().formattedDataSize(static_cast<qint64>(row.length));
+    case Type:
+      return typeName(row.format);
+    case Status:
+      return row.catalogued ? QString("not carved")
+                            : QString(integrityName(row.integrity));
+    case Path:
+      return QString::fromStdString(row.path);
+  }
+  return QVariant();
+}
+
+QVariant ResultsModel::headerData(int section, Qt::Orientation orientation,
+                                  int role) const {
+  if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+    return QAbstractTableModel::headerData(section, orientation, role);
+  switch (section) {
+    case Offset:
+      return QString("Offset");
+    case Size:
+      return QString("Size");
+    case Type:
+      return QString("Type");
+    case Status:
+      return QString("Status");
+    case Path:
+      return QString("Path");
+  }
+  return QVariant();
+}
+
+bool ResultsModel::canFetchMore(const QModelIndex &parent) const {
+  return !parent.isValid() && fetched < visible.size();
+}
+
+void ResultsModel::fetchMore(const QModelIndex &parent) {
+  if (parent.isValid()) return;
+  size_t count =
+      std::min(visible.size() - fetched, static_cast<size_t>(FETCH_BATCH));
+  if (count == 0) return;
+  beginInsertRows(QModelIndex(), static_cast<int>(fetched),
+                  static_cast<int>(fetched + count - 1));
+  fetched += count;
+  endInsertRows();
+}
+
+void ResultsModel::sort(int column, Qt::SortOrder order) {
+  sortColumn = column >= 0 && column < COLUMN_COUNT ? column : -1;
+  sortOrder = order;
+  reorder(0);
+}
+
+void ResultsModel::append(const std::vector<ScanEvent> &events) {
+  size_t before = visible.size();
+  for (const ScanEvent &event : events) {
+    if (event.type != ScanEvent::FileCarved) continue;
+    Result row;
+    row.offset = event.offset;
+    row.length = event.length;
+    row.format = event.format;
+    row.device = event.device;
+    row.integrity = event.integrity;
+    row.confidence = event.confidence;
+    row.path = event.path;
+    rows.push_back(std::move(row));
+    if (accepts(rows.back()))
+      visible.push_back(static_cast<uint32_t>(rows.size() - 1));
+  }
+  appended(before);
+}
+
+void ResultsModel::append(const CatalogEntry *begin, const CatalogEntry *end,
+                          int device) {
+  size_t before = visible.size();
+  rows.reserve(rows.size() + (end - begin));
+  for (const CatalogEntry *entry = begin; entry != end; ++entry) {
+    Result row;
+    row.offset = entry->offset;
+    row.length = entry->length;
+    row.format = entry->format;
+    row.device = device;
+    row.confidence = entry->confidence;
+    row.catalogued = true;
+    rows.push_back(std::move(row));
+    if (accepts(rows.back()))
+      visible.push_back(static_cast<uint32_t>(rows.size() - 1));
+  }
+  appended(before);
+}
+
+void ResultsModel::setPreviews(PreviewCache *cache) {
+  previews = cache;
+  // A finished preview repaints the Type column; the view only redraws the
+  // rows it shows, so there is no need to find the row.
+  connect(previews, &PreviewCache::previewReady, this, [this]() {
+    if (fetched == 0) return;
+    emit dataChanged(index(0, Type),
+                     index(static_cast<int>(fetched) - 1, Type),
+                     {Qt::DecorationRole, Qt::ToolTipRole});
+  });
+}
+
+void ResultsModel::appended(size_t before) {
+  if (visible.size() == before) return;
+
+  // A view that has seen every row gets the new ones straight away; one
+  // still fetching picks them up with its next batch.
+  if (fetched == before) {
+    beginInsertRows(QModelIndex(), static_cast<int>(before),
+                    static_cast<int>(visible.size() - 1));
+    fetched = visible.size();
+    endInsertRows();
+  }
+  if (sortColumn >= 0) reorder(before);
+}
+
+void ResultsModel::clear() {
+  beginResetModel();
+  rows.clear();
+  visible.clear();
+  fetched = 0;
+  endResetModel();
+}
+
+void ResultsModel::setFilter(uint32_t formats, uint64_t minimum,
+                             uint64_t maximum) {
+  beginResetModel();
+  formatMask = formats;
+  minSize = minimum;
+  maxSize = maximum;
+  visible.clear();
+  for (size_t i = 0; i < rows.size(); ++i)
+    if (accepts(rows[i])) visible.push_back(static_cast<uint32_t>(i));
+  if (sortColumn >= 0)
+    std::sort(visible.begin(), visible.end(),
+              [this](uint32_t a, uint32_t b) { return lessThan(a, b); });
+  fetched = std::min(visible.size(), static_cast<size_t>(FETCH_BATCH));
+  endResetModel();
+}
+
+bool ResultsModel::accepts(const Result &result) const {
+  bool knownFormat = result.format >= 0 && result.format < 32;
+  return (!knownFormat || formatMask & (1u << result.format)) &&
+         result.length >= minSize && (maxSize == 0 || result.length <= maxSize);
+}
+
+// Ties keep arrival order, so the order is total and std::sort is enough.
+bool ResultsModel::lessThan(uint32_t a, uint32_t b) const {
+  const Result &x = rows[a];
+  const Result &y = rows[b];
+  int c = 0;
+  switch (sortColumn) {
+    case Offset:
+      c = x.device != y.device ? (x.device < y.device ? -1 : 1)
+          : x.offset != y.offset ? (x.offset < y.offset ? -1 : 1)
+                                 : 0;
+      break;
+    case Size:
+      c = x.length != y.length ? (x.length < y.length ? -1 : 1) : 0;
+      break;
+    case Type:
+      c = typeName(x.format).compare(typeName(y.format));
+      break;
+    case Status:
+      c = x.integrity != y.integrity ? (x.integrity < y.integrity ? -1 : 1)
+                                     : 0;
+      break;
+    case Path:
+      c = x.path.compare(y.path);
+      break;
+  }
+  if (c != 0) return sortOrder == Qt::AscendingOrder ? c < 0 : c > 0;
+  return a < b;
+}
+
+void ResultsModel::reorder(size_t from) {
+  emit layoutAboutToBeChanged({}, QAbstractItemModel::VerticalSortHint);
+  QModelIndexList persistent = persistentIndexList();
+  std::vector<uint32_t> persistentRows;
+  for (const QModelIndex &index : persistent)
+    persistentRows.push_back(visible[index.row()]);
+
+  auto less = [this](uint32_t a, uint32_t b) {
+    return sortColumn >= 0 ? lessThan(a, b) : a < b;
+  };
+  if (from == 0) {
+    std::sort(visible.begin(), visible.end(), less);
+  } else {
+    std::sort(visible.begin() + from, visible.end(), less);
+    std::inplace_merge(visible.begin(), visible.begin() + from, visible.end(),
+                       less);
+  }
+
+  // Persistent indexes are the selection and the current cell; the map back
+  // from row to position is only built when the view holds some.
+  if (!persistent.isEmpty()) {
+    std::vector<int> position(rows.size(), -1);
+    for (size_t i = 0; i < fetched; ++i)
+      position[visible[i]] = static_cast<int>(i);
+    QModelIndexList moved;
+    for (int i = 0; i < persistent.size(); ++i) {
+      int row = position[persistentRows[i]];
+      moved << (row < 0 ? QModelIndex() : index(row, persistent[i].column()));
+    }
+    changePersistentIndexList(persistent, moved);
+  }
+  emit layoutChanged({}, QAbstractItemModel::VerticalSortHint);
+}
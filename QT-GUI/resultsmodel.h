@@ -0,0 +1,94 @@
+#ifndef RESULTSMODEL_H
+#define RESULTSMODEL_H
+
+#include <QAbstractTableModel>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../catalog.h"
+#include "../scanevent.h"
+
+class PreviewCache;
+
+// The recovered files of a scan, for a QTableView. Rows are kept as plain
+// structs and turned into text only when the view paints them, and the view
+// sees them through `visible`, an index over the rows that pass the filter
+// in the current sort order. Filtering and sorting rebuild that index and
+// never touch the rows, so a million results cost one vector of ints per
+// view, not a million widget items.
+//
+// Rows are handed to the view in FETCH_BATCH steps (canFetchMore/fetchMore)
+// as it scrolls, so opening the table or changing the filter lays out one
+// batch, whatever the result count.
+class ResultsModel : public QAbstractTableModel {
+  Q_OBJECT
+
+ public:
+  enum Column { Offset, Size, Type, Status, Path, COLUMN_COUNT };
+
+  struct Result {
+    uint64_t offset = 0;  // device offset of the file
+    uint64_t length = 0;
+    int format = -1;
+    int device = 0;  // position in the scan's device list
+    ScanEvent::Integrity integrity = ScanEvent::Unverified;
+    float confidence = 0;
+    std::string path;  // empty for a catalogued candidate
+    bool catalogued = false;  // from a catalog, not carved yet
+  };
+
+  static constexpr int FETCH_BATCH = 10000;
+
+  explicit ResultsModel(QObject *parent = nullptr);
+
+  int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+  int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+  QVariant data(const QModelIndex &index,
+                int role = Qt::DisplayRole) const override;
+  QVariant headerData(int section, Qt::Orientation orientation,
+                      int role = Qt::DisplayRole) const override;
+  bool canFetchMore(const QModelIndex &parent) const override;
+  void fetchMore(const QModelIndex &parent) override;
+  void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+  // Adds the FileCarved events among `events`; the rest are ignored.
+  void append(const std::vector<ScanEvent> &events);
+  // Adds catalogued candidates of the scan's `device`th device.
+  void append(const CatalogEntry *begin, const CatalogEntry *end, int device);
+  void clear();
+
+  // Thumbnails (Type column) and preview text (its tooltip) come from
+  // `previews`, which is asked only for the rows the view paints.
+  void setPreviews(PreviewCache *previews);
+
+  // Shows only the formats whose bit is set in `formatMask` (bit = engine
+  // format index) with a size in [minSize, maxSize]; maxSize 0 means no
+  // upper limit.
+  void setFilter(uint32_t formatMask, uint64_t minSize, uint64_t maxSize);
+
+  const Result &result(int row) const { return rows[visible[row]]; }
+  size_t totalCount() const { return rows.size(); }
+  size_t matchCount() const { return visible.size(); }
+
+ private:
+  // Shows and sorts the rows appended since `before` entries were visible.
+  void appended(size_t before);
+  bool accepts(const Result &result) const;
+  bool lessThan(uint32_t a, uint32_t b) const;
+  // Re-sorts `visible`, keeping persistent indexes (the selection) on
+  // their rows. `from` is where the unsorted tail starts; rows before it
+  // are already in order and are merged with the tail rather than re-sorted.
+  void reorder(size_t from);
+
+  std::vector<Result> rows;      // in arrival order
+  std::vector<uint32_t> visible;  // indexes into rows
+  size_t fetched = 0;             // leading entries of visible in the view
+  uint32_t formatMask = ~0u;
+  uint64_t minSize = 0, maxSize = 0;
+  int sortColumn = -1;  // -1: arrival order
+  Qt::SortOrder sortOrder = Qt::AscendingOrder;
+  PreviewCache *previews = nullptr;
+};
+
+#endif  // RESULTSMODEL_H
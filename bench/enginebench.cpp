@@ -0,0 +1,254 @@
+// End-to-end benchmark: runs RecoveryEngine over an image made by imagegen
+// and scores what it recovered against the ground truth.
+//
+// A planted file counts as recovered when some output file of the same
+// format starts with its complete contents (carvers may over-carve past the
+// real end); "exact" additionally requires the sizes to match. Output files
+// that recover nothing, or only repeat an earlier match, lower precision.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../imagereaders.h"
+#include "../recoveryengine.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+struct Planted
+{
+  string format;
+  string layout;
+  uint64_t size;
+  vector<pair<uint64_t, uint64_t>> fragments;
+  bool found = false;
+  bool exact = false;
+};
+
+struct FormatScore
+{
+  int planted = 0;
+  int found = 0;
+  int exact = 0;
+  int output = 0;
+  int matched = 0;
+};
+
+// Formats imagegen plants; also the engine's output directory names.
+static const vector<string> PLANTED_FORMATS = {"PNG", "JPEG", "PDF",
+                                               "ZIP", "MP3", "MP4"};
+
+static vector<Planted> loadTruth(const string &path)
+{
+  vector<Planted> planted;
+  ifstream in(path);
+  string line;
+  getline(in, line); // header
+  while (getline(in, line))
+  {
+    stringstream row(line);
+    string id, size, fragments;
+    Planted p;
+    getline(row, id, ',');
+    getline(row, p.format, ',');
+    getline(row, p.layout, ',');
+    getline(row, size, ',');
+    getline(row, fragments);
+    p.size = stoull(size);
+    stringstream parts(fragments);
+    string part;
+    while (getline(parts, part, '|'))
+    {
+      size_t plus = part.find('+');
+      p.fragments.push_back(
+          {stoull(part.substr(0, plus)), stoull(part.substr(plus + 1))});
+    }
+    planted.push_back(p);
+  }
+  return planted;
+}
+
+// Reads up to `size` bytes of the planted file's logical contents.
+static string plantedBytes(BlockReader &image, const Planted &p, uint64_t from,
+                           size_t size)
+{
+  string out;
+  uint64_t logical = 0;
+  for (const auto &frag : p.fragments)
+  {
+    uint64_t fragEnd = logical + frag.second;
+    if (from < fragEnd && out.size() < size)
+    {
+      uint64_t skip = from > logical ? from - logical : 0;
+      size_t n = min<uint64_t>(frag.second - skip, size - out.size());
+      string chunk(n, '\0');
+      chunk.resize(image.readAt(frag.first + skip,
+                                reinterpret_cast<unsigned char *>(&chunk[0]), n));
+      out += chunk;
+      from = fragEnd;
+    }
+    logical = fragEnd;
+  }
+  return out;
+}
+
+// True when `recovered` begins with the whole planted file.
+static bool containsPlanted(BlockReader &image, const Planted &p,
+                            const string &recovered)
+{
+  ifstream in(recovered, ios::binary);
+  const size_t CHUNK = 1 << 20;
+  string got(CHUNK, '\0');
+  for (uint64_t pos = 0; pos < p.size; pos += CHUNK)
+  {
+    size_t n = min<uint64_t>(CHUNK, p.size - pos);
+    in.read(&got[0], n);
+    if (static_cast<size_t>(in.gcount()) != n ||
+        got.compare(0, n, plantedBytes(image, p, pos, n)) != 0)
+      return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3)
+  {
+    cerr << "usage: enginebench <image> <truth.csv> [--out dir] [--keep] "
+            "[--threads N] [--carve-threads N] [--io stream|pread|mmap]\n";
+    return 2;
+  }
+  string imagePath = argv[1];
+  vector<Planted> planted = loadTruth(argv[2]);
+  fs::path outDir = fs::temp_directory_path() /
+                    ("enginebench-" + to_string(getpid()));
+  bool keep = false;
+  unsigned threads = 1;
+  int carveThreads = -1;
+  IoBackend backend = IoBackend::Stream;
+  for (int i = 3; i < argc; ++i)
+  {
+    if (string(argv[i]) == "--out" && i + 1 < argc)
+      outDir = argv[++i];
+    else if (string(argv[i]) == "--threads" && i + 1 < argc)
+      threads = strtoul(argv[++i], nullptr, 10);
+    else if (string(argv[i]) == "--carve-threads" && i + 1 < argc)
+      carveThreads = strtoul(argv[++i], nullptr, 10);
+    else if (string(argv[i]) == "--io" && i + 1 < argc)
+      parseIoBackend(argv[++i], backend);
+    else if (string(argv[i]) == "--keep")
+      keep = true;
+  }
+  fs::remove_all(outDir);
+  fs::create_directories(outDir);
+
+  vector<bool> formats(10, false);
+  for (const string &name : PLANTED_FORMATS)
+    formats[RecoveryEngine::formatIndex(name)] = true;
+  RecoveryEngine engine(imagePath, outDir.string(), formats);
+  engine.setThreads(threads);
+  if (carveThreads >= 0)
+    engine.setCarveThreads(carveThreads);
+  engine.setIoBackend(backend);
+
+  auto begin = chrono::steady_clock::now();
+  engine.run([](const ScanEvent &) {}, []() { return false; });
+  double seconds =
+      chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  // Compressed and split images are compared by their contents too.
+  uint64_t imageSize = 0;
+  string openError;
+  unique_ptr<BlockReader> image =
+      openImage(imagePath, detectImageFormat(imagePath), IoBackend::Pread,
+                imageSize, openError);
+  if (!image)
+  {
+    cerr << openError << "\n";
+    return 1;
+  }
+
+  // Index planted files by their first bytes so each output file is only
+  // compared with plausible candidates.
+  const size_t KEY = 64;
+  map<string, FormatScore> scores;
+  multimap<string, size_t> byPrefix;
+  for (size_t i = 0; i < planted.size(); ++i)
+  {
+    scores[planted[i].format].planted++;
+    byPrefix.insert({plantedBytes(*image, planted[i], 0, KEY), i});
+  }
+
+  uint64_t bytesWritten = 0;
+  for (const string &name : PLANTED_FORMATS)
+  {
+    fs::path dir = outDir / name;
+    if (!fs::is_directory(dir))
+      continue;
+    for (const auto &entry : fs::directory_iterator(dir))
+    {
+      uint64_t size = entry.file_size();
+      bytesWritten += size;
+      FormatScore &score = scores[name];
+      score.output++;
+      string head(KEY, '\0');
+      ifstream in(entry.path(), ios::binary);
+      in.read(&head[0], KEY);
+      head.resize(in.gcount());
+      auto candidates = byPrefix.equal_range(head);
+      for (auto it = candidates.first; it != candidates.second; ++it)
+      {
+        Planted &p = planted[it->second];
+        if (p.found || p.format != name ||
+            !containsPlanted(*image, p, entry.path().string()))
+          continue;
+        p.found = true;
+        p.exact = size == p.size;
+        score.matched++;
+        score.found++;
+        score.exact += p.exact;
+        break;
+      }
+    }
+  }
+
+  printf("Image:         %s (%.1f MiB, %zu planted files)\n", imagePath.c_str(),
+         imageSize / 1048576.0, planted.size());
+  printf("Scan time:     %.3f s (%u threads, %s reads)\n", seconds, threads,
+         ioBackendName(backend));
+  printf("Throughput:    %.3f GB/s\n", imageSize / seconds / 1e9);
+  printf("Bytes written: %llu\n\n", static_cast<unsigned long long>(bytesWritten));
+  printf("%-8s %8s %8s %8s %8s %8s %10s\n", "Format", "Planted", "Found",
+         "Exact", "Output", "Recall", "Precision");
+  for (const auto &s : scores)
+  {
+    const FormatScore &v = s.second;
+    printf("%-8s %8d %8d %8d %8d %7.1f%% %9.1f%%\n", s.first.c_str(), v.planted,
+           v.found, v.exact, v.output,
+           v.planted ? 100.0 * v.found / v.planted : 0.0,
+           v.output ? 100.0 * v.matched / v.output : 0.0);
+  }
+
+  map<string, pair<int, int>> byLayout;
+  for (const Planted &p : planted)
+  {
+    byLayout[p.layout].first++;
+    byLayout[p.layout].second += p.found;
+  }
+  printf("\n%-11s %8s %8s %8s\n", "Layout", "Planted", "Found", "Recall");
+  for (const auto &l : byLayout)
+    printf("%-11s %8d %8d %7.1f%%\n", l.first.c_str(), l.second.first,
+           l.second.second, 100.0 * l.second.second / l.second.first);
+
+  if (!keep)
+    fs::remove_all(outDir);
+  return 0;
+}
@@ -0,0 +1,438 @@
+// Builds reproducible synthetic disk images for the engine benchmark.
+//
+// Known PNG/JPEG/PDF/ZIP/MP3/MP4 files are planted at sector-aligned,
+// unaligned and fragmented offsets between random, zero and text filler.
+// Every planted file is listed in a ground-truth CSV:
+//
+//   id,format,layout,size,fragments
+//
+// where `fragments` is "offset+length" pairs joined by '|', in file order.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// splitmix64: same sequence on every host and standard library, so a seed
+// always produces the same image.
+class Rng
+{
+public:
+  explicit Rng(uint64_t seed) : state(seed) {}
+
+  uint64_t next()
+  {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  // Uniform in [lo, hi].
+  uint64_t range(uint64_t lo, uint64_t hi) { return lo + next() % (hi - lo + 1); }
+
+  void fill(unsigned char *p, size_t n)
+  {
+    for (size_t i = 0; i < n; ++i)
+      p[i] = static_cast<unsigned char>(next());
+  }
+
+private:
+  uint64_t state;
+};
+
+static uint32_t crc32(const unsigned char *data, size_t size, uint32_t crc = 0)
+{
+  static uint32_t table[256];
+  static bool ready = false;
+  if (!ready)
+  {
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k)
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+    ready = true;
+  }
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i)
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+typedef vector<unsigned char> Bytes;
+
+static void putBE32(Bytes &b, uint32_t v)
+{
+  b.push_back(v >> 24);
+  b.push_back(v >> 16);
+  b.push_back(v >> 8);
+  b.push_back(v);
+}
+
+static void putLE16(Bytes &b, uint16_t v)
+{
+  b.push_back(v);
+  b.push_back(v >> 8);
+}
+
+static void putLE32(Bytes &b, uint32_t v)
+{
+  putLE16(b, v & 0xFFFF);
+  putLE16(b, v >> 16);
+}
+
+static void putStr(Bytes &b, const string &s) { b.insert(b.end(), s.begin(), s.end()); }
+
+// --- File synthesis ---
+
+static void pngChunk(Bytes &png, const char *type, const Bytes &data)
+{
+  putBE32(png, data.size());
+  size_t start = png.size();
+  png.insert(png.end(), type, type + 4);
+  png.insert(png.end(), data.begin(), data.end());
+  putBE32(png, crc32(&png[start], png.size() - start));
+}
+
+static Bytes makePNG(Rng &rng, size_t size)
+{
+  Bytes png = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+  Bytes ihdr;
+  putBE32(ihdr, 64 + rng.range(0, 1024));
+  putBE32(ihdr, 64 + rng.range(0, 1024));
+  ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});
+  pngChunk(png, "IHDR", ihdr);
+  Bytes idat(size > 64 ? size - 64 : 64);
+  rng.fill(idat.data(), idat.size());
+  pngChunk(png, "IDAT", idat);
+  pngChunk(png, "IEND", Bytes());
+  return png;
+}
+
+static Bytes makeJPEG(Rng &rng, size_t size)
+{
+  Bytes jpg = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00,
+               0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00};
+  // DQT with a flat table
+  jpg.insert(jpg.end(), {0xFF, 0xDB, 0x00, 0x43, 0x00});
+  jpg.insert(jpg.end(), 64, 0x10);
+  // SOF0: 8-bit, 640x480, one component
+  jpg.insert(jpg.end(), {0xFF, 0xC0, 0x00, 0x0B, 0x08, 0x01, 0xE0, 0x02, 0x80,
+                         0x01, 0x01, 0x11, 0x00});
+  // SOS, then byte-stuffed entropy data (0xFF is always followed by 0x00)
+  jpg.insert(jpg.end(), {0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F,
+                         0x00});
+  while (jpg.size() + 2 < size)
+  {
+    unsigned char c = static_cast<unsigned char>(rng.next());
+    jpg.push_back(c);
+    if (c == 0xFF)
+      jpg.push_back(0x00);
+  }
+  jpg.insert(jpg.end(), {0xFF, 0xD9});
+  return jpg;
+}
+
+static Bytes makePDF(Rng &rng, size_t size)
+{
+  static const char *WORDS[] = {"recovery", "sector", "cluster", "inode",
+                                "journal", "extent", "bitmap", "carve"};
+  Bytes pdf;
+  putStr(pdf, "%PDF-1." + to_string(rng.range(3, 7)) + "\n");
+  vector<size_t> offsets;
+  offsets.push_back(pdf.size());
+  putStr(pdf, "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+  offsets.push_back(pdf.size());
+  putStr(pdf, "2 0 obj\n<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n");
+  offsets.push_back(pdf.size());
+  putStr(pdf, "3 0 obj\n<< /Type /Page /Parent 2 0 R /Contents 4 0 R >>\nendobj\n");
+  string text;
+  while (text.size() + pdf.size() + 300 < size)
+  {
+    text += WORDS[rng.range(0, 7)];
+    text += ' ';
+  }
+  offsets.push_back(pdf.size());
+  putStr(pdf, "4 0 obj\n<< /Length " + to_string(text.size()) +
+                  " >>\nstream\n" + text + "\nendstream\nendobj\n");
+  size_t xref = pdf.size();
+  putStr(pdf, "xref\n0 5\n0000000000 65535 f \n");
+  for (size_t off : offsets)
+  {
+    char line[32];
+    snprintf(line, sizeof(line), "%010zu 00000 n \n", off);
+    putStr(pdf, line);
+  }
+  putStr(pdf, "trailer\n<< /Size 5 /Root 1 0 R >>\nstartxref\n" +
+                  to_string(xref) + "\n%%EOF");
+  return pdf;
+}
+
+static Bytes makeZIP(Rng &rng, size_t size)
+{
+  Bytes data(size > 200 ? size - 200 : 64);
+  rng.fill(data.data(), data.size());
+  uint32_t crc = crc32(data.data(), data.size());
+  string name = "member" + to_string(rng.range(0, 9999)) + ".bin";
+
+  Bytes zip = {0x50, 0x4B, 0x03, 0x04};
+  putLE16(zip, 20);
+  putLE16(zip, 0);
+  putLE16(zip, 0); // stored
+  putLE32(zip, 0x00210000);
+  putLE32(zip, crc);
+  putLE32(zip, data.size());
+  putLE32(zip, data.size());
+  putLE16(zip, name.size());
+  putLE16(zip, 0);
+  putStr(zip, name);
+  zip.insert(zip.end(), data.begin(), data.end());
+
+  size_t central = zip.size();
+  zip.insert(zip.end(), {0x50, 0x4B, 0x01, 0x02});
+  putLE16(zip, 20);
+  putLE16(zip, 20);
+  putLE16(zip, 0);
+  putLE16(zip, 0);
+  putLE32(zip, 0x00210000);
+  putLE32(zip, crc);
+  putLE32(zip, data.size());
+  putLE32(zip, data.size());
+  putLE16(zip, name.size());
+  putLE16(zip, 0);
+  putLE16(zip, 0);
+  putLE16(zip, 0);
+  putLE16(zip, 0);
+  putLE32(zip, 0);
+  putLE32(zip, 0);
+  putStr(zip, name);
+  size_t centralSize = zip.size() - central;
+
+  zip.insert(zip.end(), {0x50, 0x4B, 0x05, 0x06});
+  putLE16(zip, 0);
+  putLE16(zip, 0);
+  putLE16(zip, 1);
+  putLE16(zip, 1);
+  putLE32(zip, centralSize);
+  putLE32(zip, central);
+  putLE16(zip, 0);
+  return zip;
+}
+
+// MPEG-1 Layer III, 128 kbit/s, 44.1 kHz: 417 byte frames without padding.
+static Bytes makeMP3(Rng &rng, size_t size)
+{
+  const size_t FRAME = 417;
+  Bytes mp3;
+  while (mp3.size() + FRAME <= size)
+  {
+    mp3.insert(mp3.end(), {0xFF, 0xFB, 0x90, 0x00});
+    size_t start = mp3.size();
+    mp3.resize(start + FRAME - 4);
+    rng.fill(&mp3[start], FRAME - 4);
+  }
+  return mp3;
+}
+
+static void mp4Box(Bytes &mp4, const char *type, const Bytes &payload)
+{
+  putBE32(mp4, payload.size() + 8);
+  mp4.insert(mp4.end(), type, type + 4);
+  mp4.insert(mp4.end(), payload.begin(), payload.end());
+}
+
+static Bytes makeMP4(Rng &rng, size_t size)
+{
+  Bytes mp4;
+  Bytes ftyp;
+  putStr(ftyp, "isom");
+  putBE32(ftyp, 0x200);
+  putStr(ftyp, "isomiso2avc1mp41");
+  mp4Box(mp4, "ftyp", ftyp);
+  Bytes moov(512);
+  rng.fill(moov.data(), moov.size());
+  mp4Box(mp4, "moov", moov);
+  Bytes mdat(size > mp4.size() + 16 ? size - mp4.size() - 8 : 64);
+  rng.fill(mdat.data(), mdat.size());
+  mp4Box(mp4, "mdat", mdat);
+  return mp4;
+}
+
+// --- Image layout ---
+
+struct Planted
+{
+  string format;
+  string layout;
+  size_t size;
+  vector<pair<uint64_t, uint64_t>> fragments;
+};
+
+class ImageWriter
+{
+public:
+  ImageWriter(const string &path, Rng &rng) : out(path, ios::binary), rng(rng) {}
+
+  bool ok() const { return static_cast<bool>(out); }
+  uint64_t position() const { return pos; }
+
+  void write(const unsigned char *data, size_t size)
+  {
+    out.write(reinterpret_cast<const char *>(data), size);
+    pos += size;
+  }
+
+  // Kind 0: random bytes, 1: zeros, 2: English-like text.
+  void filler(int kind, uint64_t size)
+  {
+    static const char *TEXT =
+        "The quick brown fox jumps over the lazy dog while the backup job "
+        "copies another block of log output to the shared volume.\n";
+    static const size_t TEXT_LEN = strlen(TEXT);
+    Bytes chunk(64 * 1024);
+    while (size > 0)
+    {
+      size_t n = min<uint64_t>(size, chunk.size());
+      if (kind == 0)
+        rng.fill(chunk.data(), n);
+      else if (kind == 1)
+        memset(chunk.data(), 0, n);
+      else
+        for (size_t i = 0; i < n; ++i)
+          chunk[i] = TEXT[(textPos + i) % TEXT_LEN];
+      textPos += n;
+      write(chunk.data(), n);
+      size -= n;
+    }
+  }
+
+private:
+  ofstream out;
+  Rng &rng;
+  uint64_t pos = 0;
+  uint64_t textPos = 0;
+};
+
+static uint64_t parseSize(const string &s)
+{
+  char *end = nullptr;
+  uint64_t v = strtoull(s.c_str(), &end, 10);
+  switch (*end)
+  {
+  case 'G':
+  case 'g':
+    v <<= 10;
+    [[fallthrough]];
+  case 'M':
+  case 'm':
+    v <<= 10;
+    [[fallthrough]];
+  case 'K':
+  case 'k':
+    v <<= 10;
+  }
+  return v;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3)
+  {
+    cerr << "usage: imagegen <image> <size[K|M|G]> [--seed N] [--truth file.csv]\n";
+    return 2;
+  }
+  string imagePath = argv[1];
+  uint64_t imageSize = parseSize(argv[2]);
+  uint64_t seed = 1;
+  string truthPath = imagePath + ".truth.csv";
+  for (int i = 3; i + 1 < argc; i += 2)
+  {
+    if (string(argv[i]) == "--seed")
+      seed = strtoull(argv[i + 1], nullptr, 10);
+    else if (string(argv[i]) == "--truth")
+      truthPath = argv[i + 1];
+  }
+
+  const uint64_t SECTOR = 4096;
+  static const char *FORMATS[] = {"PNG", "JPEG", "PDF", "ZIP", "MP3", "MP4"};
+  Rng rng(seed);
+  ImageWriter image(imagePath, rng);
+  if (!image.ok())
+  {
+    cerr << "Failed to create " << imagePath << "\n";
+    return 1;
+  }
+
+  vector<Planted> planted;
+  while (true)
+  {
+    int fillerKind = rng.range(0, 2);
+    uint64_t fillerSize = rng.range(4 * 1024, 256 * 1024);
+    int format = rng.range(0, 5);
+    size_t fileSize = rng.range(format == 4 ? 40 * 1024 : 8 * 1024, 512 * 1024);
+    Bytes file;
+    switch (format)
+    {
+    case 0: file = makePNG(rng, fileSize); break;
+    case 1: file = makeJPEG(rng, fileSize); break;
+    case 2: file = makePDF(rng, fileSize); break;
+    case 3: file = makeZIP(rng, fileSize); break;
+    case 4: file = makeMP3(rng, fileSize); break;
+    default: file = makeMP4(rng, fileSize); break;
+    }
+
+    // 40% sector aligned, 40% unaligned, 20% split in two fragments.
+    uint64_t roll = rng.range(0, 9);
+    string layout = roll < 4 ? "aligned" : (roll < 8 ? "unaligned" : "fragmented");
+    uint64_t start = image.position() + fillerSize;
+    if (layout != "unaligned")
+      start = (start + SECTOR - 1) / SECTOR * SECTOR;
+    uint64_t gap = layout == "fragmented" ? rng.range(2, 16) * SECTOR : 0;
+    if (start + file.size() + gap + fillerSize > imageSize)
+      break;
+
+    image.filler(fillerKind, start - image.position());
+    Planted p{FORMATS[format], layout, file.size(), {}};
+    if (layout == "fragmented")
+    {
+      size_t split = rng.range(1, max<size_t>(1, file.size() / SECTOR - 1)) * SECTOR;
+      split = min(split, file.size() - 1);
+      p.fragments.push_back({image.position(), split});
+      image.write(file.data(), split);
+      image.filler(fillerKind, gap);
+      p.fragments.push_back({image.position(), file.size() - split});
+      image.write(file.data() + split, file.size() - split);
+    }
+    else
+    {
+      p.fragments.push_back({image.position(), file.size()});
+      image.write(file.data(), file.size());
+    }
+    planted.push_back(p);
+  }
+  image.filler(rng.range(0, 2), imageSize - image.position());
+
+  ofstream truth(truthPath);
+  truth << "id,format,layout,size,fragments\n";
+  for (size_t i = 0; i < planted.size(); ++i)
+  {
+    truth << i << ',' << planted[i].format << ',' << planted[i].layout << ','
+          << planted[i].size << ',';
+    for (size_t f = 0; f < planted[i].fragments.size(); ++f)
+      truth << (f ? "|" : "") << planted[i].fragments[f].first << '+'
+            << planted[i].fragments[f].second;
+    truth << '\n';
+  }
+  cout << "Wrote " << imageSize << " bytes to " << imagePath << " with "
+       << planted.size() << " planted files (ground truth: " << truthPath
+       << ")\n";
+  return 0;
+}
@@ -0,0 +1,268 @@
+// Microbenchmarks for the per-byte matching kernels of the scan loop, and
+// for the CRC-32 used to verify carved PNG and ZIP files.
+//
+// Every kernel is called at each offset of a 256 KiB buffer, the way
+// RecoveryEngine::run drives it. Buffers cover the data a scan really sees:
+// random bytes, zeros, back-to-back MP3 frames and JPEG entropy-coded data.
+// Besides bytes/s, each result reports s/byte and heap allocations per byte
+// (counted by the replacement operator new set below), so an allocation
+// sneaking into a hot path shows up here before it reaches a production scan.
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "../Mp3.h"
+#include "../formats.h"
+#include "../mp4.h"
+
+using namespace std;
+
+static atomic<uint64_t> allocationCount{0};
+static const size_t DEFAULT_ALIGNMENT = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+// Every replaceable operator new and delete below funnels into this pair,
+// so plain, array, sized, nothrow and over-aligned forms all count and all
+// release memory the same way. `release` stays out of line: inlined into a
+// delete expression, GCC would see free() paired with operator new.
+static void *countedAllocate(size_t size, size_t alignment) noexcept
+{
+  allocationCount.fetch_add(1, memory_order_relaxed);
+  if (alignment <= DEFAULT_ALIGNMENT)
+    return malloc(size ? size : 1);
+  // aligned_alloc wants a size that is a multiple of the alignment.
+  return aligned_alloc(alignment,
+                       (size + alignment - 1) / alignment * alignment);
+}
+
+[[gnu::noinline]] static void release(void *p) noexcept { free(p); }
+
+static void *countedNew(size_t size, size_t alignment)
+{
+  if (void *p = countedAllocate(size, alignment))
+    return p;
+  throw bad_alloc();
+}
+
+void *operator new(size_t size) { return countedNew(size, DEFAULT_ALIGNMENT); }
+void *operator new[](size_t size)
+{
+  return countedNew(size, DEFAULT_ALIGNMENT);
+}
+void *operator new(size_t size, align_val_t alignment)
+{
+  return countedNew(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, align_val_t alignment)
+{
+  return countedNew(size, static_cast<size_t>(alignment));
+}
+void *operator new(size_t size, const nothrow_t &) noexcept
+{
+  return countedAllocate(size, DEFAULT_ALIGNMENT);
+}
+void *operator new[](size_t size, const nothrow_t &) noexcept
+{
+  return countedAllocate(size, DEFAULT_ALIGNMENT);
+}
+void *operator new(size_t size, align_val_t alignment,
+                   const nothrow_t &) noexcept
+{
+  return countedAllocate(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, align_val_t alignment,
+                     const nothrow_t &) noexcept
+{
+  return countedAllocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *p) noexcept { release(p); }
+void operator delete[](void *p) noexcept { release(p); }
+void operator delete(void *p, size_t) noexcept { release(p); }
+void operator delete[](void *p, size_t) noexcept { release(p); }
+void operator delete(void *p, align_val_t) noexcept { release(p); }
+void operator delete[](void *p, align_val_t) noexcept { release(p); }
+void operator delete(void *p, size_t, align_val_t) noexcept { release(p); }
+void operator delete[](void *p, size_t, align_val_t) noexcept { release(p); }
+void operator delete(void *p, const nothrow_t &) noexcept { release(p); }
+void operator delete[](void *p, const nothrow_t &) noexcept { release(p); }
+void operator delete(void *p, align_val_t, const nothrow_t &) noexcept
+{
+  release(p);
+}
+void operator delete[](void *p, align_val_t, const nothrow_t &) noexcept
+{
+  release(p);
+}
+
+// --- Test buffers ---
+
+enum BufferKind
+{
+  RANDOM,
+  ZEROS,
+  DENSE_MP3,
+  JPEG_ENTROPY,
+  BUFFER_KINDS
+};
+
+static const char *BUFFER_NAMES[] = {"random", "zeros", "dense_mp3",
+                                     "jpeg_entropy"};
+static const size_t BUFFER_SIZE = 256 * 1024;
+
+static uint64_t nextRandom(uint64_t &state)
+{
+  uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static vector<unsigned char> makeBuffer(int kind)
+{
+  vector<unsigned char> buffer;
+  uint64_t seed = kind + 1;
+  buffer.reserve(BUFFER_SIZE);
+  while (buffer.size() < BUFFER_SIZE)
+  {
+    unsigned char c = static_cast<unsigned char>(nextRandom(seed));
+    if (kind == ZEROS)
+      buffer.push_back(0);
+    else if (kind == DENSE_MP3 && buffer.size() % 417 == 0)
+      // MPEG-1 Layer III, 128 kbit/s, 44.1 kHz: 417 byte frames
+      buffer.insert(buffer.end(), {0xFF, 0xFB, 0x90, 0x00});
+    else if (kind == JPEG_ENTROPY && c == 0xFF)
+      buffer.insert(buffer.end(), {0xFF, 0x00}); // byte stuffing
+    else
+      buffer.push_back(c);
+  }
+  buffer.resize(BUFFER_SIZE);
+  return buffer;
+}
+
+static const vector<unsigned char> &testBuffer(int kind)
+{
+  static vector<vector<unsigned char>> buffers;
+  if (buffers.empty())
+    for (int k = 0; k < BUFFER_KINDS; ++k)
+      buffers.push_back(makeBuffer(k));
+  return buffers[kind];
+}
+
+// Runs `kernel(buffer, pos)` at every offset that leaves room for the
+// longest header (8 bytes) and reports per-byte cost and allocations.
+template <class Kernel>
+static void scanBuffer(benchmark::State &state, Kernel kernel)
+{
+  const vector<unsigned char> &buffer = testBuffer(state.range(0));
+  const size_t positions = buffer.size() - 8;
+  uint64_t matches = 0;
+  uint64_t allocationsBefore = allocationCount.load();
+  for (auto _ : state)
+  {
+    for (size_t pos = 0; pos < positions; ++pos)
+      matches += kernel(buffer, pos);
+    benchmark::DoNotOptimize(matches);
+  }
+  double allocations = allocationCount.load() - allocationsBefore;
+  double bytes = static_cast<double>(state.iterations()) * positions;
+  state.SetLabel(BUFFER_NAMES[state.range(0)]);
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+  state.counters["s/byte"] =
+      benchmark::Counter(bytes, benchmark::Counter::kIsRate |
+                                    benchmark::Counter::kInvert);
+  state.counters["allocs/byte"] = allocations / bytes;
+  state.counters["matches"] = static_cast<double>(matches) / state.iterations();
+}
+
+static void BM_signatureAt_PNG(benchmark::State &state)
+{
+  scanBuffer(state, [](const vector<unsigned char> &b, size_t pos)
+             { return signatureAt<PngFormat>(b.data() + pos, b.size() - pos); });
+}
+
+static void BM_signatureAt_JPEG(benchmark::State &state)
+{
+  scanBuffer(state, [](const vector<unsigned char> &b, size_t pos)
+             { return signatureAt<JpegFormat>(b.data() + pos, b.size() - pos); });
+}
+
+static void BM_parse_mp3_frame_header(benchmark::State &state)
+{
+  Mp3 mp3("");
+  scanBuffer(state, [&](const vector<unsigned char> &b, size_t pos)
+             { return mp3.parse_mp3_frame_header(&b[pos])[0] > 0; });
+}
+
+static void BM_matchesMP3Header(benchmark::State &state)
+{
+  Mp3 mp3("");
+  scanBuffer(state, [&](const vector<unsigned char> &b, size_t pos)
+             { return mp3.matchesMP3Header(b, pos); });
+}
+
+// Compares each offset's parsed header against the first frame of the dense
+// MP3 buffer, as extractMP3File does for every frame it follows. Headers are
+// parsed before timing so only the comparison is measured.
+static void BM_matchesFrameInfo(benchmark::State &state)
+{
+  Mp3 mp3("");
+  const vector<unsigned char> &buffer = testBuffer(state.range(0));
+  vector<int> original = mp3.parse_mp3_frame_header(testBuffer(DENSE_MP3).data());
+  vector<vector<int>> frames;
+  for (size_t pos = 0; pos + 8 < buffer.size(); ++pos)
+    frames.push_back(mp3.parse_mp3_frame_header(&buffer[pos]));
+  scanBuffer(state, [&](const vector<unsigned char> &, size_t pos)
+             { return mp3.matchesFrameInfo(frames[pos], original); });
+}
+
+static void BM_matchesMP4Header(benchmark::State &state)
+{
+  MP4 mp4("");
+  const vector<unsigned char> &ftyp = mp4.getFtypSignature();
+  scanBuffer(state, [&](const vector<unsigned char> &b, size_t pos)
+             { return mp4.matchesMP4Header(b, ftyp, pos); });
+}
+
+// CRC-32 over a whole buffer, as the PNG and ZIP verifiers run it on each
+// carved chunk. Arg is the chunk size; computeCrc32 picks PCLMULQDQ folding
+// when the CPU has it.
+template <uint32_t (*Crc)(const unsigned char *, size_t)>
+static void crcBuffer(benchmark::State &state)
+{
+  const vector<unsigned char> &buffer = testBuffer(RANDOM);
+  const size_t chunk = state.range(0);
+  uint32_t crc = 0;
+  for (auto _ : state)
+  {
+    for (size_t pos = 0; pos + chunk <= buffer.size(); pos += chunk)
+      crc ^= Crc(buffer.data() + pos, chunk);
+    benchmark::DoNotOptimize(crc);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          (buffer.size() / chunk * chunk));
+}
+
+static uint32_t crcSlicing8(const unsigned char *data, size_t size)
+{
+  return ~crc32Slicing8(data, size, ~0u);
+}
+
+static uint32_t crcDispatched(const unsigned char *data, size_t size)
+{
+  return computeCrc32(data, size);
+}
+
+BENCHMARK(BM_signatureAt_PNG)->DenseRange(0, BUFFER_KINDS - 1);
+BENCHMARK(BM_signatureAt_JPEG)->DenseRange(0, BUFFER_KINDS - 1);
+BENCHMARK(BM_parse_mp3_frame_header)->DenseRange(0, BUFFER_KINDS - 1);
+BENCHMARK(BM_matchesMP3Header)->DenseRange(0, BUFFER_KINDS - 1);
+BENCHMARK(BM_matchesFrameInfo)->DenseRange(0, BUFFER_KINDS - 1);
+BENCHMARK(BM_matchesMP4Header)->DenseRange(0, BUFFER_KINDS - 1);
+BENCHMARK(crcBuffer<crcSlicing8>)->Arg(64)->Arg(4096)->Arg(BUFFER_SIZE);
+BENCHMARK(crcBuffer<crcDispatched>)->Arg(64)->Arg(4096)->Arg(BUFFER_SIZE);
+
+BENCHMARK_MAIN();
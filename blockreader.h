@@ -0,0 +1,276 @@
+#ifndef BLOCKREADER_H
+#define BLOCKREADER_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// How the scanner reads the input device.
+enum class IoBackend
+{
+  Stream, // std::ifstream, one seek + read per chunk
+  Pread,  // pread(2): positional, no shared file offset
+  Mmap    // the whole device mapped read-only; reads are memcpy
+};
+
+inline const char *ioBackendName(IoBackend backend)
+{
+  switch (backend)
+  {
+  case IoBackend::Pread:
+    return "pread";
+  case IoBackend::Mmap:
+    return "mmap";
+  default:
+    return "stream";
+  }
+}
+
+// False for an unknown name.
+inline bool parseIoBackend(const std::string &name, IoBackend &backend)
+{
+  if (name == "stream")
+    backend = IoBackend::Stream;
+  else if (name == "pread")
+    backend = IoBackend::Pread;
+  else if (name == "mmap")
+    backend = IoBackend::Mmap;
+  else
+    return false;
+  return true;
+}
+
+// Positional reads from the input device. Every backend may be shared by
+// several scanning threads.
+class BlockReader
+{
+public:
+  virtual ~BlockReader() = default;
+
+  // Reads up to `size` bytes at `offset`; returns the count, 0 at the end of
+  // the device or on error.
+  virtual size_t readAt(uint64_t offset, unsigned char *dest, size_t size) = 0;
+
+  // Says [offset, offset + size) will be read soon, so the kernel may start
+  // reading it now. Backends that cannot pass it on ignore it.
+  virtual void prefetch(uint64_t, size_t) {}
+
+  // Opens `path` with `backend`; null when the device cannot be opened (an
+  // empty device cannot be mapped, so mmap then falls back to pread).
+  static std::unique_ptr<BlockReader> open(const std::string &path,
+                                           IoBackend backend, uint64_t size);
+};
+
+class StreamReader : public BlockReader
+{
+public:
+  explicit StreamReader(const std::string &path) : file(path, std::ios::binary) {}
+  bool ok() const { return static_cast<bool>(file); }
+
+  size_t readAt(uint64_t offset, unsigned char *dest, size_t size) override
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+    file.read(reinterpret_cast<char *>(dest), size);
+    return file.gcount();
+  }
+
+private:
+  std::mutex lock; // seek + read must not interleave between threads
+  std::ifstream file;
+};
+
+class PreadReader : public BlockReader
+{
+public:
+  explicit PreadReader(const std::string &path)
+      : fd(::open(path.c_str(), O_RDONLY)) {}
+  ~PreadReader() override
+  {
+    if (fd >= 0)
+      close(fd);
+  }
+  bool ok() const { return fd >= 0; }
+
+  size_t readAt(uint64_t offset, unsigned char *dest, size_t size) override
+  {
+    size_t done = 0;
+    while (done < size)
+    {
+      ssize_t n = pread(fd, dest + done, size - done,
+                        static_cast<off_t>(offset + done));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      done += n;
+    }
+    return done;
+  }
+
+  void prefetch(uint64_t offset, size_t size) override
+  {
+    posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(size),
+                  POSIX_FADV_WILLNEED);
+  }
+
+private:
+  int fd;
+};
+
+class MmapReader : public BlockReader
+{
+public:
+  MmapReader(const std::string &path, uint64_t size) : length(size)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0 || size == 0)
+    {
+      if (fd >= 0)
+        close(fd);
+      return;
+    }
+    void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+      return;
+    madvise(p, size, MADV_SEQUENTIAL);
+    data = static_cast<const unsigned char *>(p);
+  }
+  ~MmapReader() override
+  {
+    if (data)
+      munmap(const_cast<unsigned char *>(data), length);
+  }
+  bool ok() const { return data != nullptr; }
+
+  size_t readAt(uint64_t offset, unsigned char *dest, size_t size) override
+  {
+    if (offset >= length)
+      return 0;
+    size_t n = std::min<uint64_t>(size, length - offset);
+    memcpy(dest, data + offset, n);
+    return n;
+  }
+
+  void prefetch(uint64_t offset, size_t size) override
+  {
+    if (offset >= length)
+      return;
+    // madvise wants a page-aligned start.
+    uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t start = offset - offset % page;
+    uint64_t end = std::min<uint64_t>(offset + size, length);
+    madvise(const_cast<unsigned char *>(data) + start, end - start,
+            MADV_WILLNEED);
+  }
+
+private:
+  const unsigned char *data = nullptr;
+  uint64_t length;
+};
+
+// Serves one parser's small sequential reads from larger reads of `inner`,
+// so following a stream 4 KB at a time does not cost a device read (or a
+// read limiter's token) per 4 KB. Reads start at `firstRead` bytes and
+// double up to `maxRead`, so a stream that ends early reads little past it;
+// restart() starts over for the next stream, keeping the block read last.
+// Bytes the caller already holds can be lent with setWindow() and are then
+// copied rather than read. Not for sharing between threads.
+class ReadAheadReader : public BlockReader
+{
+public:
+  ReadAheadReader(BlockReader &inner, size_t firstRead, size_t maxRead)
+      : inner(inner), firstRead(std::min(firstRead, maxRead)),
+        nextRead(this->firstRead), maxRead(maxRead)
+  {
+  }
+
+  void restart() { nextRead = firstRead; }
+
+  // [offset, offset + size) of the device is at `data` until the next call.
+  void setWindow(const unsigned char *data, uint64_t offset, size_t size)
+  {
+    window = data;
+    windowStart = offset;
+    windowSize = size;
+  }
+
+  size_t readAt(uint64_t offset, unsigned char *dest, size_t size) override
+  {
+    size_t done = 0;
+    while (done < size)
+    {
+      uint64_t at = offset + done;
+      if (at >= windowStart && at - windowStart < windowSize)
+      {
+        size_t n =
+            std::min<uint64_t>(size - done, windowStart + windowSize - at);
+        memcpy(dest + done, window + (at - windowStart), n);
+        done += n;
+        continue;
+      }
+      if (at < start || at >= start + held)
+      {
+        block.resize(std::max(nextRead, size - done));
+        start = at;
+        held = inner.readAt(at, block.data(), block.size());
+        nextRead = std::min(nextRead * 2, maxRead);
+        if (held == 0)
+          break;
+      }
+      size_t n = std::min<uint64_t>(size - done, start + held - at);
+      memcpy(dest + done, block.data() + (at - start), n);
+      done += n;
+    }
+    return done;
+  }
+
+private:
+  BlockReader &inner;
+  std::vector<unsigned char> block;
+  uint64_t start = 0;
+  size_t held = 0;
+  size_t firstRead, nextRead, maxRead;
+  const unsigned char *window = nullptr;
+  uint64_t windowStart = 0;
+  size_t windowSize = 0;
+};
+
+inline std::unique_ptr<BlockReader> BlockReader::open(const std::string &path,
+                                                      IoBackend backend,
+                                                      uint64_t size)
+{
+  if (backend == IoBackend::Mmap)
+  {
+    std::unique_ptr<MmapReader> reader(new MmapReader(path, size));
+    if (reader->ok())
+      return reader;
+    backend = IoBackend::Pread;
+  }
+  if (backend == IoBackend::Pread)
+  {
+    std::unique_ptr<PreadReader> reader(new PreadReader(path));
+    if (reader->ok())
+      return reader;
+    return nullptr;
+  }
+  std::unique_ptr<StreamReader> reader(new StreamReader(path));
+  if (reader->ok())
+    return reader;
+  return nullptr;
+}
+
+#endif // BLOCKREADER_H
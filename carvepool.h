@@ -0,0 +1,192 @@
+#ifndef CARVEPOOL_H
+#define CARVEPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool for carve jobs. Each worker owns a deque: it takes its
+// newest job from the back, and an idle worker steals the oldest job from
+// the front of another's. A worker busy copying a 500 MB video therefore
+// does not hold up the small images queued behind it. Jobs get the index of
+// the worker running them so they can use per-worker state.
+class CarvePool
+{
+public:
+  using Job = std::function<void(size_t worker)>;
+
+  // Jobs submitted with the same group can be waited for together, so
+  // several scans can share one pool.
+  class JobGroup
+  {
+  public:
+    void wait()
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      done.wait(guard, [this]() { return pending == 0; });
+    }
+
+  private:
+    friend class CarvePool;
+    size_t pending = 0; // guarded by `lock`
+    std::mutex lock;
+    std::condition_variable done;
+  };
+
+  explicit CarvePool(size_t workers)
+  {
+    for (size_t i = 0; i < std::max<size_t>(1, workers); ++i)
+      queues.emplace_back(new Queue);
+    for (size_t i = 0; i < queues.size(); ++i)
+      threads.emplace_back([this, i]() { workerLoop(i); });
+  }
+
+  CarvePool(const CarvePool &) = delete;
+  CarvePool &operator=(const CarvePool &) = delete;
+
+  // Runs the jobs already queued, then stops the workers.
+  ~CarvePool()
+  {
+    wait();
+    {
+      std::lock_guard<std::mutex> guard(stateLock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : threads)
+      t.join();
+  }
+
+  size_t size() const { return queues.size(); }
+
+  // Safe from any thread. A worker queues on its own deque; other threads
+  // spread jobs round-robin.
+  void submit(Job job, JobGroup *group = nullptr)
+  {
+    if (group)
+    {
+      std::lock_guard<std::mutex> guard(group->lock);
+      ++group->pending;
+      job = [inner = std::move(job), group](size_t worker)
+      {
+        inner(worker);
+        // Decrement under the lock: once `pending` reads zero, wait() may
+        // return and the group's owner destroy it, so nothing may touch
+        // `group` after the lock is released.
+        std::lock_guard<std::mutex> guard(group->lock);
+        if (--group->pending == 0)
+          group->done.notify_all();
+      };
+    }
+    size_t target = identity().pool == this
+                        ? identity().index
+                        : nextQueue.fetch_add(1, std::memory_order_relaxed) %
+                              queues.size();
+    pending.fetch_add(1);
+    {
+      std::lock_guard<std::mutex> guard(queues[target]->lock);
+      queues[target]->jobs.push_back(std::move(job));
+    }
+    {
+      std::lock_guard<std::mutex> guard(stateLock);
+      ++queued;
+    }
+    wake.notify_one();
+  }
+
+  // Blocks until every submitted job has finished.
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(stateLock);
+    idle.wait(lock, [this]() { return pending.load() == 0; });
+  }
+
+private:
+  struct Queue
+  {
+    std::mutex lock;
+    std::deque<Job> jobs;
+  };
+
+  // Which pool's worker, if any, the calling thread is.
+  struct Identity
+  {
+    const CarvePool *pool = nullptr;
+    size_t index = 0;
+  };
+  static Identity &identity()
+  {
+    thread_local Identity id;
+    return id;
+  }
+
+  bool takeJob(size_t self, Job &job)
+  {
+    {
+      Queue &own = *queues[self];
+      std::lock_guard<std::mutex> guard(own.lock);
+      if (!own.jobs.empty())
+      {
+        job = std::move(own.jobs.back());
+        own.jobs.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < queues.size(); ++i)
+    {
+      Queue &victim = *queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (!victim.jobs.empty())
+      {
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void workerLoop(size_t self)
+  {
+    identity() = {this, self};
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(stateLock);
+        wake.wait(lock, [this]() { return stopping || queued > 0; });
+        if (queued == 0)
+          return; // stopping with nothing left
+        --queued;
+      }
+      // `queued` counted one job for us; some deque holds it.
+      Job job;
+      while (!takeJob(self, job))
+        std::this_thread::yield();
+      job(self);
+      if (pending.fetch_sub(1) == 1)
+      {
+        std::lock_guard<std::mutex> guard(stateLock);
+        idle.notify_all();
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::mutex stateLock;
+  std::condition_variable wake; // jobs queued or stopping
+  std::condition_variable idle; // pending reached zero
+  size_t queued = 0;            // jobs in the deques not yet claimed
+  bool stopping = false;
+  std::atomic<size_t> pending{0}; // submitted and not finished
+  std::atomic<size_t> nextQueue{0};
+};
+
+#endif // CARVEPOOL_H
@@ -0,0 +1,190 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "formats.h"
+
+// --- Candidate catalog ---
+// A catalog-only scan records every candidate it finds instead of carving
+// it, so a triage pass over a disk is pure sequential reading. The catalog
+// file is a fixed header followed by an array of CatalogEntry records and
+// then the device path, all in host (little-endian) byte order, so it can be
+// mapped and indexed in place however many entries it holds. Entries are
+// sorted by offset.
+//
+//   0   char[8]  magic "DRCATLG1"
+//   8   uint32   entry size in bytes
+//   12  uint32   reserved
+//   16  uint64   entry count
+//   24  uint64   device size in bytes
+//   32  uint64   device path length
+//   40  ...      reserved up to 64
+//   64  CatalogEntry[count]
+//   ..  device path
+
+struct CatalogEntry
+{
+  uint64_t offset; // device offset of the signature
+  uint64_t length; // bytes to the next candidate, or exact (see flags)
+  int32_t format;  // engine format index
+  float confidence;
+  uint32_t width;  // images: pixels; 0 when unknown
+  uint32_t height;
+  uint32_t detail; // format specific: PDF version * 10, MP3 kbit/s
+  uint32_t flags;
+
+  enum Flags : uint32_t
+  {
+    LengthExact = 1 // the format's own layout gave the length
+  };
+};
+
+static_assert(sizeof(CatalogEntry) == 40 &&
+                  std::is_trivially_copyable<CatalogEntry>::value,
+              "catalog entries are written and mapped as raw bytes");
+
+static constexpr char CATALOG_MAGIC[8] = {'D', 'R', 'C', 'A',
+                                          'T', 'L', 'G', '1'};
+static constexpr size_t CATALOG_HEADER_SIZE = 64;
+
+// Writes `entries` to `path`, replacing it. Returns false with `error` set
+// when the file cannot be written.
+inline bool writeCatalog(const std::string &path, const std::string &device,
+                         uint64_t deviceSize,
+                         const std::vector<CatalogEntry> &entries,
+                         std::string &error)
+{
+  unsigned char header[CATALOG_HEADER_SIZE] = {};
+  uint32_t entrySize = sizeof(CatalogEntry);
+  uint64_t count = entries.size();
+  uint64_t pathLength = device.size();
+  memcpy(header, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+  memcpy(header + 8, &entrySize, 4);
+  memcpy(header + 16, &count, 8);
+  memcpy(header + 24, &deviceSize, 8);
+  memcpy(header + 32, &pathLength, 8);
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(entries.data()),
+            entries.size() * sizeof(CatalogEntry));
+  out.write(device.data(), device.size());
+  out.close();
+  if (!out)
+  {
+    error = "Failed to write the catalog " + path;
+    return false;
+  }
+  return true;
+}
+
+// A catalog file mapped read-only. Entries are read straight from the
+// mapping; nothing is copied, so opening a catalog of millions of entries
+// costs one pass over them. The file may be damaged or come from another
+// build, so open() rejects it unless every entry names a known format and
+// lies within the device.
+class CatalogFile
+{
+ public:
+  CatalogFile() = default;
+  CatalogFile(const CatalogFile &) = delete;
+  CatalogFile &operator=(const CatalogFile &) = delete;
+  ~CatalogFile() { close(); }
+
+  bool open(const std::string &path, std::string &error)
+  {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+      if (fd >= 0)
+        ::close(fd);
+      error = "Cannot open the catalog " + path;
+      return false;
+    }
+    mappedSize = static_cast<size_t>(st.st_size);
+    if (mappedSize >= CATALOG_HEADER_SIZE)
+    {
+      void *map = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+      mapped = map == MAP_FAILED ? nullptr
+                                 : static_cast<const unsigned char *>(map);
+    }
+    ::close(fd);
+
+    uint32_t entrySize = 0;
+    uint64_t pathLength = 0;
+    if (mapped)
+    {
+      memcpy(&entrySize, mapped + 8, 4);
+      memcpy(&count, mapped + 16, 8);
+      memcpy(&sourceSize, mapped + 24, 8);
+      memcpy(&pathLength, mapped + 32, 8);
+    }
+    uint64_t entriesEnd = CATALOG_HEADER_SIZE + count * sizeof(CatalogEntry);
+    if (!mapped || memcmp(mapped, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0 ||
+        entrySize != sizeof(CatalogEntry) ||
+        count > (mappedSize - CATALOG_HEADER_SIZE) / sizeof(CatalogEntry) ||
+        pathLength > mappedSize - entriesEnd)
+    {
+      close();
+      error = path + " is not a catalog";
+      return false;
+    }
+    for (const CatalogEntry &entry : *this)
+    {
+      if (entry.format < 0 || entry.format >= static_cast<int>(FORMAT_COUNT) ||
+          entry.offset > sourceSize || entry.length > sourceSize - entry.offset)
+      {
+        close();
+        error = path +
+                " has an entry of an unknown format or outside its device";
+        return false;
+      }
+    }
+    source.assign(reinterpret_cast<const char *>(mapped + entriesEnd),
+                  pathLength);
+    return true;
+  }
+
+  void close()
+  {
+    if (mapped)
+      munmap(const_cast<unsigned char *>(mapped), mappedSize);
+    mapped = nullptr;
+    mappedSize = 0;
+    count = 0;
+  }
+
+  size_t size() const { return count; }
+  const CatalogEntry *begin() const
+  {
+    return reinterpret_cast<const CatalogEntry *>(mapped + CATALOG_HEADER_SIZE);
+  }
+  const CatalogEntry *end() const { return begin() + count; }
+  const CatalogEntry &operator[](size_t index) const { return begin()[index]; }
+
+  // The device the catalog was made from, and its size then.
+  const std::string &devicePath() const { return source; }
+  uint64_t deviceSize() const { return sourceSize; }
+
+ private:
+  const unsigned char *mapped = nullptr;
+  size_t mappedSize = 0;
+  uint64_t count = 0;
+  uint64_t sourceSize = 0;
+  std::string source;
+};
+
+#endif // CATALOG_H
@@ -0,0 +1,473 @@
+#ifndef CHECKSUMS_H
+#define CHECKSUMS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "crc32.h"
+#include "fsutil.h"
+#include "scanevent.h"
+
+// --- Carve-time checksum verification ---
+// A checksum verifier follows a file's own layout through the bytes going
+// into the output, in order, and checks the CRCs the format stores. Like a
+// Structure (formats.h) it never sees the same byte twice, so it costs one
+// CRC pass over the file. result() turns what it saw into the flag reported
+// with the carved file.
+
+// Collects a fixed-size field that may be split across two scan() calls.
+// Returns true once `field` is full.
+template <size_t N>
+struct FieldCollector
+{
+  unsigned char field[N];
+  size_t filled = 0;
+
+  bool take(const unsigned char *&data, size_t &size)
+  {
+    size_t n = N - filled < size ? N - filled : size;
+    for (size_t i = 0; i < n; ++i)
+      field[filled + i] = data[i];
+    filled += n;
+    data += n;
+    size -= n;
+    return filled == N;
+  }
+  void reset() { filled = 0; }
+};
+
+// Every PNG chunk carries a CRC of its type and data.
+struct PngChecksum
+{
+  enum State { Signature, Head, Data, Crc, Done } state = Signature;
+  FieldCollector<8> head; // the signature, then length and type of a chunk
+  FieldCollector<4> stored;
+  uint64_t remaining = 0; // data bytes left in the current chunk
+  uint32_t crc = 0;
+  size_t good = 0, bad = 0;
+  bool broken = false; // a chunk header made no sense; the rest is unchecked
+  bool sawEnd = false;
+
+  void scan(const unsigned char *data, size_t size)
+  {
+    while (size > 0 && state != Done)
+    {
+      switch (state)
+      {
+      case Signature:
+        if (head.take(data, size))
+        {
+          head.reset();
+          state = Head;
+        }
+        break;
+      case Head:
+        if (head.take(data, size))
+        {
+          remaining = be32(head.field);
+          if (remaining > 0x7FFFFFFF || !chunkType(head.field + 4))
+          {
+            broken = true;
+            state = Done;
+            break;
+          }
+          crc = computeCrc32(head.field + 4, 4);
+          state = remaining > 0 ? Data : Crc;
+        }
+        break;
+      case Data:
+      {
+        size_t n = remaining < size ? remaining : size;
+        crc = computeCrc32(data, n, crc);
+        data += n;
+        size -= n;
+        remaining -= n;
+        if (remaining == 0)
+          state = Crc;
+        break;
+      }
+      case Crc:
+        if (stored.take(data, size))
+        {
+          ++(be32(stored.field) == crc ? good : bad);
+          stored.reset();
+          sawEnd = memcmp(head.field + 4, "IEND", 4) == 0;
+          head.reset();
+          state = sawEnd ? Done : Head;
+        }
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  ScanEvent::Integrity result() const
+  {
+    if (good == 0 && bad == 0)
+      return ScanEvent::Unverified;
+    if (bad > 0 || broken || !sawEnd)
+      return ScanEvent::PartiallyCorrupt;
+    return ScanEvent::Verified;
+  }
+
+  // Chunk types are four ASCII letters.
+  static bool chunkType(const unsigned char *type)
+  {
+    for (int i = 0; i < 4; ++i)
+    {
+      unsigned char c = type[i] | 0x20;
+      if (c < 'a' || c > 'z')
+        return false;
+    }
+    return true;
+  }
+};
+
+// A ZIP member's CRC covers its uncompressed data, so deflated members are
+// inflated on the fly (with zlib). The central directory repeats each CRC;
+// a copy that disagrees with its member counts as corrupt too. Members that
+// cannot be checked (encrypted, other methods, ZIP64 sizes, or no zlib)
+// leave the file unverified unless something else is found corrupt.
+class ZipChecksum
+{
+ public:
+  ZipChecksum() = default;
+  ZipChecksum(const ZipChecksum &) = delete;
+  ZipChecksum &operator=(const ZipChecksum &) = delete;
+  ~ZipChecksum()
+  {
+#ifdef HAVE_ZLIB
+    if (inflating)
+      inflateEnd(&stream);
+#endif
+  }
+
+  void scan(const unsigned char *data, size_t size)
+  {
+    while (size > 0 && state != Done)
+    {
+      size_t before = size;
+      switch (state)
+      {
+      case Signature:
+        if (signature.filled == 0)
+          recordStart = position;
+        if (signature.take(data, size))
+          startRecord();
+        break;
+      case LocalHeader:
+        if (local.take(data, size))
+          startMember();
+        break;
+      case CentralHeader:
+        if (central.take(data, size))
+          checkCentral();
+        break;
+      case Skip:
+      {
+        size_t n = skipBytes < size ? skipBytes : size;
+        data += n;
+        size -= n;
+        skipBytes -= n;
+        break;
+      }
+      case Stored:
+      {
+        size_t n = skipBytes < size ? skipBytes : size;
+        crc = computeCrc32(data, n, crc);
+        data += n;
+        size -= n;
+        skipBytes -= n;
+        if (skipBytes == 0)
+          finishMember(expectedCrc);
+        break;
+      }
+      case Deflated:
+        inflateSome(data, size);
+        break;
+      case Descriptor:
+        if (descriptor.filled == 0)
+          recordStart = position + 12; // if the descriptor has no signature
+        if (descriptor.take(data, size))
+          readDescriptor();
+        break;
+      default:
+        break;
+      }
+      position += before - size;
+      if (state == Skip && skipBytes == 0)
+        nextRecord();
+    }
+  }
+
+  ScanEvent::Integrity result() const
+  {
+    if (bad > 0 || (broken && good > 0))
+      return ScanEvent::PartiallyCorrupt;
+    if (good > 0 && unchecked == 0 && sawEnd)
+      return ScanEvent::Verified;
+    return ScanEvent::Unverified;
+  }
+
+ private:
+  enum State
+  {
+    Signature,     // the next record's four signature bytes
+    LocalHeader,   // the rest of a local file header
+    CentralHeader, // the rest of a central directory header
+    Skip,          // names, extra fields, unchecked data
+    Stored,        // member data stored as is
+    Deflated,      // member data being inflated
+    Descriptor,    // data descriptor after a streamed member
+    Done
+  } state = Signature;
+
+  // Inflating more than this for a streamed member gives up on it, so a
+  // small member cannot pin a carve thread.
+  static constexpr uint64_t MAX_INFLATED = uint64_t(1) << 30;
+
+  FieldCollector<4> signature;
+  FieldCollector<26> local;
+  FieldCollector<42> central;
+  FieldCollector<16> descriptor;
+  uint64_t position = 0;    // bytes seen, from the archive's first byte
+  uint64_t recordStart = 0; // offset of the record being collected
+  uint64_t memberStart = 0; // offset of the current local header
+  uint64_t skipBytes = 0;
+  uint64_t inflated = 0;
+  uint32_t crc = 0, expectedCrc = 0;
+  // The current member, kept while its names are skipped.
+  uint16_t method = 0;
+  uint32_t compressed = 0, uncompressed = 0;
+  bool streamed = false;  // sizes and CRC follow the data (flag bit 3)
+  bool dataNext = false;  // the Skip in progress ends at member data
+  // Members seen, by local header offset, with their CRC when checked.
+  std::map<uint64_t, std::optional<uint32_t>> members;
+  size_t good = 0, bad = 0, unchecked = 0;
+  bool broken = false, sawEnd = false;
+#ifdef HAVE_ZLIB
+  z_stream stream{};
+  bool inflating = false;
+  std::vector<unsigned char> window;
+#endif
+
+  void startRecord()
+  {
+    static const unsigned char localSig[] = {0x50, 0x4B, 0x03, 0x04};
+    static const unsigned char centralSig[] = {0x50, 0x4B, 0x01, 0x02};
+    static const unsigned char endSig[] = {0x50, 0x4B, 0x05, 0x06};
+    if (memcmp(signature.field, localSig, 4) == 0)
+    {
+      memberStart = recordStart;
+      members[memberStart] = std::nullopt;
+      local.reset();
+      state = LocalHeader;
+    }
+    else if (memcmp(signature.field, centralSig, 4) == 0)
+    {
+      central.reset();
+      state = CentralHeader;
+    }
+    else
+    {
+      sawEnd = memcmp(signature.field, endSig, 4) == 0;
+      broken = !sawEnd;
+      state = Done;
+    }
+    signature.reset();
+  }
+
+  void startMember()
+  {
+    const unsigned char *h = local.field;
+    uint16_t flags = le16(h + 2);
+    method = le16(h + 4);
+    expectedCrc = le32(h + 10);
+    compressed = le32(h + 14);
+    uncompressed = le32(h + 18);
+    uint64_t names = uint64_t(le16(h + 22)) + le16(h + 24);
+    streamed = (flags & 0x08) != 0;
+    bool zip64 = compressed == 0xFFFFFFFF || uncompressed == 0xFFFFFFFF;
+    crc = 0;
+    inflated = 0;
+
+    // The names go past first, then the member data.
+    skipBytes = names;
+    bool encrypted = (flags & 0x01) != 0;
+#ifdef HAVE_ZLIB
+    bool canInflate = method == 8;
+#else
+    bool canInflate = false;
+#endif
+    if (encrypted || zip64 || (method != 0 && !canInflate) ||
+        (method == 0 && streamed))
+    {
+      ++unchecked;
+      if (streamed || zip64)
+      {
+        state = Done; // where the data ends is unknown
+        return;
+      }
+      skipBytes += compressed;
+      state = Skip;
+      return;
+    }
+    if (method == 0 && compressed != uncompressed)
+    {
+      ++bad;
+      skipBytes += compressed;
+      state = Skip;
+      return;
+    }
+    state = Skip;
+    dataNext = true;
+  }
+
+  // Runs when a Skip ends: either the member data starts, or a new record.
+  void nextRecord()
+  {
+    if (!dataNext)
+    {
+      state = Signature;
+      return;
+    }
+    dataNext = false;
+    if (method == 0)
+    {
+      skipBytes = compressed;
+      state = skipBytes > 0 ? Stored : Signature;
+      if (skipBytes == 0)
+        finishMember(expectedCrc);
+      return;
+    }
+#ifdef HAVE_ZLIB
+    if (!inflating)
+    {
+      if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+      {
+        broken = true;
+        state = Done;
+        return;
+      }
+      inflating = true;
+      window.resize(64 * 1024);
+    }
+    else
+      inflateReset(&stream);
+    skipBytes = streamed ? UINT64_MAX : compressed;
+    state = Deflated;
+#endif
+  }
+
+  void inflateSome(const unsigned char *&data, size_t &size)
+  {
+#ifdef HAVE_ZLIB
+    size_t offered = skipBytes < size ? skipBytes : size;
+    stream.next_in = const_cast<Bytef *>(data);
+    stream.avail_in = static_cast<uInt>(offered);
+    int status = Z_OK;
+    while (status == Z_OK && (stream.avail_in > 0 || stream.avail_out == 0))
+    {
+      stream.next_out = window.data();
+      stream.avail_out = static_cast<uInt>(window.size());
+      status = inflate(&stream, Z_NO_FLUSH);
+      size_t produced = window.size() - stream.avail_out;
+      crc = computeCrc32(window.data(), produced, crc);
+      inflated += produced;
+      if (inflated > (streamed ? MAX_INFLATED : uint64_t(uncompressed)))
+        status = Z_DATA_ERROR;
+    }
+    size_t used = offered - stream.avail_in;
+    data += used;
+    size -= used;
+    skipBytes -= streamed ? 0 : used;
+
+    if (status == Z_STREAM_END)
+    {
+      if (streamed)
+      {
+        descriptor.reset();
+        state = Descriptor;
+      }
+      else if (skipBytes > 0 || inflated != uncompressed)
+      {
+        ++bad; // the deflate stream and the header disagree on the size
+        state = Skip;
+      }
+      else
+        finishMember(expectedCrc);
+    }
+    else if (status != Z_OK && status != Z_BUF_ERROR)
+    {
+      ++bad;
+      if (streamed)
+      {
+        broken = true;
+        state = Done;
+      }
+      else
+        state = Skip;
+    }
+    else if (!streamed && skipBytes == 0)
+    {
+      ++bad; // the data ran out before the deflate stream ended
+      state = Signature;
+    }
+#else
+    (void)data;
+    (void)size;
+#endif
+  }
+
+  // The descriptor may or may not start with its own signature; a 16-byte
+  // read covers both layouts.
+  void readDescriptor()
+  {
+    static const unsigned char descriptorSig[] = {0x50, 0x4B, 0x07, 0x08};
+    bool signed_ = memcmp(descriptor.field, descriptorSig, 4) == 0;
+    const unsigned char *d = descriptor.field + (signed_ ? 4 : 0);
+    expectedCrc = le32(d);
+    finishMember(expectedCrc);
+    if (!signed_)
+    {
+      // The last four bytes were the next record's signature.
+      memcpy(signature.field, descriptor.field + 12, 4);
+      signature.filled = 4;
+      startRecord();
+    }
+  }
+
+  void finishMember(uint32_t stored)
+  {
+    ++(crc == stored ? good : bad);
+    members[memberStart] = crc;
+    state = Signature;
+  }
+
+  void checkCentral()
+  {
+    const unsigned char *h = central.field;
+    // Each entry must point at a member of this carve with the same CRC.
+    // One that does not means a member was lost, or the carve started
+    // inside a larger archive.
+    uint32_t offset = le32(h + 38);
+    auto member = members.find(offset);
+    if (offset != 0xFFFFFFFF &&
+        (member == members.end() ||
+         (member->second && *member->second != le32(h + 12))))
+      ++bad;
+    skipBytes = uint64_t(le16(h + 24)) + le16(h + 26) + le16(h + 28);
+    state = Skip;
+  }
+};
+
+#endif // CHECKSUMS_H
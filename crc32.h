@@ -0,0 +1,147 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define CRC32_X86 1
+#endif
+
+// --- CRC-32 ---
+// The IEEE 802.3 CRC used by PNG chunks and ZIP entries (reflected,
+// polynomial 0xEDB88320). `crc` continues an earlier call; start with 0.
+// Carved files are checked at device speed, so long buffers are folded with
+// carry-less multiplies (PCLMULQDQ) when the CPU has them, and everything
+// else goes through slicing-by-8 tables.
+
+using Crc32Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+// tables[0] is the classic byte table; tables[k] advances a byte that sits
+// k positions further from the end of an 8-byte word.
+inline const Crc32Tables &crc32Tables()
+{
+  static const Crc32Tables tables = []()
+  {
+    Crc32Tables t{};
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k)
+        c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      t[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+      for (int k = 1; k < 8; ++k)
+        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+    return t;
+  }();
+  return tables;
+}
+
+// Works on the inverted register, like the folding path below.
+inline uint32_t crc32Slicing8(const unsigned char *data, size_t size,
+                              uint32_t reg)
+{
+  const Crc32Tables &t = crc32Tables();
+  for (; size >= 8; data += 8, size -= 8)
+  {
+    uint32_t one = (uint32_t(data[0]) | uint32_t(data[1]) << 8 |
+                    uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24) ^
+                   reg;
+    uint32_t two = uint32_t(data[4]) | uint32_t(data[5]) << 8 |
+                   uint32_t(data[6]) << 16 | uint32_t(data[7]) << 24;
+    reg = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+          t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^ t[3][two & 0xFF] ^
+          t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^
+          t[0][two >> 24];
+  }
+  for (; size > 0; ++data, --size)
+    reg = t[0][(reg ^ *data) & 0xFF] ^ (reg >> 8);
+  return reg;
+}
+
+#ifdef CRC32_X86
+// x * k (both 64-bit halves, carry-less) + next.
+__attribute__((target("pclmul,sse4.1"))) inline __m128i
+crc32Fold(__m128i x, __m128i k, __m128i next)
+{
+  __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+  __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+  return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+}
+
+// Folds four 128-bit lanes across 64-byte blocks, then down to one lane and
+// a Barrett reduction (Gopal et al., "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ"). `size` must be a multiple of 16, at least 64.
+__attribute__((target("pclmul,sse4.1"))) inline uint32_t
+crc32Pclmul(const unsigned char *data, size_t size, uint32_t reg)
+{
+  alignas(16) static const uint64_t k1k2[] = {0x154442bd4, 0x1c6e41596};
+  alignas(16) static const uint64_t k3k4[] = {0x1751997d0, 0x0ccaa009e};
+  alignas(16) static const uint64_t k5k0[] = {0x163cd6124, 0x000000000};
+  alignas(16) static const uint64_t poly[] = {0x1db710641, 0x1f7011641};
+  auto load = [](const unsigned char *p)
+  { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); };
+
+  __m128i x1 = _mm_xor_si128(load(data), _mm_cvtsi32_si128(int(reg)));
+  __m128i x2 = load(data + 16);
+  __m128i x3 = load(data + 32);
+  __m128i x4 = load(data + 48);
+  data += 64;
+  size -= 64;
+
+  __m128i k = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+  for (; size >= 64; data += 64, size -= 64)
+  {
+    x1 = crc32Fold(x1, k, load(data));
+    x2 = crc32Fold(x2, k, load(data + 16));
+    x3 = crc32Fold(x3, k, load(data + 32));
+    x4 = crc32Fold(x4, k, load(data + 48));
+  }
+
+  k = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+  x1 = crc32Fold(x1, k, x2);
+  x1 = crc32Fold(x1, k, x3);
+  x1 = crc32Fold(x1, k, x4);
+  for (; size >= 16; data += 16, size -= 16)
+    x1 = crc32Fold(x1, k, load(data));
+
+  // 128 bits down to 64, then 64 down to 32.
+  __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+  x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  k = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  k = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), k, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return uint32_t(_mm_extract_epi32(x1, 1));
+}
+#endif
+
+inline uint32_t computeCrc32(const unsigned char *data, size_t size,
+                             uint32_t crc = 0)
+{
+  uint32_t reg = ~crc;
+#ifdef CRC32_X86
+  static const bool hasPclmul = __builtin_cpu_supports("pclmul") &&
+                                __builtin_cpu_supports("sse4.1");
+  if (hasPclmul && size >= 64)
+  {
+    size_t folded = size & ~size_t(15);
+    reg = crc32Pclmul(data, folded, reg);
+    data += folded;
+    size -= folded;
+  }
+#endif
+  return ~crc32Slicing8(data, size, reg);
+}
+
+#endif // CRC32_H
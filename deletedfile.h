@@ -0,0 +1,27 @@
+#ifndef DELETEDFILE_H
+#define DELETEDFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One contiguous piece of a file: `length` bytes at `deviceOffset` on the
+// input device hold the file bytes starting at `logicalOffset`.
+struct FileExtent
+{
+  uint64_t logicalOffset;
+  uint64_t deviceOffset;
+  uint64_t length;
+};
+
+// A deleted file recovered from filesystem metadata rather than carving.
+// Gaps between extents are holes and read back as zeros.
+struct DeletedFile
+{
+  std::string name; // original name when the metadata still has it
+  uint64_t size = 0;
+  std::vector<FileExtent> extents;
+  std::vector<unsigned char> residentData; // small files stored in metadata
+};
+
+#endif // DELETEDFILE_H
@@ -0,0 +1,524 @@
+#ifndef EXT4_H
+#define EXT4_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "deletedfile.h"
+#include "fsutil.h"
+#include "scanrange.h"
+
+using namespace std;
+
+// Reader for the ext2/ext3/ext4 on-disk layout. It only needs the superblock,
+// the group descriptor table and the block bitmaps to tell which blocks are
+// unallocated; deleted file data can only live in those. Deleted inodes are
+// found by walking the inode tables, with older copies of inode table blocks
+// taken from the jbd2 journal when deletion already cleared the block map.
+class Ext4
+{
+public:
+  // --- ext4 Constants ---
+  static const uint32_t SUPERBLOCK_OFFSET = 1024;
+  static const uint16_t EXT4_MAGIC = 0xEF53;
+  static const uint32_t INCOMPAT_64BIT = 0x80;
+  static const uint16_t BG_INODE_UNINIT = 0x0001; // inode table never used
+  static const uint16_t BG_BLOCK_UNINIT = 0x0002; // bitmap never written
+  static const uint32_t COMPAT_HAS_JOURNAL = 0x4;
+  static const uint32_t EXTENTS_FL = 0x80000;
+  static const uint16_t EXTENT_MAGIC = 0xF30A;
+  static const uint32_t JBD2_MAGIC = 0xC03B3998;
+  static const uint32_t JBD2_DESCRIPTOR_BLOCK = 1;
+
+  struct GroupDesc
+  {
+    uint64_t blockBitmap;
+    uint64_t inodeBitmap;
+    uint64_t inodeTable;
+    uint16_t flags;
+  };
+
+  // Parses the superblock and group descriptors. Returns false when the
+  // device does not hold an ext2/3/4 filesystem, or one whose superblock
+  // does not fit the `deviceSize` bytes of the device.
+  bool open(BlockReader &reader, uint64_t partitionOffset, uint64_t deviceSize)
+  {
+    base = partitionOffset;
+    device = &reader;
+    if (base >= deviceSize)
+      return false;
+
+    vector<unsigned char> sb(1024);
+    if (!readAt(*device, base + SUPERBLOCK_OFFSET, sb) ||
+        le16(&sb[0x38]) != EXT4_MAGIC)
+      return false;
+
+    uint32_t logBlockSize = le32(&sb[0x18]);
+    if (logBlockSize > 6) // 64 KiB is the largest valid block size
+      return false;
+    block_size = 1024u << logBlockSize;
+    inodes_count = le32(&sb[0x00]);
+    first_data_block = le32(&sb[0x14]);
+    blocks_per_group = le32(&sb[0x20]);
+    inodes_per_group = le32(&sb[0x28]);
+    inode_size = le16(&sb[0x58]);
+    feature_compat = le32(&sb[0x5C]);
+    feature_incompat = le32(&sb[0x60]);
+    journal_inum = le32(&sb[0xE0]);
+    blocks_count = le32(&sb[0x04]);
+    desc_size = 32;
+    if (feature_incompat & INCOMPAT_64BIT)
+    {
+      blocks_count |= static_cast<uint64_t>(le32(&sb[0x150])) << 32;
+      desc_size = le16(&sb[0xFE]);
+    }
+    if (inode_size == 0)
+      inode_size = 128; // revision 0 filesystems
+    // A group's bitmaps are one block each, so neither count can exceed
+    // the block's bits, and mke2fs makes no group under 256 blocks. These
+    // bound the group descriptor table allocated below.
+    if (blocks_per_group < 256 || blocks_per_group > 8 * block_size ||
+        inodes_per_group == 0 || inodes_per_group > 8 * block_size ||
+        (desc_size != 32 && desc_size != 64) || inode_size < 128 ||
+        inode_size > block_size || blocks_count <= first_data_block ||
+        blocks_count > (deviceSize - base) / block_size)
+      return false;
+
+    uint64_t groupCount =
+        (blocks_count - first_data_block + blocks_per_group - 1) /
+        blocks_per_group;
+    vector<unsigned char> gdt(groupCount * desc_size);
+    if (!readAt(*device, base + (first_data_block + 1) * block_size, gdt))
+      return false;
+
+    groups.clear();
+    for (uint64_t g = 0; g < groupCount; ++g)
+    {
+      const unsigned char *d = &gdt[g * desc_size];
+      GroupDesc desc;
+      desc.blockBitmap = le32(d + 0x00);
+      desc.inodeBitmap = le32(d + 0x04);
+      desc.inodeTable = le32(d + 0x08);
+      desc.flags = le16(d + 0x12);
+      if (desc_size >= 64)
+      {
+        desc.blockBitmap |= static_cast<uint64_t>(le32(d + 0x20)) << 32;
+        desc.inodeBitmap |= static_cast<uint64_t>(le32(d + 0x24)) << 32;
+        desc.inodeTable |= static_cast<uint64_t>(le32(d + 0x28)) << 32;
+      }
+      groups.push_back(desc);
+    }
+    return true;
+  }
+
+  uint32_t blockSize() const { return block_size; }
+  uint64_t totalBytes() const { return blocks_count * block_size; }
+
+  // Walks every block bitmap and returns the unallocated blocks as byte
+  // ranges, coalesced across group boundaries.
+  vector<ScanRange> freeRanges(function<bool()> cancelCheck)
+  {
+    vector<ScanRange> ranges;
+    vector<unsigned char> bitmap(block_size);
+    for (size_t g = 0; g < groups.size(); ++g)
+    {
+      if (cancelCheck())
+        break;
+      uint64_t groupStart = first_data_block + g * blocks_per_group;
+      uint64_t groupBlocks =
+          min<uint64_t>(blocks_per_group, blocks_count - groupStart);
+
+      if (groups[g].flags & BG_BLOCK_UNINIT)
+      {
+        addBlocks(ranges, groupStart, groupBlocks);
+        continue;
+      }
+      if (!readAt(*device, base + groups[g].blockBitmap * block_size, bitmap))
+        continue; // unreadable bitmap: leave the group out
+
+      uint64_t runStart = 0, runLength = 0;
+      for (uint64_t b = 0; b < groupBlocks; ++b)
+      {
+        bool used = (bitmap[b >> 3] >> (b & 7)) & 1;
+        if (!used)
+        {
+          if (runLength == 0)
+            runStart = groupStart + b;
+          runLength++;
+        }
+        else if (runLength > 0)
+        {
+          addBlocks(ranges, runStart, runLength);
+          runLength = 0;
+        }
+      }
+      if (runLength > 0)
+        addBlocks(ranges, runStart, runLength);
+    }
+    return ranges;
+  }
+
+  // Finds deleted regular files whose block map can still be decoded, either
+  // from the inode table itself or from the newest journal copy of it, and
+  // whose data blocks have not been handed out again since.
+  vector<DeletedFile> deletedFiles(function<bool()> cancelCheck)
+  {
+    map<uint32_t, vector<unsigned char>> deleted; // inode number -> raw inode
+    vector<unsigned char> table(static_cast<size_t>(inodes_per_group) *
+                                inode_size);
+    for (size_t g = 0; g < groups.size() && !cancelCheck(); ++g)
+    {
+      if ((groups[g].flags & BG_INODE_UNINIT) ||
+          !readAt(*device, base + groups[g].inodeTable * block_size, table))
+        continue;
+      for (uint32_t i = 0; i < inodes_per_group; ++i)
+      {
+        const unsigned char *inode = &table[static_cast<size_t>(i) * inode_size];
+        if (isRegularFile(inode) && le32(inode + 0x14) != 0 &&
+            le16(inode + 0x1A) == 0)
+          deleted[g * inodes_per_group + i + 1].assign(inode,
+                                                       inode + inode_size);
+      }
+    }
+    if (deleted.empty())
+      return {};
+
+    // ext4 clears the extent tree on unlink; a pre-deletion copy of the
+    // inode may survive in the journal.
+    map<uint32_t, vector<unsigned char>> journalCopies;
+    scanJournal(deleted, journalCopies, cancelCheck);
+
+    vector<DeletedFile> files;
+    journal_recoveries = 0;
+    for (const auto &entry : deleted)
+    {
+      if (cancelCheck())
+        break;
+      DeletedFile file;
+      bool fromJournal = false;
+      if (!decodeInode(entry.second.data(), file))
+      {
+        auto copy = journalCopies.find(entry.first);
+        if (copy == journalCopies.end() ||
+            !decodeInode(copy->second.data(), file))
+          continue;
+        fromJournal = true;
+      }
+      if (!extentsStillFree(file))
+        continue; // blocks were reused; the data is gone
+      file.name = "inode_" + to_string(entry.first);
+      files.push_back(file);
+      if (fromJournal)
+        journal_recoveries++;
+    }
+    return files;
+  }
+
+  // How many of the last deletedFiles() results came from journal copies.
+  size_t journalRecoveries() const { return journal_recoveries; }
+
+private:
+  static bool isRegularFile(const unsigned char *inode)
+  {
+    return (le16(inode) & 0xF000) == 0x8000;
+  }
+
+  // Fills `file` with the size and extents recorded in a raw inode. Returns
+  // false when the inode no longer maps any data.
+  bool decodeInode(const unsigned char *inode, DeletedFile &file)
+  {
+    file.size = le32(inode + 0x04) |
+                (static_cast<uint64_t>(le32(inode + 0x6C)) << 32);
+    file.extents.clear();
+    if (file.size == 0)
+      return false;
+    const unsigned char *iblock = inode + 0x28;
+    if (le32(inode + 0x20) & EXTENTS_FL)
+      walkExtentNode(iblock, 60, 0, file.extents);
+    else
+    {
+      uint64_t logical = 0;
+      for (int i = 0; i < 12; ++i)
+        addMapped(le32(iblock + i * 4), logical++, file.extents);
+      for (int level = 1; level <= 3; ++level)
+        walkIndirect(le32(iblock + (11 + level) * 4), level, logical,
+                     file.extents);
+    }
+    // Drop whatever lies past the file size (preallocated blocks).
+    vector<FileExtent> clipped;
+    for (FileExtent e : file.extents)
+    {
+      if (e.logicalOffset >= file.size)
+        continue;
+      e.length = min<uint64_t>(e.length, file.size - e.logicalOffset);
+      clipped.push_back(e);
+    }
+    file.extents.swap(clipped);
+    return !file.extents.empty();
+  }
+
+  void walkExtentNode(const unsigned char *node, size_t nodeSize, int level,
+                      vector<FileExtent> &out)
+  {
+    if (level > 5 || nodeSize < 12 || le16(node) != EXTENT_MAGIC)
+      return;
+    uint16_t entries = le16(node + 2);
+    uint16_t depth = le16(node + 6);
+    if (12 + entries * 12u > nodeSize)
+      return;
+    for (uint16_t i = 0; i < entries; ++i)
+    {
+      const unsigned char *e = node + 12 + i * 12;
+      if (depth == 0)
+      {
+        uint64_t logical = le32(e);
+        uint32_t length = le16(e + 4);
+        uint64_t start = le32(e + 8) | (static_cast<uint64_t>(le16(e + 6)) << 32);
+        if (length > 32768)
+          continue; // uninitialised extent: reads as zeros, leave a hole
+        if (start + length <= blocks_count)
+          out.push_back({logical * block_size, base + start * block_size,
+                         static_cast<uint64_t>(length) * block_size});
+      }
+      else
+      {
+        uint64_t leaf = le32(e + 4) | (static_cast<uint64_t>(le16(e + 8)) << 32);
+        vector<unsigned char> child(block_size);
+        if (leaf < blocks_count &&
+            readAt(*device, base + leaf * block_size, child))
+          walkExtentNode(child.data(), child.size(), level + 1, out);
+      }
+    }
+  }
+
+  // ext2/3 block map: `level` levels of indirection below `block`.
+  void walkIndirect(uint32_t block, int level, uint64_t &logical,
+                    vector<FileExtent> &out)
+  {
+    uint64_t pointers = block_size / 4;
+    uint64_t span = 1;
+    for (int i = 0; i < level; ++i)
+      span *= pointers;
+    vector<unsigned char> table(block_size);
+    if (block == 0 || block >= blocks_count ||
+        !readAt(*device, base + static_cast<uint64_t>(block) * block_size,
+                table))
+    {
+      logical += span;
+      return;
+    }
+    for (uint64_t i = 0; i < pointers; ++i)
+    {
+      uint32_t child = le32(&table[i * 4]);
+      if (level == 1)
+        addMapped(child, logical++, out);
+      else
+        walkIndirect(child, level - 1, logical, out);
+    }
+  }
+
+  void addMapped(uint32_t block, uint64_t logical, vector<FileExtent> &out)
+  {
+    if (block == 0 || block >= blocks_count)
+      return;
+    uint64_t offset = base + static_cast<uint64_t>(block) * block_size;
+    if (!out.empty() &&
+        out.back().logicalOffset + out.back().length == logical * block_size &&
+        out.back().deviceOffset + out.back().length == offset)
+      out.back().length += block_size;
+    else
+      out.push_back({logical * block_size, offset, block_size});
+  }
+
+  bool isBlockFree(uint64_t block)
+  {
+    if (block < first_data_block)
+      return false;
+    size_t g = (block - first_data_block) / blocks_per_group;
+    if (g >= groups.size())
+      return false;
+    if (groups[g].flags & BG_BLOCK_UNINIT)
+      return true;
+    auto it = bitmap_cache.find(g);
+    if (it == bitmap_cache.end())
+    {
+      vector<unsigned char> bitmap(block_size);
+      if (!readAt(*device, base + groups[g].blockBitmap * block_size, bitmap))
+        bitmap.assign(block_size, 0xFF);
+      it = bitmap_cache.emplace(g, move(bitmap)).first;
+    }
+    uint64_t b = (block - first_data_block) % blocks_per_group;
+    return !((it->second[b >> 3] >> (b & 7)) & 1);
+  }
+
+  bool extentsStillFree(const DeletedFile &file)
+  {
+    for (const FileExtent &e : file.extents)
+    {
+      uint64_t first = (e.deviceOffset - base) / block_size;
+      uint64_t count = (e.length + block_size - 1) / block_size;
+      for (uint64_t b = first; b < first + count; ++b)
+      {
+        if (!isBlockFree(b))
+          return false;
+      }
+    }
+    return true;
+  }
+
+  // Maps journal block `index` to a device block through the journal
+  // inode's extents.
+  uint64_t journalBlock(const vector<FileExtent> &journal, uint64_t index)
+  {
+    uint64_t logical = index * block_size;
+    for (const FileExtent &e : journal)
+    {
+      if (logical >= e.logicalOffset && logical < e.logicalOffset + e.length)
+        return e.deviceOffset + (logical - e.logicalOffset);
+    }
+    return 0;
+  }
+
+  // Reads every descriptor block in the journal and keeps, for each inode in
+  // `deleted`, the newest logged copy that still maps data.
+  void scanJournal(const map<uint32_t, vector<unsigned char>> &deleted,
+                   map<uint32_t, vector<unsigned char>> &copies,
+                   function<bool()> cancelCheck)
+  {
+    if (!(feature_compat & COMPAT_HAS_JOURNAL) || journal_inum == 0)
+      return;
+    vector<unsigned char> inode(inode_size);
+    uint32_t group = (journal_inum - 1) / inodes_per_group;
+    uint32_t index = (journal_inum - 1) % inodes_per_group;
+    if (group >= groups.size() ||
+        !readAt(*device,
+                base + groups[group].inodeTable * block_size +
+                    static_cast<uint64_t>(index) * inode_size,
+                inode))
+      return;
+    DeletedFile journalFile;
+    if (!decodeInode(inode.data(), journalFile))
+      return;
+    const vector<FileExtent> &journal = journalFile.extents;
+
+    vector<unsigned char> block(block_size);
+    uint64_t jsb = journalBlock(journal, 0);
+    if (!jsb || !readAt(*device, jsb, block) || be32(&block[0]) != JBD2_MAGIC)
+      return;
+    uint32_t maxLen = be32(&block[0x10]);
+    uint32_t first = be32(&block[0x14]);
+    uint32_t incompat = be32(&block[0x28]);
+    bool csumV3 = incompat & 0x10;
+    bool csumV2 = incompat & 0x08;
+    bool blocks64 = incompat & 0x2;
+    // As jbd2's journal_tag_bytes(): a v3 tag is always 16 bytes; older
+    // ones are 12 with a 64-bit block number, 8 without, and a v2 checksum
+    // adds 2.
+    size_t tagSize = csumV3 ? 16 : (blocks64 ? 12 : 8) + (csumV2 ? 2 : 0);
+    size_t tail = (csumV2 || csumV3) ? 4 : 0;
+
+    map<uint32_t, uint32_t> newestSequence;
+    vector<unsigned char> data(block_size);
+    for (uint32_t j = first; j < maxLen; ++j)
+    {
+      if ((j & 0xFFF) == 0 && cancelCheck())
+        return;
+      uint64_t where = journalBlock(journal, j);
+      if (!where || !readAt(*device, where, block) ||
+          be32(&block[0]) != JBD2_MAGIC ||
+          be32(&block[4]) != JBD2_DESCRIPTOR_BLOCK)
+        continue;
+      uint32_t sequence = be32(&block[8]);
+
+      size_t pos = 12;
+      uint32_t dataIndex = j;
+      while (pos + tagSize <= block_size - tail)
+      {
+        const unsigned char *tag = &block[pos];
+        uint64_t fsBlock = be32(tag);
+        uint32_t flags = csumV3 ? be32(tag + 4) : (be32(tag + 4) & 0xFFFF);
+        if (blocks64)
+          fsBlock |= static_cast<uint64_t>(be32(tag + 8)) << 32;
+        pos += tagSize;
+        if (!(flags & 0x2)) // no SAME_UUID: a 16 byte UUID follows
+          pos += 16;
+        if (++dataIndex >= maxLen)
+          dataIndex = first + (dataIndex - maxLen);
+
+        int g = inodeTableGroup(fsBlock);
+        uint64_t dataWhere = journalBlock(journal, dataIndex);
+        if (g >= 0 && dataWhere && readAt(*device, dataWhere, data))
+        {
+          if (flags & 0x1) // escaped: the journal magic was zeroed out
+            data[0] = 0xC0, data[1] = 0x3B, data[2] = 0x39, data[3] = 0x98;
+          uint64_t firstInode =
+              static_cast<uint64_t>(g) * inodes_per_group +
+              (fsBlock - groups[g].inodeTable) * (block_size / inode_size) + 1;
+          for (size_t k = 0; k < block_size / inode_size; ++k)
+          {
+            uint32_t ino = static_cast<uint32_t>(firstInode + k);
+            const unsigned char *copy = &data[k * inode_size];
+            if (!deleted.count(ino) || !isRegularFile(copy) ||
+                le16(copy + 0x1A) == 0)
+              continue;
+            auto seen = newestSequence.find(ino);
+            if (seen != newestSequence.end() && seen->second > sequence)
+              continue;
+            newestSequence[ino] = sequence;
+            copies[ino].assign(copy, copy + inode_size);
+          }
+        }
+        if (flags & 0x8) // LAST_TAG
+          break;
+      }
+    }
+  }
+
+  // Returns the group whose inode table contains `block`, or -1.
+  int inodeTableGroup(uint64_t block) const
+  {
+    uint64_t tableBlocks =
+        (static_cast<uint64_t>(inodes_per_group) * inode_size + block_size - 1) /
+        block_size;
+    for (size_t g = 0; g < groups.size(); ++g)
+    {
+      if (block >= groups[g].inodeTable &&
+          block < groups[g].inodeTable + tableBlocks)
+        return static_cast<int>(g);
+    }
+    return -1;
+  }
+
+  void addBlocks(vector<ScanRange> &ranges, uint64_t firstBlock,
+                 uint64_t count)
+  {
+    size_t start = base + firstBlock * block_size;
+    size_t length = count * block_size;
+    if (!ranges.empty() && ranges.back().end() == start)
+      ranges.back().length += length;
+    else
+      ranges.push_back({start, length});
+  }
+
+  BlockReader *device = nullptr;
+  uint64_t base = 0;
+  uint32_t block_size = 0;
+  uint32_t inodes_count = 0;
+  uint32_t first_data_block = 0;
+  uint32_t blocks_per_group = 0;
+  uint32_t inodes_per_group = 0;
+  uint32_t feature_compat = 0;
+  uint32_t feature_incompat = 0;
+  uint32_t journal_inum = 0;
+  uint16_t inode_size = 0;
+  uint16_t desc_size = 0;
+  uint64_t blocks_count = 0;
+  vector<GroupDesc> groups;
+  map<size_t, vector<unsigned char>> bitmap_cache;
+  size_t journal_recoveries = 0;
+};
+
+#endif // EXT4_H
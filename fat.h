@@ -0,0 +1,554 @@
+#ifndef FAT_H
+#define FAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "deletedfile.h"
+#include "fsutil.h"
+#include "scanrange.h"
+
+using namespace std;
+
+// Reader for FAT12/16/32 and exFAT volumes. FAT volumes record free clusters
+// as zero entries in the allocation table; exFAT keeps a separate allocation
+// bitmap referenced from the root directory. Deleting a file only marks its
+// directory entry (0xE5 on FAT, a cleared in-use bit on exFAT) and frees the
+// clusters, so the start cluster and size survive.
+class Fat
+{
+public:
+  enum Type
+  {
+    FAT12,
+    FAT16,
+    FAT32,
+    EXFAT
+  };
+
+  // --- Directory entry constants ---
+  static const uint8_t FAT_DELETED = 0xE5;
+  static const uint8_t FAT_ATTR_LFN = 0x0F;
+  static const uint8_t FAT_ATTR_VOLUME = 0x08;
+  static const uint8_t FAT_ATTR_DIRECTORY = 0x10;
+  static const uint8_t EXFAT_ENTRY_BITMAP = 0x81;
+  static const uint8_t EXFAT_ENTRY_FILE = 0x05;   // | 0x80 when in use
+  static const uint8_t EXFAT_ENTRY_STREAM = 0x40; // | 0x80 when in use
+  static const uint8_t EXFAT_ENTRY_NAME = 0x41;   // | 0x80 when in use
+  static const uint8_t EXFAT_IN_USE = 0x80;
+
+  bool open(BlockReader &reader, uint64_t partitionOffset = 0)
+  {
+    base = partitionOffset;
+    device = &reader;
+
+    unsigned char boot[512];
+    if (!readAt(*device, base, boot, sizeof(boot)) || boot[510] != 0x55 ||
+        boot[511] != 0xAA)
+      return false;
+    if (memcmp(boot + 3, "EXFAT   ", 8) == 0)
+      return openExfat(boot);
+    if (boot[0] != 0xEB && boot[0] != 0xE9)
+      return false;
+
+    uint32_t bytesPerSector = le16(boot + 0x0B);
+    uint32_t sectorsPerCluster = boot[0x0D];
+    uint32_t reservedSectors = le16(boot + 0x0E);
+    uint32_t fatCount = boot[0x10];
+    uint32_t rootEntries = le16(boot + 0x11);
+    uint32_t totalSectors = le16(boot + 0x13);
+    if (totalSectors == 0)
+      totalSectors = le32(boot + 0x20);
+    uint32_t fatSectors = le16(boot + 0x16);
+    if (fatSectors == 0)
+      fatSectors = le32(boot + 0x24);
+
+    if (!isPowerOfTwo(bytesPerSector) || bytesPerSector < 512 ||
+        bytesPerSector > 4096 || !isPowerOfTwo(sectorsPerCluster) ||
+        reservedSectors == 0 || fatCount == 0 || fatCount > 4 ||
+        fatSectors == 0 || totalSectors == 0)
+      return false;
+
+    uint32_t rootDirSectors =
+        (rootEntries * 32 + bytesPerSector - 1) / bytesPerSector;
+    uint64_t metaSectors = reservedSectors +
+                           static_cast<uint64_t>(fatCount) * fatSectors +
+                           rootDirSectors;
+    if (metaSectors >= totalSectors)
+      return false;
+
+    cluster_size = bytesPerSector * sectorsPerCluster;
+    cluster_count = (totalSectors - metaSectors) / sectorsPerCluster;
+    fat_offset = static_cast<uint64_t>(reservedSectors) * bytesPerSector;
+    root_dir_offset =
+        fat_offset + static_cast<uint64_t>(fatCount) * fatSectors * bytesPerSector;
+    root_dir_bytes = rootDirSectors * bytesPerSector;
+    data_offset = metaSectors * bytesPerSector;
+
+    // The cluster count alone decides the FAT width (Microsoft FAT spec).
+    if (cluster_count < 4085)
+      fs_type = FAT12;
+    else if (cluster_count < 65525)
+      fs_type = FAT16;
+    else
+    {
+      fs_type = FAT32;
+      root_cluster = le32(boot + 0x2C);
+    }
+    return true;
+  }
+
+  Type type() const { return fs_type; }
+  uint32_t clusterSize() const { return cluster_size; }
+
+  string typeName() const
+  {
+    static const char *names[] = {"FAT12", "FAT16", "FAT32", "exFAT"};
+    return names[fs_type];
+  }
+
+  // Returns the free clusters of the data region as byte ranges.
+  vector<ScanRange> freeRanges(function<bool()> cancelCheck)
+  {
+    if (fs_type == EXFAT)
+      return exfatFreeRanges(cancelCheck);
+
+    vector<ScanRange> ranges;
+    uint32_t runStart = 0, runLength = 0;
+    for (uint32_t c = 2; c < cluster_count + 2; ++c)
+    {
+      if ((c & 0xFFFF) == 0 && cancelCheck())
+        break;
+      if (fatEntry(c) == 0)
+      {
+        if (runLength == 0)
+          runStart = c;
+        runLength++;
+      }
+      else if (runLength > 0)
+      {
+        addClusters(ranges, runStart, runLength);
+        runLength = 0;
+      }
+    }
+    if (runLength > 0)
+      addClusters(ranges, runStart, runLength);
+    return ranges;
+  }
+
+  // Walks the directory tree (including the first cluster of deleted
+  // directories) and returns deleted files whose clusters, assumed
+  // contiguous from the start cluster, are all still free.
+  vector<DeletedFile> deletedFiles(function<bool()> cancelCheck)
+  {
+    vector<DeletedFile> files;
+    if (fs_type == EXFAT && !loadExfatBitmap())
+      return files;
+
+    vector<DirRef> pending;
+    if (fs_type == FAT12 || fs_type == FAT16)
+    {
+      vector<unsigned char> root(root_dir_bytes);
+      if (readAt(*device, base + root_dir_offset, root))
+        scanFatDirectory(root, files, pending);
+    }
+    else
+      pending.push_back({root_cluster, 0, false});
+
+    set<uint32_t> visited;
+    while (!pending.empty() && !cancelCheck())
+    {
+      DirRef ref = pending.back();
+      pending.pop_back();
+      if (!visited.insert(ref.cluster).second)
+        continue;
+      vector<unsigned char> dir = readDirectory(ref);
+      if (fs_type == EXFAT)
+        scanExfatDirectory(dir, files, pending);
+      else
+        scanFatDirectory(dir, files, pending);
+    }
+    return files;
+  }
+
+private:
+  // A directory to visit: chained through the FAT, or `length` contiguous
+  // bytes when the chain is gone (deleted) or never existed (exFAT).
+  struct DirRef
+  {
+    uint32_t cluster;
+    uint64_t length;
+    bool contiguous;
+  };
+
+  static constexpr size_t MAX_DIRECTORY_BYTES = 2 * 1024 * 1024; // 65536 entries
+
+  vector<unsigned char> readDirectory(const DirRef &ref)
+  {
+    vector<unsigned char> dir;
+    size_t maxClusters = MAX_DIRECTORY_BYTES / cluster_size + 1;
+    if (!ref.contiguous)
+    {
+      vector<unsigned char> chunk(cluster_size);
+      for (uint32_t c : clusterChain(ref.cluster, maxClusters))
+      {
+        if (!readAt(*device, clusterOffset(c), chunk))
+          break;
+        dir.insert(dir.end(), chunk.begin(), chunk.end());
+      }
+      return dir;
+    }
+    uint64_t length = min<uint64_t>(max<uint64_t>(ref.length, cluster_size),
+                                    MAX_DIRECTORY_BYTES);
+    uint64_t clusters = (length + cluster_size - 1) / cluster_size;
+    if (ref.cluster < 2 || ref.cluster + clusters > cluster_count + 2)
+      return dir;
+    dir.resize(clusters * cluster_size);
+    if (!readAt(*device, clusterOffset(ref.cluster), dir))
+      dir.clear();
+    return dir;
+  }
+
+  void scanFatDirectory(const vector<unsigned char> &dir,
+                        vector<DeletedFile> &files, vector<DirRef> &pending)
+  {
+    vector<const unsigned char *> longName; // LFN entries in disk order
+    for (size_t pos = 0; pos + 32 <= dir.size(); pos += 32)
+    {
+      const unsigned char *e = &dir[pos];
+      if (e[0] == 0x00)
+        break; // no entries were ever written past this one
+      uint8_t attr = e[11];
+      if (attr == FAT_ATTR_LFN)
+      {
+        longName.push_back(e);
+        continue;
+      }
+      if ((attr & FAT_ATTR_VOLUME) || e[0] == '.')
+      {
+        longName.clear();
+        continue;
+      }
+      uint32_t cluster = le16(e + 26);
+      if (fs_type == FAT32)
+        cluster |= static_cast<uint32_t>(le16(e + 20)) << 16;
+      bool deleted = e[0] == FAT_DELETED;
+      if (attr & FAT_ATTR_DIRECTORY)
+      {
+        // Freed directories lost their chain; their first cluster remains.
+        if (cluster >= 2)
+          pending.push_back({cluster, cluster_size, deleted});
+      }
+      else if (deleted)
+      {
+        DeletedFile file;
+        file.name = longName.empty() ? shortName(e) : lfnName(longName);
+        file.size = le32(e + 28);
+        if (contiguousFile(cluster, file))
+          files.push_back(move(file));
+      }
+      longName.clear();
+    }
+  }
+
+  void scanExfatDirectory(const vector<unsigned char> &dir,
+                          vector<DeletedFile> &files, vector<DirRef> &pending)
+  {
+    for (size_t pos = 0; pos + 32 <= dir.size(); pos += 32)
+    {
+      const unsigned char *e = &dir[pos];
+      if (e[0] == 0x00)
+        break;
+      if ((e[0] & 0x7F) != EXFAT_ENTRY_FILE)
+        continue;
+      uint8_t secondary = e[1];
+      if (secondary < 2 || pos + (secondary + 1) * 32u > dir.size())
+        continue;
+      const unsigned char *stream = e + 32;
+      if ((stream[0] & 0x7F) != EXFAT_ENTRY_STREAM)
+        continue;
+      bool inUse = e[0] & EXFAT_IN_USE;
+      bool directory = le16(e + 4) & FAT_ATTR_DIRECTORY;
+      bool noFatChain = stream[1] & 0x02;
+      uint32_t cluster = le32(stream + 20);
+      uint64_t length = le64(stream + 24);
+
+      if (directory)
+        pending.push_back({cluster, length, noFatChain || !inUse});
+      else if (!inUse)
+      {
+        DeletedFile file;
+        uint8_t nameLength = stream[3];
+        for (uint8_t i = 2; i <= secondary && file.name.size() < nameLength;
+             ++i)
+        {
+          const unsigned char *n = e + i * 32;
+          if ((n[0] & 0x7F) != EXFAT_ENTRY_NAME)
+            break;
+          size_t chars = min<size_t>(15, nameLength - (i - 2) * 15);
+          file.name += utf16leToUtf8(n + 2, chars);
+        }
+        file.size = length;
+        if (contiguousFile(cluster, file))
+          files.push_back(move(file));
+      }
+      pos += secondary * 32;
+    }
+  }
+
+  // The FAT chain of a deleted file is zeroed, so the data is only
+  // recoverable when it was stored contiguously and not overwritten since.
+  bool contiguousFile(uint32_t first, DeletedFile &file)
+  {
+    if (first < 2 || file.size == 0)
+      return false;
+    uint64_t clusters = (file.size + cluster_size - 1) / cluster_size;
+    if (first + clusters > static_cast<uint64_t>(cluster_count) + 2)
+      return false;
+    for (uint64_t c = first; c < first + clusters; ++c)
+    {
+      if (!isClusterFree(static_cast<uint32_t>(c)))
+        return false;
+    }
+    file.extents = {{0, clusterOffset(first), file.size}};
+    return true;
+  }
+
+  bool isClusterFree(uint32_t cluster)
+  {
+    if (fs_type != EXFAT)
+      return fatEntry(cluster) == 0;
+    uint32_t bit = cluster - 2;
+    return bit / 8 < exfat_bitmap.size() &&
+           !((exfat_bitmap[bit >> 3] >> (bit & 7)) & 1);
+  }
+
+  // The first name byte was overwritten by the deletion marker.
+  static string shortName(const unsigned char *e)
+  {
+    string name = "_";
+    for (int i = 1; i < 8 && e[i] != ' '; ++i)
+      name += static_cast<char>(e[i]);
+    string extension;
+    for (int i = 8; i < 11 && e[i] != ' '; ++i)
+      extension += static_cast<char>(e[i]);
+    if (!extension.empty())
+      name += "." + extension;
+    for (char &c : name)
+    {
+      if (c == '/' || c == '\\' || static_cast<unsigned char>(c) < 0x20)
+        c = '_';
+    }
+    return name;
+  }
+
+  // Long name parts are stored last part first, 13 UTF-16 units each.
+  static string lfnName(const vector<const unsigned char *> &parts)
+  {
+    static const int OFFSETS[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    vector<unsigned char> units;
+    for (auto it = parts.rbegin(); it != parts.rend(); ++it)
+    {
+      for (int offset : OFFSETS)
+      {
+        uint16_t c = le16(*it + offset);
+        if (c == 0x0000 || c == 0xFFFF)
+          break;
+        units.push_back((*it)[offset]);
+        units.push_back((*it)[offset + 1]);
+      }
+    }
+    return utf16leToUtf8(units.data(), units.size() / 2);
+  }
+
+  static bool isPowerOfTwo(uint32_t v) { return v && !(v & (v - 1)); }
+
+  bool openExfat(const unsigned char *boot)
+  {
+    uint8_t sectorShift = boot[108];
+    uint8_t clusterShift = boot[109];
+    if (sectorShift < 9 || sectorShift > 12 || sectorShift + clusterShift > 25)
+      return false;
+    uint32_t bytesPerSector = 1u << sectorShift;
+    fs_type = EXFAT;
+    cluster_size = bytesPerSector << clusterShift;
+    fat_offset = static_cast<uint64_t>(le32(boot + 80)) * bytesPerSector;
+    data_offset = static_cast<uint64_t>(le32(boot + 88)) * bytesPerSector;
+    cluster_count = le32(boot + 92);
+    root_cluster = le32(boot + 96);
+    return cluster_count > 0 && root_cluster >= 2;
+  }
+
+  // Reads allocation table entry `cluster`, going through a one-page cache
+  // so sequential walks touch the disk once per page.
+  uint32_t fatEntry(uint32_t cluster)
+  {
+    uint64_t byteOffset;
+    if (fs_type == FAT12)
+      byteOffset = cluster + cluster / 2;
+    else if (fs_type == FAT16)
+      byteOffset = static_cast<uint64_t>(cluster) * 2;
+    else
+      byteOffset = static_cast<uint64_t>(cluster) * 4;
+
+    uint64_t page = byteOffset / FAT_PAGE_SIZE;
+    if (page != fat_page_index)
+    {
+      // Four spare bytes let a 12-bit entry straddle the page edge.
+      fat_page.assign(FAT_PAGE_SIZE + 4, 0);
+      device->readAt(base + fat_offset + page * FAT_PAGE_SIZE, fat_page.data(),
+                     fat_page.size());
+      fat_page_index = page;
+    }
+    const unsigned char *p = &fat_page[byteOffset - page * FAT_PAGE_SIZE];
+    switch (fs_type)
+    {
+    case FAT12:
+      return (cluster & 1) ? le16(p) >> 4 : le16(p) & 0x0FFF;
+    case FAT16:
+      return le16(p);
+    case FAT32:
+      return le32(p) & 0x0FFFFFFF;
+    default:
+      return le32(p);
+    }
+  }
+
+  bool isEndOfChain(uint32_t entry) const
+  {
+    switch (fs_type)
+    {
+    case FAT12:
+      return entry >= 0xFF8;
+    case FAT16:
+      return entry >= 0xFFF8;
+    case FAT32:
+      return entry >= 0x0FFFFFF8;
+    default:
+      return entry >= 0xFFFFFFF8;
+    }
+  }
+
+  // Follows the allocation chain from `first`. exFAT may store contiguous
+  // files without a chain, so a zero entry continues to the next cluster.
+  vector<uint32_t> clusterChain(uint32_t first, size_t maxClusters)
+  {
+    vector<uint32_t> chain;
+    uint32_t c = first;
+    while (c >= 2 && c < cluster_count + 2 && chain.size() < maxClusters)
+    {
+      chain.push_back(c);
+      uint32_t next = fatEntry(c);
+      if (isEndOfChain(next))
+        break;
+      if (next == 0 && fs_type == EXFAT)
+        next = c + 1;
+      if (next == c)
+        break;
+      c = next;
+    }
+    return chain;
+  }
+
+  uint64_t clusterOffset(uint32_t cluster) const
+  {
+    return base + data_offset +
+           static_cast<uint64_t>(cluster - 2) * cluster_size;
+  }
+
+  // Loads the exFAT allocation bitmap (one bit per cluster, from cluster 2),
+  // found through its entry in the root directory.
+  bool loadExfatBitmap()
+  {
+    uint32_t bitmapCluster = 0;
+    uint64_t bitmapLength = 0;
+    vector<unsigned char> dir(cluster_size);
+    for (uint32_t c : clusterChain(root_cluster, 1024))
+    {
+      if (!readAt(*device, clusterOffset(c), dir))
+        break;
+      for (size_t pos = 0; pos + 32 <= dir.size(); pos += 32)
+      {
+        if (dir[pos] == EXFAT_ENTRY_BITMAP)
+        {
+          bitmapCluster = le32(&dir[pos + 20]);
+          bitmapLength = le64(&dir[pos + 24]);
+          break;
+        }
+      }
+      if (bitmapCluster)
+        break;
+    }
+    if (bitmapCluster < 2 || bitmapLength * 8 < cluster_count)
+      return false;
+
+    size_t bitmapClusters = (bitmapLength + cluster_size - 1) / cluster_size;
+    exfat_bitmap.clear();
+    for (uint32_t bc : clusterChain(bitmapCluster, bitmapClusters))
+    {
+      if (!readAt(*device, clusterOffset(bc), dir))
+        return false;
+      exfat_bitmap.insert(exfat_bitmap.end(), dir.begin(), dir.end());
+    }
+    exfat_bitmap.resize(bitmapLength);
+    return exfat_bitmap.size() * 8 >= cluster_count;
+  }
+
+  vector<ScanRange> exfatFreeRanges(function<bool()> cancelCheck)
+  {
+    vector<ScanRange> ranges;
+    if (!loadExfatBitmap() || cancelCheck())
+      return ranges;
+    uint32_t runStart = 0, runLength = 0;
+    for (uint32_t c = 2; c < cluster_count + 2; ++c)
+    {
+      if (isClusterFree(c))
+      {
+        if (runLength == 0)
+          runStart = c;
+        runLength++;
+      }
+      else if (runLength > 0)
+      {
+        addClusters(ranges, runStart, runLength);
+        runLength = 0;
+      }
+    }
+    if (runLength > 0)
+      addClusters(ranges, runStart, runLength);
+    return ranges;
+  }
+
+  void addClusters(vector<ScanRange> &ranges, uint32_t firstCluster,
+                   uint32_t count)
+  {
+    size_t start = clusterOffset(firstCluster);
+    size_t length = static_cast<size_t>(count) * cluster_size;
+    if (!ranges.empty() && ranges.back().end() == start)
+      ranges.back().length += length;
+    else
+      ranges.push_back({start, length});
+  }
+
+  static constexpr uint64_t FAT_PAGE_SIZE = 64 * 1024;
+
+  BlockReader *device = nullptr;
+  uint64_t base = 0;
+  Type fs_type = FAT32;
+  uint32_t cluster_size = 0;
+  uint32_t cluster_count = 0;
+  uint32_t root_cluster = 0;
+  uint64_t fat_offset = 0;
+  uint64_t data_offset = 0;
+  uint64_t root_dir_offset = 0; // FAT12/16 fixed root directory
+  uint32_t root_dir_bytes = 0;
+  vector<unsigned char> fat_page;
+  uint64_t fat_page_index = UINT64_MAX;
+  vector<unsigned char> exfat_bitmap;
+};
+
+#endif // FAT_H
@@ -0,0 +1,336 @@
+#ifndef FORMATS_H
+#define FORMATS_H
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#include "checksums.h"
+#include "crc32.h"
+#include "fsutil.h"
+
+// --- Format registry ---
+// Every file type the engine knows is one descriptor type below. The scanner
+// and the carvers are instantiated per descriptor at compile time, so the
+// matching loop never branches on a format number. To add a format, write a
+// descriptor and list it in `Formats`; its index is its position there.
+
+// Carving strategies. recoveryengine.cpp specializes its Carver<> template
+// for each one.
+struct CarveToEndMarker {}; // from the signature through `endMarker`
+struct CarveMp3Frames {};   // follow a run of MPEG audio frames
+struct CarveMp4Boxes {};    // follow ftyp/moov/mdat boxes
+
+// Facts about a format that are needed at run time (names, limits).
+struct FormatInfo
+{
+  const char *name;      // display name, also the output directory
+  const char *extension; // with the dot
+  size_t minSize;
+  size_t maxSize;
+  float confidence; // of a file carved from its signature to its end
+  bool carved = true;      // searched for by the signature scan
+  bool identifying = true; // the signature alone names the content
+};
+
+// Structure checks made while a file is carved. NoStructure accepts
+// anything; a format that needs more names its own type as `Structure`.
+struct NoStructure
+{
+  // Bytes that go into the output, in order.
+  void scan(const unsigned char *, size_t) {}
+  bool complete() const { return true; }
+  // Whether a complete structure may have its missing end marker supplied.
+  static constexpr bool supplyEndMarker = false;
+};
+
+// A PDF is only kept once both the xref table and the trailer were seen.
+// Tokens split across two reads are missed.
+struct PdfStructure
+{
+  bool xref = false;
+  bool trailer = false;
+
+  void scan(const unsigned char *data, size_t size)
+  {
+    for (size_t i = 0; i < size; ++i)
+    {
+      if (!xref && size - i >= 4 && memcmp(data + i, "xref", 4) == 0)
+        xref = true;
+      if (!trailer && size - i >= 7 && memcmp(data + i, "trailer", 7) == 0)
+        trailer = true;
+    }
+  }
+  bool complete() const { return xref && trailer; }
+  static constexpr bool supplyEndMarker = true;
+};
+
+// Checksums verified while a file is carved (see checksums.h). NoChecksum
+// leaves every file unverified.
+struct NoChecksum
+{
+  void scan(const unsigned char *, size_t) {}
+  ScanEvent::Integrity result() const { return ScanEvent::Unverified; }
+};
+
+// Facts read from a candidate's header for the catalog; zero when unknown.
+struct HeaderInfo
+{
+  uint32_t width = 0; // images, in pixels
+  uint32_t height = 0;
+  uint32_t detail = 0; // see CatalogEntry::detail
+};
+
+// What a descriptor gets unless it says otherwise.
+struct FormatDefaults
+{
+  using Carve = CarveToEndMarker;
+  using Structure = NoStructure;
+  using Checksum = NoChecksum;
+  // No end marker: the file ends where the next carved signature starts.
+  static constexpr std::array<unsigned char, 0> endMarker{};
+  // Checks beyond the signature bytes; `data` has `size` bytes available.
+  static bool accept(const unsigned char *, size_t) { return true; }
+  // Header checks on the start of a carved candidate, made before any
+  // output file exists. Unless `whole` is set, `size` may be short of the
+  // whole file and a check that runs out of data accepts.
+  static bool validate(const unsigned char *, size_t, bool) { return true; }
+  // What a catalog records about the candidate at `data`.
+  static HeaderInfo headerInfo(const unsigned char *, size_t) { return {}; }
+};
+
+struct PngFormat : FormatDefaults
+{
+  static constexpr FormatInfo info = {"PNG", ".png", 512 * 2, 20 * 1024 * 1024,
+                                      0.9f};
+  static constexpr unsigned char signature[] = {0x89, 0x50, 0x4E, 0x47,
+                                                0x0D, 0x0A, 0x1A, 0x0A};
+  // An empty IEND chunk with its CRC.
+  static constexpr unsigned char endMarker[] = {0x00, 0x00, 0x00, 0x00,
+                                                0x49, 0x45, 0x4E, 0x44,
+                                                0xAE, 0x42, 0x60, 0x82};
+  using Checksum = PngChecksum;
+  // IHDR comes first, holds a non-empty image and carries a matching CRC.
+  static bool validate(const unsigned char *data, size_t size, bool whole)
+  {
+    if (size < 33)
+      return !whole;
+    static constexpr unsigned char ihdr[] = {0x00, 0x00, 0x00, 0x0D,
+                                             'I',  'H',  'D',  'R'};
+    return memcmp(data + 8, ihdr, sizeof(ihdr)) == 0 &&
+           be32(data + 16) != 0 && be32(data + 20) != 0 &&
+           computeCrc32(data + 12, 17) == be32(data + 29);
+  }
+  static HeaderInfo headerInfo(const unsigned char *data, size_t size)
+  {
+    HeaderInfo header;
+    if (size >= 24)
+    {
+      header.width = be32(data + 16);
+      header.height = be32(data + 20);
+    }
+    return header;
+  }
+};
+
+struct JpegFormat : FormatDefaults
+{
+  static constexpr FormatInfo info = {"JPEG", ".jpg", 512 * 2,
+                                      20 * 1024 * 1024, 0.6f};
+  static constexpr unsigned char signature[] = {0xFF, 0xD8, 0xFF};
+  static constexpr unsigned char endMarker[] = {0xFF, 0xD9};
+  // SOI must be followed by an APPn marker.
+  static bool accept(const unsigned char *data, size_t size)
+  {
+    return size > 3 && (data[3] & 0xF0) == 0xE0;
+  }
+  // Walks the marker segments up to the start of scan. Each length must be
+  // sane, and a frame header (SOFn) with a plausible precision, size and
+  // component count must come before the scan. `frame`, when given, is
+  // pointed at the frame header's fields.
+  static bool validate(const unsigned char *data, size_t size, bool whole,
+                       const unsigned char **frame = nullptr)
+  {
+    bool sawFrame = false;
+    size_t pos = 2;
+    while (pos + 4 <= size)
+    {
+      if (data[pos] != 0xFF)
+        return false;
+      unsigned char marker = data[pos + 1];
+      if (marker == 0xFF)
+      {
+        ++pos; // fill byte
+        continue;
+      }
+      if (marker == 0x00 || (marker >= 0xD0 && marker <= 0xD9))
+        return false; // SOI, EOI or RSTn before any scan data
+      size_t length = size_t(data[pos + 2]) << 8 | data[pos + 3];
+      if (length < 2)
+        return false;
+      if (marker == 0xDA)
+        return sawFrame;
+      bool sof = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+                 marker != 0xC8 && marker != 0xCC;
+      if (sof)
+      {
+        if (pos + 10 > size)
+          return !whole;
+        const unsigned char *fields = data + pos + 4;
+        bool lossless = marker == 0xC3 || marker == 0xC7 || marker == 0xCB ||
+                        marker == 0xCF;
+        unsigned precision = fields[0];
+        unsigned width = unsigned(fields[3]) << 8 | fields[4];
+        unsigned components = fields[5];
+        if (lossless ? precision < 2 || precision > 16
+                     : precision != 8 && precision != 12)
+          return false;
+        if (width == 0 || components == 0 || components > 4 ||
+            length != 8 + 3 * components)
+          return false;
+        sawFrame = true;
+        if (frame)
+          *frame = fields;
+      }
+      pos += 2 + length;
+    }
+    return !whole;
+  }
+  static HeaderInfo headerInfo(const unsigned char *data, size_t size)
+  {
+    HeaderInfo header;
+    const unsigned char *frame = nullptr;
+    if (validate(data, size, false, &frame) && frame)
+    {
+      header.height = unsigned(frame[1]) << 8 | frame[2];
+      header.width = unsigned(frame[3]) << 8 | frame[4];
+    }
+    return header;
+  }
+};
+
+struct PdfFormat : FormatDefaults
+{
+  static constexpr FormatInfo info = {"PDF", ".pdf", 1024, 50 * 1024 * 1024,
+                                      0.8f};
+  static constexpr unsigned char signature[] = {'%', 'P', 'D', 'F', '-'};
+  static constexpr unsigned char endMarker[] = {'%', '%', 'E', 'O', 'F'};
+  using Structure = PdfStructure;
+  // "%PDF-" is followed by a version such as "1.7" or "2.0".
+  static bool validate(const unsigned char *data, size_t size, bool whole)
+  {
+    if (size < 8)
+      return !whole;
+    return (data[5] == '1' || data[5] == '2') && data[6] == '.' &&
+           data[7] >= '0' && data[7] <= '9';
+  }
+  static HeaderInfo headerInfo(const unsigned char *data, size_t size)
+  {
+    HeaderInfo header;
+    if (validate(data, size, true))
+      header.detail = (data[5] - '0') * 10 + (data[7] - '0');
+    return header;
+  }
+};
+
+struct ZipFormat : FormatDefaults
+{
+  static constexpr FormatInfo info = {"ZIP", ".zip", 1024, 100 * 1024 * 1024,
+                                      0.8f};
+  static constexpr unsigned char signature[] = {0x50, 0x4B, 0x03, 0x04};
+  // End of central directory record.
+  static constexpr unsigned char endMarker[] = {0x50, 0x4B, 0x05, 0x06};
+  using Checksum = ZipChecksum;
+};
+
+struct Mp3Format : FormatDefaults
+{
+  // Frame sync bytes say little on their own.
+  static constexpr FormatInfo info = {"MP3", ".mp3", 1024, 20 * 1024 * 1024,
+                                      0.5f, true, false};
+  static constexpr unsigned char signature[] = {0xFF, 0xE0};
+  using Carve = CarveMp3Frames;
+};
+
+struct DocFormat : FormatDefaults
+{
+  static constexpr FormatInfo info = {"DOC", ".doc", 1024, 50 * 1024 * 1024,
+                                      0.3f, false};
+  // OLE2 compound file.
+  static constexpr unsigned char signature[] = {0xD0, 0xCF, 0x11, 0xE0,
+                                                0xA1, 0xB1, 0x1A, 0xE1};
+};
+
+struct DocxFormat : FormatDefaults
+{
+  static constexpr FormatInfo info = {"DOCX", ".docx", 1024, 50 * 1024 * 1024,
+                                      0.3f, false};
+  static constexpr unsigned char signature[] = {0x50, 0x4B, 0x03, 0x04};
+};
+
+struct Mp4Format : FormatDefaults
+{
+  static constexpr FormatInfo info = {"MP4", ".mp4", 1024, 500 * 1024 * 1024,
+                                      0.3f, true, false};
+  // Box size (ignored), then "ftyp".
+  static constexpr unsigned char signature[] = {0x00, 0x00, 0x00, 0x00,
+                                                0x66, 0x74, 0x79, 0x70};
+  using Carve = CarveMp4Boxes;
+};
+
+struct ExeFormat : FormatDefaults
+{
+  static constexpr FormatInfo info = {"EXE", ".exe", 1024, 50 * 1024 * 1024,
+                                      0.3f, false};
+  static constexpr unsigned char signature[] = {0x4D, 0x5A};
+};
+
+struct ElfFormat : FormatDefaults
+{
+  static constexpr FormatInfo info = {"ELF", ".elf", 1024, 50 * 1024 * 1024,
+                                      0.3f, false};
+  static constexpr unsigned char signature[] = {0x7F, 0x45, 0x4C, 0x46};
+};
+
+template <class... F>
+struct FormatList
+{
+  static constexpr size_t size = sizeof...(F);
+  static constexpr FormatInfo info[] = {F::info...};
+  static constexpr size_t signatureSize[] = {sizeof(F::signature)...};
+
+  // Position of `Format` in the list, -1 when absent.
+  template <class Format>
+  static constexpr int indexOf()
+  {
+    int index = -1, i = 0;
+    ((std::is_same<Format, F>::value ? index = i : 0, ++i), ...);
+    return index;
+  }
+};
+
+// Order fixes the format indices used by the GUI checkboxes, the metrics
+// and File_Supported; append new formats at the end.
+using Formats = FormatList<PngFormat, JpegFormat, PdfFormat, ZipFormat,
+                           Mp3Format, DocFormat, DocxFormat, Mp4Format,
+                           ExeFormat, ElfFormat>;
+
+static constexpr size_t FORMAT_COUNT = Formats::size;
+
+template <class Format>
+constexpr int formatIndexOf()
+{
+  return Formats::indexOf<Format>();
+}
+
+// True when `Format`'s signature, and its extra checks, match at `data`.
+template <class Format>
+inline bool signatureAt(const unsigned char *data, size_t size)
+{
+  constexpr size_t length = sizeof(Format::signature);
+  return size >= length && memcmp(data, Format::signature, length) == 0 &&
+         Format::accept(data, size);
+}
+
+#endif // FORMATS_H
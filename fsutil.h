@@ -0,0 +1,102 @@
+#ifndef FSUTIL_H
+#define FSUTIL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "blockreader.h"
+
+// Little-endian field access for on-disk filesystem structures.
+inline uint16_t le16(const unsigned char *p)
+{
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+inline uint32_t le32(const unsigned char *p)
+{
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline uint64_t le64(const unsigned char *p)
+{
+  return static_cast<uint64_t>(le32(p)) |
+         (static_cast<uint64_t>(le32(p + 4)) << 32);
+}
+
+// Big-endian access, used by the jbd2 journal.
+inline uint32_t be32(const unsigned char *p)
+{
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+// Appends code point `c` to `out` as UTF-8.
+inline void appendUtf8(std::string &out, uint32_t c)
+{
+  if (c < 0x80)
+    out += static_cast<char>(c);
+  else if (c < 0x800)
+  {
+    out += static_cast<char>(0xC0 | (c >> 6));
+    out += static_cast<char>(0x80 | (c & 0x3F));
+  }
+  else if (c < 0x10000)
+  {
+    out += static_cast<char>(0xE0 | (c >> 12));
+    out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (c & 0x3F));
+  }
+  else
+  {
+    out += static_cast<char>(0xF0 | (c >> 18));
+    out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (c & 0x3F));
+  }
+}
+
+// Converts `count` UTF-16LE code units (NTFS, VFAT and exFAT file names) to
+// UTF-8. Characters that cannot appear in a file name here become '_'.
+inline std::string utf16leToUtf8(const unsigned char *p, size_t count)
+{
+  std::string out;
+  for (size_t i = 0; i < count; ++i)
+  {
+    uint32_t c = le16(p + i * 2);
+    if (c >= 0xD800 && c < 0xDC00 && i + 1 < count)
+    {
+      uint32_t low = le16(p + (i + 1) * 2);
+      if (low >= 0xDC00 && low < 0xE000)
+      {
+        c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+        i++;
+      }
+    }
+    if (c == 0)
+      break;
+    if (c < 0x20 || c == '/' || c == '\\')
+      c = '_';
+    appendUtf8(out, c);
+  }
+  return out;
+}
+
+// Reads exactly `size` bytes at `offset`; false on a short read.
+inline bool readAt(BlockReader &in, uint64_t offset, unsigned char *dest,
+                   size_t size)
+{
+  return in.readAt(offset, dest, size) == size;
+}
+
+inline bool readAt(BlockReader &in, uint64_t offset,
+                   std::vector<unsigned char> &dest)
+{
+  return readAt(in, offset, dest.data(), dest.size());
+}
+
+#endif // FSUTIL_H
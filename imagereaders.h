@@ -0,0 +1,1097 @@
+#ifndef IMAGEREADERS_H
+#define IMAGEREADERS_H
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "blockreader.h"
+
+// Containers a disk image may arrive in. All of them are read in place, so
+// evidence does not have to be unpacked to scratch disk before a scan.
+enum class ImageFormat
+{
+  Raw,   // a device or plain image file
+  Split, // raw segments name.001, name.002, ...
+  Gzip,  // gzip, including multi-member files from pigz or bgzip
+  Zstd,  // zstd; seeks cheaply only between frames
+  Qcow2  // QEMU copy-on-write, version 2 or 3
+};
+
+inline const char *imageFormatName(ImageFormat format)
+{
+  switch (format)
+  {
+  case ImageFormat::Split:
+    return "split";
+  case ImageFormat::Gzip:
+    return "gzip";
+  case ImageFormat::Zstd:
+    return "zstd";
+  case ImageFormat::Qcow2:
+    return "qcow2";
+  default:
+    return "raw";
+  }
+}
+
+// "disk.001", "disk.E01.0001": a numbered first segment.
+inline bool isFirstSegment(const std::string &path)
+{
+  size_t dot = path.find_last_of("./");
+  if (dot == std::string::npos || path[dot] != '.' || path.size() - dot < 4)
+    return false;
+  std::string number = path.substr(dot + 1);
+  return number.size() < 10 &&
+         number.find_first_not_of("0123456789") == std::string::npos &&
+         std::stoul(number) == 1;
+}
+
+// Split images are known by name, the others by their magic bytes.
+inline ImageFormat detectImageFormat(const std::string &path)
+{
+  if (isFirstSegment(path))
+    return ImageFormat::Split;
+  PreadReader file(path);
+  unsigned char magic[4] = {};
+  if (!file.ok() || file.readAt(0, magic, sizeof(magic)) < sizeof(magic))
+    return ImageFormat::Raw;
+  if (magic[0] == 0x1F && magic[1] == 0x8B)
+    return ImageFormat::Gzip;
+  if (magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F &&
+      magic[3] == 0xFD)
+    return ImageFormat::Zstd;
+  if (magic[0] == 'Q' && magic[1] == 'F' && magic[2] == 'I' && magic[3] == 0xFB)
+    return ImageFormat::Qcow2;
+  return ImageFormat::Raw;
+}
+
+// Opens `path` as an image of `format`. `size` receives the size of the disk
+// inside it. Compressed images are decoded once here to build their seek
+// index; `cancelCheck` can stop that. Null, with `error` set, on failure. A
+// damaged compressed image still opens up to the damage, with `error` set
+// to say so.
+inline std::unique_ptr<BlockReader>
+openImage(const std::string &path, ImageFormat format, IoBackend backend,
+          uint64_t &size, std::string &error,
+          const std::function<bool()> &cancelCheck = nullptr);
+
+// --- Split images ---
+// Segments are read in place, each with the chosen backend.
+class SplitReader : public BlockReader
+{
+public:
+  SplitReader(const std::string &firstSegment, IoBackend backend)
+  {
+    size_t digits = firstSegment.size() - firstSegment.find_last_of('.') - 1;
+    std::string base = firstSegment.substr(0, firstSegment.size() - digits);
+    for (unsigned n = 1;; ++n)
+    {
+      std::string number = std::to_string(n);
+      if (number.size() > digits)
+        break;
+      std::string path = base + std::string(digits - number.size(), '0') + number;
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0)
+        break;
+      std::unique_ptr<BlockReader> segment =
+          BlockReader::open(path, backend, st.st_size);
+      if (!segment)
+      {
+        segments.clear();
+        return;
+      }
+      starts.push_back(length);
+      segments.push_back(std::move(segment));
+      length += st.st_size;
+    }
+  }
+
+  bool ok() const { return !segments.empty(); }
+  uint64_t size() const { return length; }
+
+  size_t readAt(uint64_t offset, unsigned char *dest, size_t size) override
+  {
+    if (offset >= length)
+      return 0;
+    size_t index =
+        std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin() - 1;
+    size_t done = 0;
+    while (done < size && index < segments.size())
+    {
+      uint64_t end = index + 1 < starts.size() ? starts[index + 1] : length;
+      uint64_t at = offset + done;
+      size_t wanted = std::min<uint64_t>(size - done, end - at);
+      size_t got = segments[index]->readAt(at - starts[index], dest + done, wanted);
+      done += got;
+      if (got < wanted)
+        break;
+      ++index;
+    }
+    return done;
+  }
+
+private:
+  std::vector<std::unique_ptr<BlockReader>> segments;
+  std::vector<uint64_t> starts; // image offset of each segment
+  uint64_t length = 0;
+};
+
+// --- Compressed images ---
+// Base for streams that decode only forward. Opening decodes the stream once
+// to learn its size and record seek points, places where decoding can
+// restart. Reads are served from a cache of decoded blocks, or else by the
+// cheapest decoder: one of a few left running where earlier reads stopped
+// (a scan reads forward, so its decoder just continues, and carvers trail
+// it), or a fresh one at the last seek point before the block.
+class CompressedReader : public BlockReader
+{
+public:
+  uint64_t size() const { return length; }
+  // The stream is truncated or corrupt; size() covers the readable part.
+  bool isDamaged() const { return damaged; }
+
+  size_t readAt(uint64_t offset, unsigned char *dest, size_t size) override
+  {
+    size_t done = 0;
+    while (done < size && offset + done < length)
+    {
+      uint64_t at = offset + done;
+      Block block = loadBlock(at / BLOCK_SIZE);
+      size_t within = at % BLOCK_SIZE;
+      if (!block || within >= block->size())
+        break;
+      size_t n = std::min(size - done, block->size() - within);
+      memcpy(dest + done, block->data() + within, n);
+      done += n;
+    }
+    return done;
+  }
+
+protected:
+  // Decodes forward from one seek point.
+  class Decoder
+  {
+  public:
+    virtual ~Decoder() = default;
+    // Decodes up to `size` bytes into `dest`, or discards them when `dest` is
+    // null. Fewer only at the end of the stream or on corrupt data.
+    virtual size_t read(unsigned char *dest, size_t size) = 0;
+  };
+
+  // A decoder starting at seek point `index`; null when it cannot start.
+  virtual std::unique_ptr<Decoder> decoderAt(size_t index) = 0;
+
+  // Filled while indexing: the decoded offset of every seek point, ascending
+  // and starting at 0, and the decoded size. A damaged stream keeps what
+  // decoded before the damage.
+  std::vector<uint64_t> seekPoints;
+  uint64_t length = 0;
+  bool damaged = false;
+
+private:
+  static constexpr size_t BLOCK_SIZE = 64 * 1024;
+  static constexpr size_t CACHE_BLOCKS = 1024; // 64 MB of decoded data
+  static constexpr size_t DECODERS = 8;
+
+  using Block = std::shared_ptr<const std::vector<unsigned char>>;
+
+  struct Cursor
+  {
+    std::unique_ptr<Decoder> decoder;
+    uint64_t position = 0; // decoded offset of the next byte
+    bool busy = false;
+    uint64_t lastUse = 0;
+  };
+
+  // Lock held.
+  Block cached(uint64_t block)
+  {
+    auto it = cache.find(block);
+    if (it == cache.end())
+      return nullptr;
+    lru.splice(lru.begin(), lru, it->second.second);
+    return it->second.first;
+  }
+
+  // Lock held.
+  void store(uint64_t block, Block data)
+  {
+    if (cache.count(block))
+      return;
+    lru.push_front(block);
+    cache[block] = {std::move(data), lru.begin()};
+    if (cache.size() > CACHE_BLOCKS)
+    {
+      cache.erase(lru.back());
+      lru.pop_back();
+    }
+  }
+
+  // Lock held. The idle cursor that reaches `start` with the least decoding;
+  // `restartAt` is set when that means starting over at a seek point. Null
+  // when every cursor is busy.
+  Cursor *pickCursor(uint64_t start, size_t &restartAt)
+  {
+    size_t point =
+        std::upper_bound(seekPoints.begin(), seekPoints.end(), start) -
+        seekPoints.begin() - 1;
+    uint64_t bestCost = start - seekPoints[point];
+    Cursor *best = nullptr, *spare = nullptr;
+    for (Cursor &cursor : cursors)
+    {
+      if (cursor.busy)
+        continue;
+      if (cursor.decoder && cursor.position <= start &&
+          start - cursor.position <= bestCost)
+      {
+        bestCost = start - cursor.position;
+        best = &cursor;
+      }
+      if (!spare || !cursor.decoder ||
+          (spare->decoder && cursor.lastUse < spare->lastUse))
+        spare = &cursor;
+    }
+    if (best)
+      return best;
+    restartAt = point;
+    return spare;
+  }
+
+  Block loadBlock(uint64_t block)
+  {
+    uint64_t start = block * BLOCK_SIZE;
+    size_t restartAt = SIZE_MAX;
+    Cursor *cursor;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      while (true)
+      {
+        if (Block hit = cached(block))
+          return hit;
+        if ((cursor = pickCursor(start, restartAt)))
+          break;
+        idle.wait(guard);
+      }
+      cursor->busy = true;
+      cursor->lastUse = ++useClock;
+    }
+
+    if (restartAt != SIZE_MAX)
+    {
+      cursor->decoder = decoderAt(restartAt);
+      cursor->position = seekPoints[restartAt];
+    }
+    // Decode up to and including the block; whole blocks on the way are
+    // cached for the reads that follow.
+    Block result;
+    bool failed = !cursor->decoder;
+    while (!failed && cursor->position <= start)
+    {
+      uint64_t at = cursor->position;
+      if (at % BLOCK_SIZE != 0)
+      {
+        size_t skip = BLOCK_SIZE - at % BLOCK_SIZE;
+        size_t got = cursor->decoder->read(nullptr, skip);
+        cursor->position += got;
+        failed = got < skip;
+        continue;
+      }
+      auto data = std::make_shared<std::vector<unsigned char>>(
+          std::min<uint64_t>(BLOCK_SIZE, length - at));
+      size_t got = cursor->decoder->read(data->data(), data->size());
+      cursor->position += got;
+      failed = got < data->size();
+      data->resize(got);
+      if (at == start)
+        result = data;
+      std::lock_guard<std::mutex> guard(lock);
+      store(at / BLOCK_SIZE, std::move(data));
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (failed)
+      cursor->decoder.reset();
+    cursor->busy = false;
+    idle.notify_all();
+    return result;
+  }
+
+  std::mutex lock;
+  std::condition_variable idle; // a cursor was released
+  Cursor cursors[DECODERS];
+  uint64_t useClock = 0;
+  std::list<uint64_t> lru; // cached block numbers, most recent first
+  std::unordered_map<uint64_t,
+                     std::pair<Block, std::list<uint64_t>::iterator>>
+      cache;
+};
+
+#ifdef HAVE_ZLIB
+// Seek points follow zlib's zran example: at deflate block boundaries, with
+// the 32 KB window the following data may refer back to. One is kept for
+// every `span` compressed bytes, so the index stays small (at most about
+// MAX_POINTS windows) and a restart decodes at most one span. Each member of
+// a multi-member file starts with a seek point that needs no window.
+class GzipReader : public CompressedReader
+{
+public:
+  explicit GzipReader(const std::string &path) : path(path), file(path) {}
+
+  bool ok() const { return file.ok(); }
+
+  // False when cancelled or the stream cannot be read at all.
+  bool buildIndex(const std::function<bool()> &cancelCheck)
+  {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+      return false;
+    uint64_t span = std::max<uint64_t>(MIN_SPAN, st.st_size / MAX_POINTS);
+
+    z_stream strm = {};
+    if (inflateInit2(&strm, GZIP_WINDOW_BITS) != Z_OK)
+      return false;
+    std::vector<unsigned char> input(INPUT_SIZE);
+    std::vector<unsigned char> window(WINDOW_SIZE);
+    uint64_t fed = 0, out = 0, lastPoint = 0;
+    addMemberPoint(0, 0);
+    bool cancelled = false;
+    while (true)
+    {
+      if (cancelCheck && cancelCheck())
+      {
+        cancelled = true;
+        break;
+      }
+      if (strm.avail_in == 0)
+      {
+        size_t n = file.readAt(fed, input.data(), input.size());
+        if (n == 0)
+        {
+          damaged = true; // truncated inside a member
+          break;
+        }
+        fed += n;
+        strm.next_in = input.data();
+        strm.avail_in = n;
+      }
+      // The window buffer doubles as output: it always holds the last 32 KB.
+      if (strm.avail_out == 0)
+      {
+        strm.next_out = window.data();
+        strm.avail_out = WINDOW_SIZE;
+      }
+      unsigned before = strm.avail_out;
+      int ret = inflate(&strm, Z_BLOCK);
+      out += before - strm.avail_out;
+      if (ret == Z_STREAM_END)
+      {
+        uint64_t next = fed - strm.avail_in;
+        if (!isMemberStart(next))
+          break; // the end, or padding after the last member
+        inflateReset(&strm);
+        strm.avail_in = 0;
+        fed = next;
+        addMemberPoint(out, next);
+        lastPoint = next;
+        continue;
+      }
+      if (ret != Z_OK && ret != Z_BUF_ERROR)
+      {
+        damaged = true;
+        break;
+      }
+      uint64_t in = fed - strm.avail_in;
+      if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+          in - lastPoint >= span)
+      {
+        addPoint(out, in, strm.data_type & 7, window, strm.avail_out);
+        lastPoint = in;
+      }
+    }
+    inflateEnd(&strm);
+    length = out;
+    return !cancelled;
+  }
+
+protected:
+  std::unique_ptr<Decoder> decoderAt(size_t index) override
+  {
+    std::unique_ptr<Inflater> decoder(new Inflater(file));
+    if (!decoder->start(points[index]))
+      return nullptr;
+    return decoder;
+  }
+
+private:
+  static constexpr int GZIP_WINDOW_BITS = 15 + 32; // detect the gzip header
+  static constexpr size_t WINDOW_SIZE = 32768;
+  static constexpr size_t INPUT_SIZE = 64 * 1024;
+  static constexpr uint64_t MIN_SPAN = 1024 * 1024;
+  static constexpr uint64_t MAX_POINTS = 4096;
+
+  struct Point
+  {
+    uint64_t in; // compressed offset of the first byte to feed
+    int bits;    // bits of the byte before `in` still to use; -1 at a member start
+    std::vector<unsigned char> window;
+  };
+
+  bool isMemberStart(uint64_t offset)
+  {
+    unsigned char magic[2];
+    return file.readAt(offset, magic, 2) == 2 && magic[0] == 0x1F &&
+           magic[1] == 0x8B;
+  }
+
+  void addMemberPoint(uint64_t out, uint64_t in)
+  {
+    if (!seekPoints.empty() && seekPoints.back() == out)
+    {
+      points.back() = {in, -1, {}};
+      return;
+    }
+    seekPoints.push_back(out);
+    points.push_back({in, -1, {}});
+  }
+
+  // `free` is how much of the circular window has not been written since it
+  // last wrapped; before the first wrap that part is empty.
+  void addPoint(uint64_t out, uint64_t in, int bits,
+                const std::vector<unsigned char> &window, unsigned free)
+  {
+    Point point{in, bits, {}};
+    size_t filled = WINDOW_SIZE - free;
+    if (out > filled)
+      point.window.assign(window.begin() + filled, window.end());
+    point.window.insert(point.window.end(), window.begin(),
+                        window.begin() + filled);
+    if (point.window.size() > out)
+      point.window.erase(point.window.begin(),
+                         point.window.end() - static_cast<size_t>(out));
+    seekPoints.push_back(out);
+    points.push_back(std::move(point));
+  }
+
+  class Inflater : public Decoder
+  {
+  public:
+    explicit Inflater(PreadReader &file) : file(file), input(INPUT_SIZE) {}
+    ~Inflater() override
+    {
+      if (initialized)
+        inflateEnd(&strm);
+    }
+
+    bool start(const Point &point)
+    {
+      in = point.in;
+      raw = point.bits >= 0;
+      if (inflateInit2(&strm, raw ? -15 : GZIP_WINDOW_BITS) != Z_OK)
+        return false;
+      initialized = true;
+      if (!raw)
+        return true;
+      if (point.bits > 0)
+      {
+        unsigned char byte;
+        if (file.readAt(in - 1, &byte, 1) != 1)
+          return false;
+        inflatePrime(&strm, point.bits, byte >> (8 - point.bits));
+      }
+      return point.window.empty() ||
+             inflateSetDictionary(&strm, point.window.data(),
+                                  point.window.size()) == Z_OK;
+    }
+
+    size_t read(unsigned char *dest, size_t size) override
+    {
+      unsigned char scratch[16384];
+      size_t produced = 0;
+      while (produced < size && !finished)
+      {
+        if (strm.avail_in == 0)
+        {
+          size_t n = file.readAt(in, input.data(), input.size());
+          if (n == 0)
+          {
+            finished = true;
+            break;
+          }
+          in += n;
+          strm.next_in = input.data();
+          strm.avail_in = n;
+        }
+        size_t want = dest ? size - produced
+                           : std::min(size - produced, sizeof(scratch));
+        strm.next_out = dest ? dest + produced : scratch;
+        strm.avail_out = want;
+        int ret = inflate(&strm, Z_NO_FLUSH);
+        produced += want - strm.avail_out;
+        if (ret == Z_STREAM_END)
+          finished = !nextMember();
+        else if (ret != Z_OK)
+          finished = true;
+      }
+      return produced;
+    }
+
+  private:
+    // Moves on to the next gzip member, if there is one.
+    bool nextMember()
+    {
+      uint64_t next = in - strm.avail_in;
+      if (raw)
+        next += 8; // the trailer raw inflation did not read
+      unsigned char magic[2];
+      if (file.readAt(next, magic, 2) != 2 || magic[0] != 0x1F ||
+          magic[1] != 0x8B)
+        return false;
+      if (inflateReset2(&strm, GZIP_WINDOW_BITS) != Z_OK)
+        return false;
+      raw = false;
+      in = next;
+      strm.avail_in = 0;
+      return true;
+    }
+
+    PreadReader &file;
+    z_stream strm = {};
+    bool initialized = false;
+    bool raw = false;
+    bool finished = false;
+    uint64_t in = 0; // compressed offset of the next byte to load
+    std::vector<unsigned char> input;
+  };
+
+  std::string path;
+  PreadReader file;
+  std::vector<Point> points; // parallel to seekPoints
+};
+#endif // HAVE_ZLIB
+
+#ifdef HAVE_ZSTD
+// zstd cannot restart inside a frame, so seek points are frame starts.
+// Images compressed as many frames (pzstd, or the seekable format) seek
+// cheaply; a single-frame image is still read in one forward pass, and
+// carvers trailing the scan reuse a decoder rather than starting over.
+class ZstdReader : public CompressedReader
+{
+public:
+  explicit ZstdReader(const std::string &path) : file(path) {}
+
+  bool ok() const { return file.ok(); }
+
+  // False when cancelled or the stream cannot be read at all.
+  bool buildIndex(const std::function<bool()> &cancelCheck)
+  {
+    std::unique_ptr<ZSTD_DStream, size_t (*)(ZSTD_DStream *)> stream(
+        ZSTD_createDStream(), ZSTD_freeDStream);
+    if (!stream || ZSTD_isError(ZSTD_initDStream(stream.get())))
+      return false;
+    std::vector<unsigned char> input(ZSTD_DStreamInSize());
+    std::vector<unsigned char> output(ZSTD_DStreamOutSize());
+    uint64_t fed = 0, out = 0;
+    seekPoints.push_back(0);
+    frames.push_back(0);
+    size_t pending = 0; // nonzero while a frame is unfinished
+    while (!damaged)
+    {
+      if (cancelCheck && cancelCheck())
+        return false;
+      size_t n = file.readAt(fed, input.data(), input.size());
+      if (n == 0)
+        break;
+      ZSTD_inBuffer in = {input.data(), n, 0};
+      while (in.pos < in.size)
+      {
+        ZSTD_outBuffer o = {output.data(), output.size(), 0};
+        pending = ZSTD_decompressStream(stream.get(), &o, &in);
+        if (ZSTD_isError(pending))
+        {
+          damaged = true;
+          break;
+        }
+        out += o.pos;
+        if (pending == 0)
+        {
+          seekPoints.push_back(out);
+          frames.push_back(fed + in.pos);
+        }
+      }
+      fed += n;
+    }
+    // Output still buffered in the decoder after the last input.
+    while (!damaged && pending != 0)
+    {
+      ZSTD_inBuffer in = {nullptr, 0, 0};
+      ZSTD_outBuffer o = {output.data(), output.size(), 0};
+      pending = ZSTD_decompressStream(stream.get(), &o, &in);
+      if (ZSTD_isError(pending) || o.pos == 0)
+        damaged = true; // truncated
+      else
+        out += o.pos;
+    }
+    // The last frame's end is not a seek point.
+    while (frames.size() > 1 && frames.back() >= fed)
+    {
+      frames.pop_back();
+      seekPoints.pop_back();
+    }
+    length = out;
+    return true;
+  }
+
+protected:
+  std::unique_ptr<Decoder> decoderAt(size_t index) override
+  {
+    std::unique_ptr<Decompressor> decoder(new Decompressor(file, frames[index]));
+    if (!decoder->ok())
+      return nullptr;
+    return decoder;
+  }
+
+private:
+  class Decompressor : public Decoder
+  {
+  public:
+    Decompressor(PreadReader &file, uint64_t start)
+        : file(file), in(start), stream(ZSTD_createDStream()),
+          input(ZSTD_DStreamInSize())
+    {
+      if (stream && ZSTD_isError(ZSTD_initDStream(stream)))
+      {
+        ZSTD_freeDStream(stream);
+        stream = nullptr;
+      }
+    }
+    ~Decompressor() override
+    {
+      if (stream)
+        ZSTD_freeDStream(stream);
+    }
+    bool ok() const { return stream != nullptr; }
+
+    size_t read(unsigned char *dest, size_t size) override
+    {
+      unsigned char scratch[16384];
+      size_t produced = 0;
+      while (produced < size && !finished)
+      {
+        if (buffer.pos == buffer.size && !atEnd)
+        {
+          size_t n = file.readAt(in, input.data(), input.size());
+          in += n;
+          buffer = {input.data(), n, 0};
+          atEnd = n == 0;
+        }
+        ZSTD_outBuffer out = {dest ? dest + produced : scratch,
+                              dest ? size - produced
+                                   : std::min(size - produced, sizeof(scratch)),
+                              0};
+        size_t ret = ZSTD_decompressStream(stream, &out, &buffer);
+        produced += out.pos;
+        if (ZSTD_isError(ret) || (atEnd && out.pos == 0))
+          finished = true;
+      }
+      return produced;
+    }
+
+  private:
+    PreadReader &file;
+    uint64_t in; // compressed offset of the next byte to load
+    ZSTD_DStream *stream;
+    std::vector<unsigned char> input;
+    ZSTD_inBuffer buffer = {nullptr, 0, 0};
+    bool atEnd = false;
+    bool finished = false;
+  };
+
+  PreadReader file;
+  std::vector<uint64_t> frames; // compressed offset of each seek point
+};
+#endif // HAVE_ZSTD
+
+// --- qcow2 ---
+// Guest offsets go through the L1 and L2 tables to clusters in the file.
+// Unallocated clusters read from the backing image, or as zeros without
+// one; compressed clusters are decoded when read. Encrypted images, external
+// data files and extended L2 entries are refused.
+class Qcow2Reader : public BlockReader
+{
+public:
+  Qcow2Reader(const std::string &path, int depth = 0) : file(path)
+  {
+    if (!file.ok())
+    {
+      error = "Failed to open " + path;
+      return;
+    }
+    unsigned char header[112] = {};
+    if (file.readAt(0, header, 72) < 72 || memcmp(header, "QFI\xFB", 4) != 0)
+    {
+      error = path + " is not a qcow2 image";
+      return;
+    }
+    uint32_t version = be32(header + 4);
+    clusterBits = be32(header + 20);
+    length = be64(header + 24);
+    uint32_t l1Size = be32(header + 36);
+    uint64_t l1Offset = be64(header + 40);
+    if ((version != 2 && version != 3) || clusterBits < 9 || clusterBits > 21)
+    {
+      error = path + ": unsupported qcow2 version or cluster size";
+      return;
+    }
+    if (be32(header + 32) != 0)
+    {
+      error = path + ": encrypted qcow2 images are not supported";
+      return;
+    }
+    if (version == 3)
+    {
+      file.readAt(72, header + 72, sizeof(header) - 72);
+      uint64_t incompatible = be64(header + 72);
+      uint32_t headerLength = be32(header + 100);
+      // Dirty and corrupt images still read; compression type is below.
+      if (incompatible & ~uint64_t(DIRTY | CORRUPT | COMPRESSION_TYPE))
+      {
+        error = path + ": uses qcow2 features that are not supported";
+        return;
+      }
+      if ((incompatible & COMPRESSION_TYPE) && headerLength > 104)
+        zstdClusters = header[104] == 1;
+    }
+
+    uint64_t l2Entries = (uint64_t(1) << clusterBits) / 8;
+    uint64_t clusters = (length + clusterSize() - 1) >> clusterBits;
+    if (uint64_t(l1Size) * l2Entries < clusters)
+    {
+      error = path + ": L1 table too small for the disk size";
+      return;
+    }
+    std::vector<unsigned char> raw(uint64_t(l1Size) * 8);
+    if (file.readAt(l1Offset, raw.data(), raw.size()) < raw.size())
+    {
+      error = path + ": L1 table is truncated";
+      return;
+    }
+    for (uint32_t i = 0; i < l1Size; ++i)
+      l1.push_back(be64(raw.data() + i * 8) & OFFSET_MASK);
+
+    uint64_t backingOffset = be64(header + 8);
+    uint32_t backingLength = be32(header + 16);
+    if (backingOffset != 0 && backingLength > 0)
+    {
+      std::string name(backingLength, '\0');
+      file.readAt(backingOffset, reinterpret_cast<unsigned char *>(&name[0]),
+                  backingLength);
+      size_t slash = path.find_last_of('/');
+      if (name[0] != '/' && slash != std::string::npos)
+        name = path.substr(0, slash + 1) + name;
+      if (depth >= MAX_BACKING_DEPTH)
+      {
+        error = path + ": backing chain is too long";
+        return;
+      }
+      ImageFormat format = detectImageFormat(name);
+      uint64_t backingSize;
+      std::string backingError;
+      if (format == ImageFormat::Qcow2)
+      {
+        std::unique_ptr<Qcow2Reader> reader(new Qcow2Reader(name, depth + 1));
+        backingError = reader->errorMessage();
+        if (backingError.empty())
+          backing = std::move(reader);
+      }
+      else
+        backing = openImage(name, format, IoBackend::Pread, backingSize,
+                            backingError);
+      if (!backing)
+      {
+        error = path + ": backing image: " + backingError;
+        return;
+      }
+    }
+  }
+
+  bool ok() const { return error.empty(); }
+  const std::string &errorMessage() const { return error; }
+  uint64_t size() const { return length; }
+
+  size_t readAt(uint64_t offset, unsigned char *dest, size_t size) override
+  {
+    size_t done = 0;
+    while (done < size && offset + done < length)
+    {
+      uint64_t at = offset + done;
+      uint64_t within = at & (clusterSize() - 1);
+      size_t n = std::min<uint64_t>(
+          size - done, std::min(clusterSize() - within, length - at));
+      if (!readCluster(at - within, within, dest + done, n))
+        break;
+      done += n;
+    }
+    return done;
+  }
+
+private:
+  static constexpr uint64_t OFFSET_MASK = 0x00FFFFFFFFFFFE00ULL;
+  static constexpr uint64_t COMPRESSED = 1ULL << 62;
+  static constexpr uint64_t ALL_ZEROS = 1; // version 3
+  static constexpr uint64_t DIRTY = 1, CORRUPT = 2, COMPRESSION_TYPE = 8;
+  static constexpr int MAX_BACKING_DEPTH = 16;
+  static constexpr size_t MAX_TABLES = 256;
+  static constexpr size_t MAX_CLUSTERS = 16;
+
+  static uint32_t be32(const unsigned char *p)
+  {
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+  }
+  static uint64_t be64(const unsigned char *p)
+  {
+    return uint64_t(be32(p)) << 32 | be32(p + 4);
+  }
+
+  uint64_t clusterSize() const { return uint64_t(1) << clusterBits; }
+
+  // False when the table cannot be read.
+  bool l2Entry(uint64_t guest, uint64_t &entry)
+  {
+    unsigned l2Bits = clusterBits - 3;
+    uint64_t cluster = guest >> clusterBits;
+    uint64_t l1Index = cluster >> l2Bits;
+    uint64_t table = l1Index < l1.size() ? l1[l1Index] : 0;
+    if (table == 0)
+    {
+      entry = 0;
+      return true;
+    }
+    size_t index = cluster & ((uint64_t(1) << l2Bits) - 1);
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = tables.find(table);
+    if (it == tables.end())
+    {
+      std::vector<unsigned char> raw(clusterSize());
+      if (file.readAt(table, raw.data(), raw.size()) < raw.size())
+        return false;
+      if (tables.size() >= MAX_TABLES)
+        tables.clear();
+      std::vector<uint64_t> &entries = tables[table];
+      for (size_t i = 0; i < raw.size() / 8; ++i)
+        entries.push_back(be64(raw.data() + i * 8));
+      it = tables.find(table);
+    }
+    entry = it->second[index];
+    return true;
+  }
+
+  bool readCluster(uint64_t start, uint64_t within, unsigned char *dest,
+                   size_t size)
+  {
+    uint64_t entry;
+    if (!l2Entry(start, entry))
+      return false;
+    if (entry & COMPRESSED)
+      return readCompressed(entry, within, dest, size);
+    uint64_t host = entry & OFFSET_MASK;
+    if ((entry & ALL_ZEROS) || (host == 0 && !backing))
+    {
+      memset(dest, 0, size);
+      return true;
+    }
+    if (host == 0)
+    {
+      // A backing image shorter than this one reads as zeros past its end.
+      size_t got = backing->readAt(start + within, dest, size);
+      memset(dest + got, 0, size - got);
+      return true;
+    }
+    return file.readAt(host + within, dest, size) == size;
+  }
+
+  // The last few decoded clusters are kept: a scan reads each one in
+  // several pieces.
+  bool readCompressed(uint64_t entry, uint64_t within, unsigned char *dest,
+                      size_t size)
+  {
+    unsigned sectorBits = 62 - (clusterBits - 8);
+    uint64_t host = entry & ((uint64_t(1) << sectorBits) - 1);
+    uint64_t sectors = (entry & (COMPRESSED - 1)) >> sectorBits;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      for (const auto &cluster : decoded)
+        if (cluster.first == host)
+        {
+          memcpy(dest, cluster.second->data() + within, size);
+          return true;
+        }
+    }
+    size_t compressedSize = (sectors + 1) * 512 - (host & 511);
+    std::vector<unsigned char> input(compressedSize);
+    input.resize(file.readAt(host, input.data(), input.size()));
+    auto cluster = std::make_shared<std::vector<unsigned char>>(clusterSize());
+    if (!decompressCluster(input, *cluster))
+      return false;
+    memcpy(dest, cluster->data() + within, size);
+    std::lock_guard<std::mutex> guard(lock);
+    decoded.push_front({host, cluster});
+    if (decoded.size() > MAX_CLUSTERS)
+      decoded.pop_back();
+    return true;
+  }
+
+  // Compressed data is padded to a sector, so decoding stops once the
+  // cluster is full.
+  bool decompressCluster(std::vector<unsigned char> &input,
+                         std::vector<unsigned char> &output)
+  {
+    if (zstdClusters)
+    {
+#ifdef HAVE_ZSTD
+      std::unique_ptr<ZSTD_DStream, size_t (*)(ZSTD_DStream *)> stream(
+          ZSTD_createDStream(), ZSTD_freeDStream);
+      if (!stream || ZSTD_isError(ZSTD_initDStream(stream.get())))
+        return false;
+      ZSTD_inBuffer in = {input.data(), input.size(), 0};
+      ZSTD_outBuffer out = {output.data(), output.size(), 0};
+      while (out.pos < out.size && in.pos < in.size)
+        if (ZSTD_isError(ZSTD_decompressStream(stream.get(), &out, &in)))
+          return false;
+      return out.pos == out.size;
+#else
+      return false;
+#endif
+    }
+#ifdef HAVE_ZLIB
+    z_stream strm = {};
+    if (inflateInit2(&strm, -12) != Z_OK)
+      return false;
+    strm.next_in = input.data();
+    strm.avail_in = input.size();
+    strm.next_out = output.data();
+    strm.avail_out = output.size();
+    int ret = inflate(&strm, Z_FINISH);
+    inflateEnd(&strm);
+    return (ret == Z_STREAM_END || ret == Z_BUF_ERROR || ret == Z_OK) &&
+           strm.avail_out == 0;
+#else
+    return false;
+#endif
+  }
+
+  PreadReader file;
+  std::string error;
+  unsigned clusterBits = 16;
+  uint64_t length = 0;
+  bool zstdClusters = false;
+  std::vector<uint64_t> l1; // L2 table offsets
+  std::unique_ptr<BlockReader> backing;
+
+  std::mutex lock; // guards the caches below
+  std::unordered_map<uint64_t, std::vector<uint64_t>> tables;
+  std::list<std::pair<uint64_t, std::shared_ptr<std::vector<unsigned char>>>>
+      decoded;
+};
+
+inline std::unique_ptr<BlockReader>
+openImage(const std::string &path, ImageFormat format, IoBackend backend,
+          uint64_t &size, std::string &error,
+          const std::function<bool()> &cancelCheck)
+{
+  switch (format)
+  {
+  case ImageFormat::Split:
+  {
+    std::unique_ptr<SplitReader> reader(new SplitReader(path, backend));
+    if (!reader->ok())
+      break;
+    size = reader->size();
+    return reader;
+  }
+  case ImageFormat::Gzip:
+  {
+#ifdef HAVE_ZLIB
+    std::unique_ptr<GzipReader> reader(new GzipReader(path));
+    if (!reader->ok())
+      break;
+    if (!reader->buildIndex(cancelCheck))
+    {
+      error = "Cancelled while indexing " + path;
+      return nullptr;
+    }
+    if (reader->isDamaged())
+      error = "Damaged gzip data in " + path + "; reading the first " +
+              std::to_string(reader->size()) + " bytes";
+    size = reader->size();
+    return reader;
+#else
+    error = "Reading gzip images needs a build with zlib: " + path;
+    return nullptr;
+#endif
+  }
+  case ImageFormat::Zstd:
+  {
+#ifdef HAVE_ZSTD
+    std::unique_ptr<ZstdReader> reader(new ZstdReader(path));
+    if (!reader->ok())
+      break;
+    if (!reader->buildIndex(cancelCheck))
+    {
+      error = "Cancelled while indexing " + path;
+      return nullptr;
+    }
+    if (reader->isDamaged())
+      error = "Damaged zstd data in " + path + "; reading the first " +
+              std::to_string(reader->size()) + " bytes";
+    size = reader->size();
+    return reader;
+#else
+    error = "Reading zstd images needs a build with libzstd: " + path;
+    return nullptr;
+#endif
+  }
+  case ImageFormat::Qcow2:
+  {
+    std::unique_ptr<Qcow2Reader> reader(new Qcow2Reader(path));
+    if (!reader->ok())
+    {
+      error = reader->errorMessage();
+      return nullptr;
+    }
+    size = reader->size();
+    return reader;
+  }
+  default:
+  {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+      break;
+    size = static_cast<uint64_t>(file.tellg());
+    if (std::unique_ptr<BlockReader> reader = BlockReader::open(path, backend, size))
+      return reader;
+  }
+  }
+  error = "Failed to open " + path;
+  return nullptr;
+}
+
+#endif // IMAGEREADERS_H
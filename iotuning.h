@@ -0,0 +1,269 @@
+#ifndef IOTUNING_H
+#define IOTUNING_H
+
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+// --- Device I/O profile ---
+// What the kernel says about the disk under a device or image file
+// (/sys/dev/block/MAJ:MIN/queue). A partition reports its disk's queue; an
+// image file reports the disk its filesystem is on. Nothing is known for
+// files on network or overlay filesystems.
+struct IoProfile
+{
+  bool known = false;
+  bool rotational = false;
+  uint64_t optimalIo = 0;  // bytes; 0 when the device does not say
+  uint64_t maxRequest = 0; // bytes (max_sectors_kb)
+  std::string name;        // "sda", "nvme0n1", ...
+};
+
+inline bool readSysfsNumber(const std::string &path, uint64_t &value)
+{
+  std::ifstream in(path);
+  return static_cast<bool>(in >> value);
+}
+
+// The sysfs directory of the disk holding `path` (a device, partition or
+// file), empty when there is none.
+inline std::string sysfsDiskDirectory(const std::string &path)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return "";
+  dev_t dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+  std::string sys = "/sys/dev/block/" + std::to_string(major(dev)) + ":" +
+                    std::to_string(minor(dev));
+  uint64_t rotational;
+  if (readSysfsNumber(sys + "/queue/rotational", rotational))
+    return sys;
+  if (readSysfsNumber(sys + "/../queue/rotational", rotational))
+    return sys + "/.."; // a partition
+  return "";
+}
+
+inline IoProfile probeIoProfile(const std::string &path)
+{
+  IoProfile profile;
+  std::string disk = sysfsDiskDirectory(path);
+  uint64_t rotational = 0;
+  if (disk.empty() || !readSysfsNumber(disk + "/queue/rotational", rotational))
+    return profile;
+  profile.known = true;
+  profile.rotational = rotational != 0;
+  readSysfsNumber(disk + "/queue/optimal_io_size", profile.optimalIo);
+  if (readSysfsNumber(disk + "/queue/max_sectors_kb", profile.maxRequest))
+    profile.maxRequest *= 1024;
+  std::ifstream uevent(disk + "/uevent");
+  for (std::string line; std::getline(uevent, line);)
+    if (line.compare(0, 8, "DEVNAME=") == 0)
+      profile.name = line.substr(8);
+  return profile;
+}
+
+inline std::string describeIoProfile(const IoProfile &profile)
+{
+  if (!profile.known)
+    return "unknown device";
+  std::string text = (profile.name.empty() ? "" : profile.name + ", ") +
+                     (profile.rotational ? "rotational" : "non-rotational");
+  if (profile.optimalIo > 0)
+    text += ", optimal I/O " + std::to_string(profile.optimalIo / 1024) + " KB";
+  if (profile.maxRequest > 0)
+    text += ", max request " + std::to_string(profile.maxRequest / 1024) + " KB";
+  return text;
+}
+
+// --- Adaptive read size and queue depth ---
+// Starts from the device profile: large reads and little read-ahead for a
+// spinning disk, which wants long sequential runs; moderate reads and more
+// in flight for an SSD. Every scan read is then recorded, and each
+// WINDOW_BYTES the read throughput (bytes per second spent waiting in reads)
+// decides the next step: the read size is doubled while that gains at least
+// MIN_GAIN (or halved, if the first doubling lost), then the queue depth the
+// same way, and the best pair is kept. A pair whose mean read latency
+// exceeds the device's limit never wins. Once settled, a device that slows
+// past that limit (someone else is using it) gets a smaller depth or read
+// size, and after RECOVER_WINDOWS fast windows in a row the tuner steps back
+// toward the best pair, read size first.
+//
+// Sizes stay multiples of ALIGNMENT. record() may be called from every
+// scanning thread; readSize() and queueDepth() are lock free.
+class IoTuner
+{
+public:
+  static constexpr size_t ALIGNMENT = 4096;
+  static constexpr size_t MIN_READ = 64 * 1024;
+  static constexpr size_t MAX_READ = 8 * 1024 * 1024;
+  static constexpr unsigned MAX_DEPTH = 16;
+  static constexpr uint64_t WINDOW_BYTES = 64 * 1024 * 1024;
+  static constexpr double MIN_GAIN = 0.05;
+  static constexpr unsigned RECOVER_WINDOWS = 4;
+
+  explicit IoTuner(const IoProfile &profile)
+  {
+    size_t start = 256 * 1024;
+    unsigned startDepth = 2;
+    if (profile.known && profile.rotational)
+      start = 1024 * 1024;
+    else if (profile.known)
+    {
+      start = std::max<size_t>(start, profile.optimalIo);
+      startDepth = 4;
+    }
+    // The kernel splits a read larger than one request, so aim at one.
+    maxRead = MAX_READ;
+    if (profile.maxRequest >= MIN_READ)
+      maxRead = std::min<size_t>(maxRead, profile.maxRequest);
+    maxRead -= maxRead % ALIGNMENT;
+    latencyLimitNanos = profile.rotational ? 100000000 : 20000000;
+    best = {clampSize(start), startDepth, 0};
+    initialSize = best.size;
+    size = best.size;
+    depth = best.depth;
+  }
+
+  size_t readSize() const { return size.load(std::memory_order_relaxed); }
+  unsigned queueDepth() const { return depth.load(std::memory_order_relaxed); }
+
+  bool settled() const
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return step == Settled;
+  }
+
+  // Bytes per second of the best window so far, 0 before the first.
+  double throughput() const
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return best.rate;
+  }
+
+  void record(uint64_t bytes, uint64_t nanos)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    windowBytes += bytes;
+    windowNanos += nanos;
+    ++windowReads;
+    if (windowBytes >= WINDOW_BYTES)
+      evaluate();
+  }
+
+private:
+  enum Step
+  {
+    GrowSize,
+    ShrinkSize,
+    GrowDepth,
+    Settled
+  };
+
+  struct Setting
+  {
+    size_t size;
+    unsigned depth;
+    double rate; // bytes per second while reading
+  };
+
+  size_t clampSize(size_t bytes) const
+  {
+    bytes = std::min(std::max(bytes, MIN_READ), maxRead);
+    return bytes - bytes % ALIGNMENT;
+  }
+
+  void apply(const Setting &setting)
+  {
+    size = setting.size;
+    depth = setting.depth;
+  }
+
+  // Called at the end of each window, which measured the applied setting.
+  void evaluate()
+  {
+    Setting current = {readSize(), queueDepth(),
+                       windowBytes * 1e9 / std::max<uint64_t>(windowNanos, 1)};
+    bool fast = windowNanos / std::max<uint64_t>(windowReads, 1) <=
+                latencyLimitNanos;
+    windowBytes = windowNanos = windowReads = 0;
+
+    if (step == Settled)
+    {
+      // `best` stays the tuned pair; backing off only changes what is
+      // applied, so the tuner knows where to return to.
+      Setting next = current;
+      if (!fast)
+      {
+        fastWindows = 0;
+        if (current.depth > 1)
+          next.depth /= 2;
+        else
+          next.size = clampSize(current.size / 2);
+      }
+      else if (current.size == best.size && current.depth == best.depth)
+        best.rate = std::max(best.rate, current.rate);
+      else if (++fastWindows >= RECOVER_WINDOWS)
+      {
+        // Undo the back-off in reverse: read size, then depth.
+        fastWindows = 0;
+        if (current.size < best.size)
+          next.size = std::min(clampSize(current.size * 2), best.size);
+        else
+          next.depth = std::min(current.depth * 2, best.depth);
+      }
+      apply(next);
+      return;
+    }
+    if (best.rate == 0 || (fast && current.rate > best.rate * (1 + MIN_GAIN)))
+      best = current;
+    else
+      step = nextStep(); // the trial lost; try the next direction
+
+    // From the best setting, one step in the current direction. A direction
+    // with nothing left to try moves on to the next.
+    while (step != Settled)
+    {
+      Setting next = best;
+      if (step == GrowSize)
+        next.size = clampSize(best.size * 2);
+      else if (step == ShrinkSize)
+        next.size = clampSize(best.size / 2);
+      else
+        next.depth = std::min(best.depth * 2, MAX_DEPTH);
+      if (next.size != best.size || next.depth != best.depth)
+      {
+        apply(next);
+        return;
+      }
+      step = nextStep();
+    }
+    apply(best);
+  }
+
+  // Smaller reads are only tried when larger ones never helped.
+  Step nextStep() const
+  {
+    if (step == GrowSize)
+      return best.size == initialSize ? ShrinkSize : GrowDepth;
+    return step == ShrinkSize ? GrowDepth : Settled;
+  }
+
+  mutable std::mutex lock;
+  std::atomic<size_t> size{0};
+  std::atomic<unsigned> depth{1};
+  size_t maxRead = MAX_READ;
+  uint64_t latencyLimitNanos = 0;
+  Step step = GrowSize;
+  Setting best = {0, 1, 0};
+  size_t initialSize = 0;
+  unsigned fastWindows = 0; // in a row while backed off from `best`
+  uint64_t windowBytes = 0, windowNanos = 0, windowReads = 0;
+};
+
+#endif // IOTUNING_H
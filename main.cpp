@@ -1,253 +1,305 @@
-#include <cstdint>
-#include <filesystem>  // For creating directories
-#include <fstream>
+// Headless command-line front end for the recovery engine, for servers
+// without Qt.
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include "mp3.h"
-#include "mp4.h"
+#include "catalog.h"
+#include "scanbatch.h"
 
 using namespace std;
-namespace fs = std::filesystem;
-
-const vector<unsigned char> PNG_SIGNATURE = {0x89, 0x50, 0x4E, 0x47,
-                                             0x0D, 0x0A, 0x1A, 0x0A};
-const vector<unsigned char> PNG_IEND = {0x00, 0x00, 0x00, 0x00, 0x49, 0x45,
-                                        0x4E, 0x44, 0xAE, 0x42, 0x60, 0x82};
-
-const vector<unsigned char> JPEG_SIGNATURE = {
-    0xFF, 0xD8, 0xFF};  // changed to 0xFF,0xD8,0xFF from 0xFF,0xD8,
-const vector<unsigned char> JPEG_END = {0xFF, 0xD9};  // JPEG EOI
-
-const vector<unsigned char> PDF_SIGNATURE = {0x25, 0x50, 0x44, 0x46,
-                                             0x2D};                    // %PDF-
-const vector<unsigned char> PDF_END = {0x25, 0x25, 0x45, 0x4F, 0x46};  // %%EOF
-
-const vector<unsigned char> ZIP_SIGNATURE = {0x50, 0x4B, 0x03,
-                                             0x04};  // PK\x03\x04
-const vector<unsigned char> ZIP_END = {0x50, 0x4B, 0x05,
-                                       0x06};  // End of Central Directory
-
-const vector<unsigned char> MP3_SIG = {
-    0xFF, 0xE0};  // Simplified MP3 frame header start
-const vector<unsigned char> MP3_END = {0x00};  // Placeholder
-
-const vector<unsigned char> DOC_SIGNATURE = {
-    0xD0, 0xCF, 0x11, 0xE0, 0xA1, 0xB1, 0x1A, 0xE1};  // Old .doc/.xls
-const vector<unsigned char> DOCX_SIGNATURE = {
-    0x50, 0x4B, 0x03, 0x04};  // Same as ZIP, check internal [Content_Types].xml
-const vector<unsigned char> MP4_SIGNATURE = {0x00, 0x00, 0x00, 0x00, 0x66,
-                                             0x74, 0x79, 0x70};  // 'ftyp' box
-const vector<unsigned char> EXE_SIGNATURE = {0x4D, 0x5A};        // "MZ" header
-const vector<unsigned char> ELF_SIGNATURE = {0x7F, 0x45, 0x4C,
-                                             0x46};  // 0x7F 'E' 'L' 'F'
-
-// Optional dummy end markers (can improve or scan length-based)
-const vector<unsigned char> GENERIC_END = {
-    0x00};  // Placeholder for types with no clear EOF marker
-
-vector<vector<unsigned char>> SIGNATURES = {
-    PNG_SIGNATURE, JPEG_SIGNATURE, PDF_SIGNATURE, ZIP_SIGNATURE, MP3_SIG,
-    DOC_SIGNATURE, DOCX_SIGNATURE, MP4_SIGNATURE, EXE_SIGNATURE, ELF_SIGNATURE};
-
-vector<vector<unsigned char>> END_MARKERS = {
-    PNG_IEND,    JPEG_END, PDF_END, ZIP_END, MP3_END,
-    GENERIC_END,  // DOC
-    GENERIC_END,  // DOCX
-    GENERIC_END,  // MP4
-    GENERIC_END,  // EXE
-    GENERIC_END   // ELF
-};
-
-vector<string> FILE_EXTENSIONS = {".png", ".jpg",  ".pdf", ".zip", ".mp3",
-                                  ".doc", ".docx", ".mp4", ".exe", ".elf"};
-vector<string> FILE_NAMES = {"PNG", "JPEG", "PDF", "ZIP", "MP3",
-                             "DOC", "DOCX", "MP4", "EXE", "ELF"};
-vector<pair<int, int>> Size_limit = {
-    {512, 20 * 1024 * 1024},   {512, 20 * 1024 * 1024},
-    {1024, 50 * 1024 * 1024},  {1024, 100 * 1024 * 1024},
-    {1024, 20 * 1024 * 1024},  {1024, 50 * 1024 * 1024},  // DOC
-    {1024, 50 * 1024 * 1024},                             // DOCX
-    {1024, 500 * 1024 * 1024},                            // MP4
-    {1024, 50 * 1024 * 1024},                             // EXE
-    {1024, 50 * 1024 * 1024}                              // ELF
-};
-int SupportedFileCount = 5;
-bool matchesSignature(const vector<unsigned char> &buffer, size_t pos,
-                      const vector<unsigned char> &signature) {
-  if (pos + signature.size() > buffer.size()) return false;
-  for (size_t i = 0; i < signature.size(); i++) {
-    if (buffer[pos + i] != signature[i]) return false;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void onInterrupt(int) { interrupted = 1; }
+
+// Parses "0,4,10-20" into `selected`, one flag per catalog entry.
+static bool parseEntries(const string &list, vector<bool> &selected)
+{
+  stringstream items(list);
+  string item;
+  while (getline(items, item, ','))
+  {
+    char *end = nullptr;
+    unsigned long first = strtoul(item.c_str(), &end, 10);
+    unsigned long last = first;
+    if (*end == '-')
+      last = strtoul(end + 1, &end, 10);
+    if (item.empty() || *end != '\0' || first > last ||
+        last >= selected.size())
+      return false;
+    fill(selected.begin() + first, selected.begin() + last + 1, true);
   }
   return true;
 }
-void extractFile(const string &filename, size_t fileStart, int &fileCount,
-                 int formatIndex) {
-  if (formatIndex == 4) return;  // MP3 handled elsewhere
-
-  ifstream file(filename, ios::binary);
-  if (!file) {
-    cerr << "Failed to reopen file for extraction\n";
-    return;
+
+static void listCatalog(const CatalogFile &catalog)
+{
+  cout << "Device: " << catalog.devicePath() << " (" << catalog.deviceSize()
+       << " bytes), " << catalog.size() << " entries\n";
+  for (size_t i = 0; i < catalog.size(); ++i)
+  {
+    const CatalogEntry &entry = catalog[i];
+    cout << i << "\t" << RecoveryEngine::formatName(entry.format) << "\t"
+         << entry.offset << "\t"
+         << (entry.flags & CatalogEntry::LengthExact ? "" : "~")
+         << entry.length << "\t"
+         << static_cast<int>(entry.confidence * 100 + 0.5f) << "%";
+    if (entry.width > 0)
+      cout << "\t" << entry.width << "x" << entry.height;
+    if (entry.detail > 0)
+      cout << "\tdetail " << entry.detail;
+    cout << "\n";
   }
+}
 
-  file.clear();  // Clear any flags
-  file.seekg(fileStart, ios::beg);
+static void usage()
+{
+  cerr << "usage: datarecovery --device PATH [--device PATH ...] --output DIR\n"
+          "                    [options]\n"
+          "       datarecovery --extract CATALOG [--entries LIST] --output DIR\n"
+          "       datarecovery --list CATALOG\n"
+          "\n"
+          "  Several devices are scanned at once, each into a subdirectory of DIR.\n"
+          "\n"
+          "  --catalog          only list candidates in DIR/catalog.idx, carve nothing\n"
+          "  --extract CATALOG  carve entries of a catalog from its device (or the\n"
+          "                     one --device names)\n"
+          "  --entries LIST     catalog entries to extract, e.g. 0,4,10-20 (default:\n"
+          "                     all of the selected formats)\n"
+          "  --list CATALOG     print a catalog's entries\n"
+          "  --formats LIST     comma separated: png,jpeg,pdf,zip,mp3 (default: all)\n"
+          "  --threads N        scanning threads (default: 1, 0 = one per core)\n"
+          "  --carve-threads N  threads copying out files (default: one per core,\n"
+          "                     0 = carve on the scanning threads)\n"
+          "  --io BACKEND       stream, pread or mmap (default: stream)\n"
+          "  --max-rate MB      read limit over all devices in MB/s, shared fairly\n"
+          "  --device-rate MB   read limit for each device in MB/s\n"
+          "  --max-iops N       reads per second for each device\n"
+          "  --idle-only        read only while nothing else uses the disk\n"
+          "  --ioprio CLASS     I/O class of the scan: idle, be[:0-7], rt[:0-7]\n"
+          "  --free-space-only  scan only blocks the filesystem marks as free\n"
+          "  --metadata         recover deleted files from filesystem metadata first\n"
+          "  --verbose          also print every candidate and why it was rejected\n"
+          "  --quiet            print only the summary\n";
+}
 
-  size_t chunkSize = 4 * 1024;
-  vector<unsigned char> readBuffer(chunkSize);
+int main(int argc, char *argv[])
+{
+  vector<string> devices;
+  string output;
+  string formatList = "png,jpeg,pdf,zip,mp3";
+  unsigned threads = 1;
+  int carveThreads = -1;
+  IoBackend backend = IoBackend::Stream;
+  double maxRate = 0, deviceRate = 0, maxIops = 0;
+  bool idleOnly = false;
+  IoPriority ioPriority;
+  bool freeSpaceOnly = false, metadata = false, quiet = false, verbose = false;
+  bool catalogOnly = false;
+  string extractFrom, listFrom, entryList;
 
-  string outFileName = "./RecoveredData/" + FILE_NAMES[formatIndex] +
-                       "/RecoveredFile_" + to_string(fileCount) +
-                       FILE_EXTENSIONS[formatIndex];
-  ofstream outFile(outFileName, ios::binary);
-  if (!outFile) {
-    cerr << "Failed to create output file " << outFileName << endl;
-    return;
-  }
-
-  // PDF specific
-  bool xrefFound = false;
-  bool trailerFound = false;
-  vector<unsigned char> PDF_XREF = {0x78, 0x72, 0x65, 0x66};  // xref
-  vector<unsigned char> PDF_TRAILER = {0x74, 0x72, 0x61, 0x69,
-                                       0x6C, 0x65, 0x72};  // trailer
-
-  bool foundEnd = false;
-  size_t totalBytesWritten = 0;
-
-  while (!foundEnd && (file.read(reinterpret_cast<char *>(readBuffer.data()),
-                                 readBuffer.size()) ||
-                       file.gcount() > 0)) {
-    size_t chunkBytes = file.gcount();
-    size_t writeBytes = chunkBytes;
-
-    if (END_MARKERS[formatIndex] == GENERIC_END) {
-      for (size_t j = 0; j < SupportedFileCount; j++) {
-        if (j >= 5 && j <= 9) continue;
-        for (size_t k = 0; k + SIGNATURES[j].size() <= chunkBytes; k++) {
-          if (matchesSignature(readBuffer, k, SIGNATURES[j])) {
-            writeBytes = k + SIGNATURES[j].size();
-            foundEnd = true;
-            break;
-          }
-        }
-        if (foundEnd) break;
+  for (int i = 1; i < argc; ++i)
+  {
+    string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--device" && hasValue)
+      devices.push_back(argv[++i]);
+    else if (arg == "--output" && hasValue)
+      output = argv[++i];
+    else if (arg == "--formats" && hasValue)
+      formatList = argv[++i];
+    else if (arg == "--threads" && hasValue)
+      threads = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--carve-threads" && hasValue)
+      carveThreads = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--io" && hasValue)
+    {
+      if (!parseIoBackend(argv[++i], backend))
+      {
+        cerr << "Unknown I/O backend: " << argv[i] << "\n";
+        return 2;
       }
-    } else {
-      for (size_t j = 0; j + END_MARKERS[formatIndex].size() <= chunkBytes;
-           j++) {
-        if (formatIndex == 2 && (!xrefFound || !trailerFound))  // PDF specific
-        {
-          if (matchesSignature(readBuffer, j, PDF_XREF)) {
-            xrefFound = true;
-          }
-          if (matchesSignature(readBuffer, j, PDF_TRAILER)) {
-            trailerFound = true;
-          }
-        }
-        if (matchesSignature(readBuffer, j, END_MARKERS[formatIndex])) {
-          writeBytes = j + END_MARKERS[formatIndex].size();
-          foundEnd = true;
-          break;
-        }
+    }
+    else if (arg == "--max-rate" && hasValue)
+      maxRate = strtod(argv[++i], nullptr);
+    else if (arg == "--device-rate" && hasValue)
+      deviceRate = strtod(argv[++i], nullptr);
+    else if (arg == "--max-iops" && hasValue)
+      maxIops = strtod(argv[++i], nullptr);
+    else if (arg == "--idle-only")
+      idleOnly = true;
+    else if (arg == "--ioprio" && hasValue)
+    {
+      if (!parseIoPriority(argv[++i], ioPriority))
+      {
+        cerr << "Unknown I/O priority: " << argv[i] << "\n";
+        return 2;
       }
     }
-
-    outFile.write(reinterpret_cast<char *>(readBuffer.data()), writeBytes);
-    totalBytesWritten += writeBytes;
+    else if (arg == "--catalog")
+      catalogOnly = true;
+    else if (arg == "--extract" && hasValue)
+      extractFrom = argv[++i];
+    else if (arg == "--entries" && hasValue)
+      entryList = argv[++i];
+    else if (arg == "--list" && hasValue)
+      listFrom = argv[++i];
+    else if (arg == "--free-space-only")
+      freeSpaceOnly = true;
+    else if (arg == "--metadata")
+      metadata = true;
+    else if (arg == "--quiet")
+      quiet = true;
+    else if (arg == "--verbose")
+      verbose = true;
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+  if (!listFrom.empty())
+  {
+    CatalogFile catalog;
+    string error;
+    if (!catalog.open(listFrom, error))
+    {
+      cerr << error << "\n";
+      return 1;
+    }
+    listCatalog(catalog);
+    return 0;
   }
+  if ((devices.empty() && extractFrom.empty()) || output.empty() ||
+      (!extractFrom.empty() && devices.size() > 1))
+  {
+    usage();
+    return 2;
+  }
+  if (threads == 0)
+    threads = max(1u, thread::hardware_concurrency());
 
-  // pdf specific
-  if (!foundEnd && formatIndex == 2 && xrefFound && trailerFound) {
-    foundEnd = true;  // PDF files can be considered valid if they have xref and
-                      // trailer
-    // PDF specific
-    outFile.write(reinterpret_cast<char *>(END_MARKERS[formatIndex].data()),
-                  END_MARKERS[formatIndex].size());
+  vector<bool> formats(FORMAT_COUNT, false);
+  stringstream names(formatList);
+  string name;
+  while (getline(names, name, ','))
+  {
+    int index = RecoveryEngine::formatIndex(name);
+    if (index < 0)
+    {
+      cerr << "Unknown format: " << name << "\n";
+      return 2;
+    }
+    formats[index] = true;
   }
 
-  outFile.close();
-  file.close();
+  signal(SIGINT, onInterrupt);
+  signal(SIGTERM, onInterrupt);
+  auto cancelCheck = []() { return interrupted != 0; };
 
-  size_t minSize = Size_limit[formatIndex].first;   // Convert to bytes
-  size_t maxSize = Size_limit[formatIndex].second;  // Convert to bytes
+  if (!extractFrom.empty())
+  {
+    CatalogFile catalog;
+    string error;
+    if (!catalog.open(extractFrom, error))
+    {
+      cerr << error << "\n";
+      return 1;
+    }
+    vector<bool> selected(catalog.size(), entryList.empty());
+    if (!entryList.empty() && !parseEntries(entryList, selected))
+    {
+      cerr << "Bad entry list: " << entryList << "\n";
+      return 2;
+    }
+    vector<CatalogEntry> entries;
+    for (size_t i = 0; i < catalog.size(); ++i)
+      if (selected[i] && formats[catalog[i].format])
+        entries.push_back(catalog[i]);
 
-  if (foundEnd &&
-      (totalBytesWritten < minSize || totalBytesWritten > maxSize)) {
-    cout << "[SKIP] Deleted invalid size file: " << outFileName << " ("
-         << totalBytesWritten << " bytes)\n";
-    remove(outFileName.c_str());  // Delete file
-    fileCount--;                  // Decrement file count to avoid gaps
-    return;
-  }
-  if (!foundEnd || (formatIndex == 2 && !xrefFound && !trailerFound)) {
-    cout << "[SKIP] Deleted file without end marker: " << outFileName << " ("
-         << totalBytesWritten << " bytes)\n";
-    remove(outFileName.c_str());  // Delete file
-    fileCount--;                  // Decrement file count to avoid gaps
-    return;
-  } else {
-    cout << "[OK] Recovered: " << outFileName << " ("
-         << totalBytesWritten / 1024 << " KB)\n";
-    return;
+    string device = devices.empty() ? catalog.devicePath() : devices[0];
+    RecoveryEngine engine(device, output, formats);
+    engine.setIoBackend(backend);
+    // One device, so the lower of the two rates applies.
+    double rate = maxRate > 0 && deviceRate > 0 ? min(maxRate, deviceRate)
+                                                : max(maxRate, deviceRate);
+    if (rate > 0)
+      engine.setReadLimiter(make_shared<TokenBucket>(rate * 1024 * 1024));
+    if (maxIops > 0)
+      engine.setIopsLimiter(
+          make_shared<TokenBucket>(maxIops, max(1.0, maxIops / 4)));
+    engine.setIdleOnly(idleOnly);
+    if (ioPriority.ioClass != IoClass::None && !setIoPriority(ioPriority))
+      cerr << "Cannot set I/O priority " << ioPriorityName(ioPriority) << "\n";
+    mutex outputLock;
+    bool success = engine.extractEntries(
+        entries,
+        [&](const ScanEvent &event)
+        {
+          if (event.type == ScanEvent::Progress ||
+              (quiet && event.type != ScanEvent::IoError) ||
+              (event.type == ScanEvent::CandidateRejected && !verbose))
+            return;
+          lock_guard<mutex> guard(outputLock);
+          (event.type == ScanEvent::IoError ? cerr : cout)
+              << describeEvent(event) << "\n";
+        },
+        cancelCheck);
+    if (!success)
+      return interrupted ? 130 : 1;
+    return 0;
   }
-}
 
-int main() {
-  const string filename = "/dev/sda";
-  const size_t CHUNK_SIZE = 4096;
-  ifstream file(filename, ios::binary);
-  if (!file) {
-    cerr << "Failed to open " << filename << endl;
-    return 1;
-  }
-  Mp3 mp3;
-  MP4 mp4;
-  int fileCount = 0;
-  size_t offset = 0;
-  size_t mp3_offset_done = 0;  // Counter for MP3 files
-  size_t overlap = 0;
-  vector<unsigned char> buffer(CHUNK_SIZE + overlap);
-
-  while (file.read(reinterpret_cast<char *>(buffer.data() + overlap),
-                   CHUNK_SIZE) ||
-         file.gcount() > 0) {
-    size_t bytesRead = file.gcount();
-
-    for (int formatIndex = 0; formatIndex < SupportedFileCount; formatIndex++) {
-      for (size_t i = 0; i + SIGNATURES[i].size() <= bytesRead + overlap; i++) {
-        size_t fileStart = offset + i;
-        if ((formatIndex == 4 && mp3.matchesMP3Header(buffer, i) &&
-             offset + i >= mp3_offset_done)) {
-          cout << "found mp3 header at offset: " << fileStart << endl;
-          mp3_offset_done =
-              mp3.extractMP3File(filename, fileStart, ++fileCount);
-          i += 4;
-        } else if (formatIndex == 7 &&
-                   mp4.matchesMP4Header(buffer, MP4_SIGNATURE, i)) {
-          cout << "Found MP4 header at offset: " << fileStart << endl;
-          mp4.extractMP4File(filename, fileStart, ++fileCount);
-          i += 8;  // Skip the 'ftyp' header
-        } else if ((formatIndex != 4 && formatIndex != 7 &&
-                    matchesSignature(buffer, i, SIGNATURES[formatIndex]))) {
-          cout << "Found file signature at offset: " << fileStart << endl;
-          extractFile(filename, fileStart, ++fileCount, formatIndex);
-          i += SIGNATURES[formatIndex].size();  // Skip some bytes to avoid
-                                                // detecting same file again
-        }
-      }
+  ScanBatch batch(devices, output, formats);
+  batch.setThreadsPerDevice(threads);
+  if (carveThreads >= 0)
+    batch.setCarveThreads(carveThreads);
+  batch.setIoBackend(backend);
+  batch.setFreeSpaceOnly(freeSpaceOnly);
+  batch.setMetadataRecovery(metadata);
+  batch.setCatalogOnly(catalogOnly);
+  batch.setTotalBandwidth(maxRate * 1024 * 1024);
+  batch.setDeviceBandwidth(deviceRate * 1024 * 1024);
+  batch.setDeviceIops(maxIops);
+  batch.setIdleOnly(idleOnly);
+  batch.setIoPriority(ioPriority);
+
+  // Callbacks arrive from every scanning thread.
+  mutex outputLock;
+  auto eventCallback = [&](const ScanEvent &event)
+  {
+    if ((event.type == ScanEvent::CandidateFound ||
+         event.type == ScanEvent::CandidateRejected) &&
+        !verbose)
+      return;
+    lock_guard<mutex> guard(outputLock);
+    if (event.type == ScanEvent::Progress)
+    {
+      // Only the combined figure; per-device progress would interleave.
+      if (!quiet && event.device < 0)
+        cerr << "\rProgress: " << event.percent << "%"
+             << (event.percent == 100 ? "\n" : "") << flush;
+      return;
     }
-    offset += bytesRead;
-    if (bytesRead == CHUNK_SIZE) {
-      for (int i = 0; i < overlap; i++) {
-        buffer[i] = buffer[CHUNK_SIZE + i -
-                           overlap];  // Shift overlap bytes to the front
-      }
+    // Quiet mode prints only the summaries and errors.
+    if (!quiet || event.summary || event.type == ScanEvent::IoError)
+    {
+      ostream &out = event.type == ScanEvent::IoError ? cerr : cout;
+      if (batch.size() > 1 && event.device >= 0)
+        out << "[" << batch.device(event.device) << "] ";
+      out << describeEvent(event) << "\n";
     }
-  }
-
-  file.close();
+  };
+  bool success = batch.run(eventCallback, cancelCheck);
+  if (!success)
+    return interrupted ? 130 : 1;
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,223 @@
+#ifndef MEDIAINFO_H
+#define MEDIAINFO_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "blockreader.h"
+#include "fsutil.h"
+
+// --- Media facts for previews ---
+// Read from a candidate's byte range on the device, so a file can be
+// described before it is carved. Each reader touches a few small windows,
+// never the whole file.
+
+struct Mp3Tags
+{
+  std::string title, artist, album; // UTF-8, empty when absent
+  bool empty() const
+  {
+    return title.empty() && artist.empty() && album.empty();
+  }
+};
+
+struct Mp4Info
+{
+  std::string brand;   // ftyp major brand, "isom", "M4A ", ...
+  double seconds = 0;  // mvhd duration; 0 when no moov was found
+};
+
+// ID3 text: an encoding byte (0 Latin-1, 1 UTF-16 with BOM, 2 UTF-16BE,
+// 3 UTF-8), then the text, up to a terminator.
+inline std::string id3Text(const unsigned char *p, size_t size)
+{
+  if (size == 0)
+    return "";
+  std::string out;
+  unsigned encoding = p[0];
+  ++p;
+  --size;
+  if (encoding == 1 || encoding == 2)
+  {
+    bool bigEndian = encoding == 2;
+    if (size >= 2 && ((p[0] == 0xFE && p[1] == 0xFF) ||
+                      (p[0] == 0xFF && p[1] == 0xFE)))
+    {
+      bigEndian = p[0] == 0xFE;
+      p += 2;
+      size -= 2;
+    }
+    for (size_t i = 0; i + 1 < size; i += 2)
+    {
+      uint32_t c = bigEndian ? (p[i] << 8 | p[i + 1]) : (p[i] | p[i + 1] << 8);
+      if (c >= 0xD800 && c < 0xDC00 && i + 3 < size)
+      {
+        uint32_t low = bigEndian ? (p[i + 2] << 8 | p[i + 3])
+                                 : (p[i + 2] | p[i + 3] << 8);
+        if (low >= 0xDC00 && low < 0xE000)
+        {
+          c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+          i += 2;
+        }
+      }
+      if (c == 0)
+        break;
+      appendUtf8(out, c);
+    }
+    return out;
+  }
+  for (size_t i = 0; i < size && p[i] != 0; ++i)
+  {
+    if (encoding == 3)
+      out += static_cast<char>(p[i]);
+    else
+      appendUtf8(out, p[i]);
+  }
+  return out;
+}
+
+// An ID3v2.3/2.4 tag of `size` bytes, header included.
+inline void parseId3v2(const unsigned char *tag, size_t size, Mp3Tags &tags)
+{
+  unsigned version = tag[3];
+  auto syncsafe = [](const unsigned char *p)
+  { return uint32_t(p[0]) << 21 | p[1] << 14 | p[2] << 7 | p[3]; };
+  size_t pos = 10;
+  if (tag[5] & 0x40 && size >= 14) // extended header
+    pos += version == 4 ? syncsafe(tag + 10) : be32(tag + 10) + 4;
+  while (pos + 10 <= size && tag[pos] != 0)
+  {
+    uint32_t length =
+        version == 4 ? syncsafe(tag + pos + 4) : be32(tag + pos + 4);
+    if (length > size - pos - 10)
+      break;
+    const unsigned char *body = tag + pos + 10;
+    std::string *field = memcmp(tag + pos, "TIT2", 4) == 0   ? &tags.title
+                         : memcmp(tag + pos, "TPE1", 4) == 0 ? &tags.artist
+                         : memcmp(tag + pos, "TALB", 4) == 0 ? &tags.album
+                                                             : nullptr;
+    if (field)
+      *field = id3Text(body, length);
+    pos += 10 + length;
+  }
+}
+
+// Tags of the MP3 whose frames occupy [offset, offset + length). An ID3v2
+// tag sits just before the first frame, so the ID3V2_SEARCH bytes before
+// `offset` are searched for a tag that ends there (give or take its zero
+// padding); an ID3v1 tag follows the last frame. False when neither exists.
+inline bool readMp3Tags(BlockReader &device, uint64_t offset, uint64_t length,
+                        Mp3Tags &tags)
+{
+  static constexpr size_t ID3V2_SEARCH = 256 * 1024;
+  static constexpr size_t MAX_PADDING = 4096;
+
+  size_t window =
+      static_cast<size_t>(std::min<uint64_t>(offset, ID3V2_SEARCH));
+  std::vector<unsigned char> before(window);
+  window = device.readAt(offset - window, before.data(), window);
+  before.resize(window);
+  for (size_t i = window >= 10 ? window - 10 + 1 : 0; i-- > 0;)
+  {
+    const unsigned char *p = before.data() + i;
+    if (p[0] != 'I' || p[1] != 'D' || p[2] != '3' || (p[3] != 3 && p[3] != 4) ||
+        ((p[6] | p[7] | p[8] | p[9]) & 0x80))
+      continue;
+    size_t size = 10 + (size_t(p[6]) << 21 | p[7] << 14 | p[8] << 7 | p[9]);
+    if (size > window - i || window - i - size > MAX_PADDING)
+      continue;
+    parseId3v2(p, size, tags);
+    break;
+  }
+
+  // ID3v1: 128 bytes, "TAG", then 30 bytes each of title, artist and album.
+  if (tags.empty())
+  {
+    unsigned char v1[128];
+    for (uint64_t at : {offset + length, offset + length - 128})
+    {
+      if (length < 128 || device.readAt(at, v1, sizeof(v1)) != sizeof(v1) ||
+          memcmp(v1, "TAG", 3) != 0)
+        continue;
+      auto field = [&v1](size_t start)
+      {
+        std::string out;
+        for (size_t i = start; i < start + 30 && v1[i] != 0; ++i)
+          appendUtf8(out, v1[i]);
+        return out.erase(out.find_last_not_of(' ') + 1);
+      };
+      tags.title = field(3);
+      tags.artist = field(33);
+      tags.album = field(63);
+      break;
+    }
+  }
+  return !tags.empty();
+}
+
+// The major brand and duration of the MP4 starting at `offset`. Top-level
+// boxes are walked by their headers, so a large mdat costs one read; only
+// moov (up to MAX_MOOV bytes) is read in full. False when the first box is
+// not ftyp.
+inline bool readMp4Info(BlockReader &device, uint64_t offset, Mp4Info &info)
+{
+  static constexpr size_t MAX_MOOV = 4 * 1024 * 1024;
+  static constexpr int MAX_BOXES = 64;
+
+  uint64_t at = offset;
+  for (int box = 0; box < MAX_BOXES; ++box)
+  {
+    unsigned char header[16];
+    if (device.readAt(at, header, sizeof(header)) < 16)
+      break;
+    uint64_t size = be32(header);
+    size_t headerSize = 8;
+    if (size == 1)
+    {
+      size = uint64_t(be32(header + 8)) << 32 | be32(header + 12);
+      headerSize = 16;
+    }
+    if (box == 0 && (memcmp(header + 4, "ftyp", 4) != 0 || size < 12))
+      return false;
+    if (size < headerSize && size != 0)
+      break;
+    if (box == 0)
+      info.brand.assign(reinterpret_cast<const char *>(header + 8), 4);
+    if (memcmp(header + 4, "moov", 4) == 0 && size != 0)
+    {
+      std::vector<unsigned char> moov(
+          static_cast<size_t>(std::min<uint64_t>(size - headerSize, MAX_MOOV)));
+      moov.resize(device.readAt(at + headerSize, moov.data(), moov.size()));
+      for (size_t pos = 0; pos + 8 <= moov.size();)
+      {
+        uint32_t childSize = be32(moov.data() + pos);
+        const unsigned char *mvhd = moov.data() + pos + 8;
+        if (memcmp(moov.data() + pos + 4, "mvhd", 4) == 0 &&
+            childSize >= 40 && pos + childSize <= moov.size())
+        {
+          bool v1 = mvhd[0] == 1;
+          uint32_t timescale = be32(mvhd + (v1 ? 20 : 12));
+          uint64_t duration =
+              v1 ? uint64_t(be32(mvhd + 24)) << 32 | be32(mvhd + 28)
+                 : be32(mvhd + 16);
+          if (timescale > 0)
+            info.seconds = double(duration) / timescale;
+          break;
+        }
+        if (childSize < 8)
+          break;
+        pos += childSize;
+      }
+      break;
+    }
+    if (size == 0) // runs to the end of the device
+      break;
+    at += size;
+  }
+  return true;
+}
+
+#endif // MEDIAINFO_H
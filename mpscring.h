@@ -0,0 +1,81 @@
+#ifndef MPSCRING_H
+#define MPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Bounded lock-free queue for many producers and one consumer (D. Vyukov's
+// sequence-numbered ring). Producers claim a slot with one CAS on the tail;
+// each slot's sequence number tells the consumer when its value is ready
+// and tells producers when the consumer has freed it. `Capacity` must be a
+// power of two. Memory use is fixed: a full ring makes tryPush fail.
+template <class T, size_t Capacity>
+class MpscRing
+{
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+public:
+  MpscRing()
+  {
+    for (size_t i = 0; i < Capacity; ++i)
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  MpscRing(const MpscRing &) = delete;
+  MpscRing &operator=(const MpscRing &) = delete;
+
+  // Safe from any thread. Returns false when the ring is full.
+  bool tryPush(T value)
+  {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true)
+    {
+      cell = &cells[pos & (Capacity - 1)];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0)
+      {
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+          break;
+      }
+      else if (diff < 0)
+        return false; // the consumer has not freed this slot yet
+      else
+        pos = tail.load(std::memory_order_relaxed);
+    }
+    cell->value = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer thread only. Returns false when nothing is ready.
+  bool tryPop(T &value)
+  {
+    Cell &cell = cells[head & (Capacity - 1)];
+    size_t seq = cell.sequence.load(std::memory_order_acquire);
+    if (seq != head + 1)
+      return false;
+    value = std::move(cell.value);
+    cell.sequence.store(head + Capacity, std::memory_order_release);
+    head++;
+    return true;
+  }
+
+private:
+  struct Cell
+  {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  Cell cells[Capacity];
+  alignas(64) std::atomic<size_t> tail{0};
+  alignas(64) size_t head = 0;
+};
+
+#endif // MPSCRING_H
@@ -0,0 +1,421 @@
+#ifndef NTFS_H
+#define NTFS_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "deletedfile.h"
+#include "fsutil.h"
+#include "scanrange.h"
+
+using namespace std;
+
+// Reader for NTFS volumes. Cluster allocation lives in the $Bitmap system
+// file (MFT record 6), whose data runs are decoded from its MFT record.
+// Deleted files keep their MFT record (name, size, data runs or resident
+// data) until the record is reused, so reading only the $MFT finds them.
+class Ntfs
+{
+public:
+  // --- NTFS Constants ---
+  static const uint32_t ATTR_FILE_NAME = 0x30;
+  static const uint32_t ATTR_DATA = 0x80;
+  static const uint16_t RECORD_IN_USE = 0x0001;
+  static const uint16_t RECORD_DIRECTORY = 0x0002;
+  static const uint16_t ATTR_COMPRESSED = 0x0001;
+  static const uint16_t ATTR_ENCRYPTED = 0x4000;
+  static const uint32_t ATTR_END = 0xFFFFFFFF;
+  static const uint64_t MFT_RECORD_BITMAP = 6;
+
+  // One extent of a non-resident attribute: `length` clusters starting at
+  // `lcn`. Sparse runs have lcn == -1.
+  struct DataRun
+  {
+    int64_t lcn;
+    uint64_t length;
+  };
+
+  bool open(BlockReader &reader, uint64_t partitionOffset = 0)
+  {
+    base = partitionOffset;
+    device = &reader;
+
+    unsigned char boot[512];
+    if (!readAt(*device, base, boot, sizeof(boot)) ||
+        memcmp(boot + 3, "NTFS    ", 8) != 0)
+      return false;
+
+    uint32_t bytesPerSector = le16(boot + 0x0B);
+    uint8_t spc = boot[0x0D];
+    // Values above 0x80 encode a power of two for very large clusters; more
+    // than 2^12 sectors is no real volume, and would overflow the shift.
+    if (spc > 0x80 && 256 - spc > 12)
+      return false;
+    uint32_t sectorsPerCluster = spc > 0x80 ? 1u << (256 - spc) : spc;
+    if (bytesPerSector < 256 || bytesPerSector > 4096 ||
+        sectorsPerCluster == 0)
+      return false;
+    cluster_size = bytesPerSector * sectorsPerCluster;
+    total_clusters = le64(boot + 0x28) * bytesPerSector / cluster_size;
+    mft_lcn = le64(boot + 0x30);
+
+    // Negative: a power of two in bytes, checked before it is shifted.
+    int8_t recordSize = static_cast<int8_t>(boot[0x40]);
+    if (-recordSize > 16)
+      return false;
+    record_size = recordSize < 0 ? 1u << (-recordSize)
+                                 : static_cast<uint32_t>(recordSize) *
+                                       cluster_size;
+    if (record_size < 512 || record_size > 64 * 1024)
+      return false;
+
+    // Record 0 is $MFT itself; its $DATA runs locate every other record.
+    vector<unsigned char> record(record_size);
+    if (!readAt(*device, base + mft_lcn * cluster_size, record) ||
+        !applyFixups(record))
+      return false;
+    mft_runs = nonResidentRuns(record, ATTR_DATA);
+    return !mft_runs.empty();
+  }
+
+  uint32_t clusterSize() const { return cluster_size; }
+  uint64_t totalBytes() const { return total_clusters * cluster_size; }
+
+  // Reads $Bitmap and returns the clusters it marks free, as byte ranges.
+  vector<ScanRange> freeRanges(function<bool()> cancelCheck)
+  {
+    vector<ScanRange> ranges;
+    vector<unsigned char> record(record_size);
+    if (!readRecord(MFT_RECORD_BITMAP, record))
+      return ranges;
+    vector<DataRun> runs = nonResidentRuns(record, ATTR_DATA);
+
+    uint64_t cluster = 0, runStart = 0, runLength = 0;
+    vector<unsigned char> chunk(cluster_size);
+    for (const DataRun &run : runs)
+    {
+      for (uint64_t c = 0; c < run.length && cluster < total_clusters; ++c)
+      {
+        if (cancelCheck())
+          return ranges;
+        bool haveData = run.lcn >= 0 &&
+                        readAt(*device, base + (run.lcn + c) * cluster_size,
+                               chunk);
+        // Unreadable or sparse bitmap clusters are treated as "in use" so
+        // they are never mistaken for free space.
+        for (size_t bit = 0; bit < chunk.size() * 8 && cluster < total_clusters;
+             ++bit, ++cluster)
+        {
+          bool used = !haveData || ((chunk[bit >> 3] >> (bit & 7)) & 1);
+          if (!used)
+          {
+            if (runLength == 0)
+              runStart = cluster;
+            runLength++;
+          }
+          else if (runLength > 0)
+          {
+            addClusters(ranges, runStart, runLength);
+            runLength = 0;
+          }
+        }
+      }
+    }
+    if (runLength > 0)
+      addClusters(ranges, runStart, runLength);
+    return ranges;
+  }
+
+  // Reads the $MFT run by run and returns every deleted file record whose
+  // data is resident or whose clusters are all still free.
+  vector<DeletedFile> deletedFiles(function<bool()> cancelCheck)
+  {
+    vector<DeletedFile> files;
+    vector<unsigned char> record(record_size);
+    if (!readRecord(0, record))
+      return files;
+    const unsigned char *mftData = findAttribute(record, ATTR_DATA);
+    uint64_t recordCount = mftData ? le64(mftData + 0x30) / record_size : 0;
+    bitmap_runs.clear();
+    if (readRecord(MFT_RECORD_BITMAP, record))
+      bitmap_runs = nonResidentRuns(record, ATTR_DATA);
+
+    const uint64_t BATCH = 256; // records per read
+    vector<unsigned char> batch(BATCH * record_size);
+    uint64_t index = 0;
+    for (const DataRun &run : mft_runs)
+    {
+      uint64_t runRecords = run.length * cluster_size / record_size;
+      if (run.lcn < 0)
+      {
+        index += runRecords;
+        continue;
+      }
+      for (uint64_t r = 0; r < runRecords && index < recordCount; r += BATCH)
+      {
+        if (cancelCheck())
+          return files;
+        uint64_t count = min(BATCH, min(runRecords - r, recordCount - index));
+        batch.resize(count * record_size);
+        if (!readAt(*device,
+                    base + run.lcn * cluster_size + r * record_size, batch))
+        {
+          index += count;
+          continue;
+        }
+        for (uint64_t k = 0; k < count; ++k, ++index)
+        {
+          record.assign(batch.begin() + k * record_size,
+                        batch.begin() + (k + 1) * record_size);
+          DeletedFile file;
+          if (applyFixups(record) && decodeDeleted(record, file))
+          {
+            if (file.name.empty())
+              file.name = "record_" + to_string(index);
+            files.push_back(move(file));
+          }
+        }
+      }
+    }
+    return files;
+  }
+
+private:
+  bool decodeDeleted(const vector<unsigned char> &record, DeletedFile &file)
+  {
+    uint16_t flags = le16(&record[0x16]);
+    if ((flags & (RECORD_IN_USE | RECORD_DIRECTORY)) ||
+        le64(&record[0x20]) != 0) // extension records belong to a base record
+      return false;
+
+    file.name = fileName(record);
+    const unsigned char *data = findAttribute(record, ATTR_DATA);
+    if (!data)
+      return false;
+
+    if (data[8] == 0)
+    {
+      uint32_t valueLength = le32(data + 0x10);
+      uint16_t valueOffset = le16(data + 0x14);
+      if (valueLength == 0 ||
+          valueOffset + valueLength > le32(data + 4))
+        return false;
+      file.size = valueLength;
+      file.residentData.assign(data + valueOffset,
+                               data + valueOffset + valueLength);
+      return true;
+    }
+
+    if (le16(data + 0x0C) & (ATTR_COMPRESSED | ATTR_ENCRYPTED))
+      return false; // on-disk bytes are not the file content
+    file.size = le64(data + 0x30);
+    uint64_t logical = 0;
+    for (const DataRun &run : decodeRuns(data, le32(data + 4)))
+    {
+      uint64_t bytes = run.length * cluster_size;
+      if (run.lcn >= 0 && logical < file.size)
+      {
+        for (uint64_t c = 0; c < run.length; ++c)
+        {
+          if (!isClusterFree(run.lcn + c))
+            return false; // reallocated since the file was deleted
+        }
+        file.extents.push_back({logical, base + run.lcn * cluster_size,
+                                min(bytes, file.size - logical)});
+      }
+      logical += bytes;
+    }
+    return file.size > 0 && !file.extents.empty();
+  }
+
+  // Picks the long (Win32) name over the 8.3 DOS alias when both exist.
+  string fileName(const vector<unsigned char> &record)
+  {
+    string name;
+    size_t pos = le16(&record[0x14]);
+    while (pos + 16 <= record.size())
+    {
+      uint32_t attrType = le32(&record[pos]);
+      uint32_t attrLength = le32(&record[pos + 4]);
+      if (attrType == ATTR_END || attrLength < 16 ||
+          pos + attrLength > record.size())
+        break;
+      // A resident attribute's header runs to 0x18; the name's length and
+      // namespace sit at 0x40 and 0x41 of the value.
+      if (attrType == ATTR_FILE_NAME && record[pos + 8] == 0 &&
+          attrLength >= 0x18 &&
+          le16(&record[pos + 0x14]) + 0x42u <= attrLength)
+      {
+        const unsigned char *value = &record[pos + le16(&record[pos + 0x14])];
+        uint8_t length = value[0x40];
+        uint8_t nameSpace = value[0x41];
+        if (value + 0x42 + length * 2 <= record.data() + pos + attrLength &&
+            (name.empty() || nameSpace != 2))
+          name = utf16leToUtf8(value + 0x42, length);
+      }
+      pos += attrLength;
+    }
+    return name;
+  }
+
+  bool isClusterFree(uint64_t lcn)
+  {
+    if (lcn >= total_clusters)
+      return false;
+    uint64_t bitsPerPage = static_cast<uint64_t>(cluster_size) * 8;
+    uint64_t page = lcn / bitsPerPage;
+    auto it = bitmap_cache.find(page);
+    if (it == bitmap_cache.end())
+    {
+      vector<unsigned char> bits(cluster_size, 0xFF);
+      uint64_t vcn = page;
+      for (const DataRun &run : bitmap_runs)
+      {
+        if (vcn < run.length)
+        {
+          if (run.lcn >= 0 &&
+              !readAt(*device, base + (run.lcn + vcn) * cluster_size, bits))
+            bits.assign(cluster_size, 0xFF);
+          break;
+        }
+        vcn -= run.length;
+      }
+      it = bitmap_cache.emplace(page, move(bits)).first;
+    }
+    uint64_t bit = lcn % bitsPerPage;
+    return !((it->second[bit >> 3] >> (bit & 7)) & 1);
+  }
+
+  // Undoes the update sequence array: the last two bytes of every 512-byte
+  // stride were swapped out for a check value when the record was written.
+  bool applyFixups(vector<unsigned char> &record)
+  {
+    if (memcmp(record.data(), "FILE", 4) != 0)
+      return false;
+    uint16_t usaOffset = le16(&record[4]);
+    uint16_t usaCount = le16(&record[6]);
+    if (usaCount == 0 || usaOffset + usaCount * 2u > record.size() ||
+        (usaCount - 1) * 512u > record.size())
+      return false;
+    const unsigned char *usa = &record[usaOffset];
+    for (uint16_t i = 1; i < usaCount; ++i)
+    {
+      unsigned char *tail = &record[i * 512 - 2];
+      if (tail[0] != usa[0] || tail[1] != usa[1])
+        return false; // torn write
+      tail[0] = usa[i * 2];
+      tail[1] = usa[i * 2 + 1];
+    }
+    return true;
+  }
+
+  // Locates MFT record `index` through the $MFT data runs.
+  bool readRecord(uint64_t index, vector<unsigned char> &record)
+  {
+    uint64_t byteOffset = index * record_size;
+    for (const DataRun &run : mft_runs)
+    {
+      uint64_t runBytes = run.length * cluster_size;
+      if (byteOffset < runBytes)
+      {
+        if (run.lcn < 0)
+          return false;
+        return readAt(*device, base + run.lcn * cluster_size + byteOffset,
+                      record) &&
+               applyFixups(record);
+      }
+      byteOffset -= runBytes;
+    }
+    return false;
+  }
+
+  // Returns a pointer to the first unnamed attribute of `type`, or nullptr.
+  const unsigned char *findAttribute(const vector<unsigned char> &record,
+                                     uint32_t type)
+  {
+    size_t pos = le16(&record[0x14]);
+    while (pos + 16 <= record.size())
+    {
+      uint32_t attrType = le32(&record[pos]);
+      uint32_t attrLength = le32(&record[pos + 4]);
+      if (attrType == ATTR_END || attrLength < 16 ||
+          pos + attrLength > record.size())
+        break;
+      if (attrType == type && record[pos + 9] == 0)
+        return &record[pos];
+      pos += attrLength;
+    }
+    return nullptr;
+  }
+
+  // Decodes the mapping pairs of a non-resident attribute.
+  vector<DataRun> decodeRuns(const unsigned char *attr, size_t attrLength)
+  {
+    vector<DataRun> runs;
+    size_t pos = le16(attr + 0x20);
+    int64_t lcn = 0;
+    while (pos < attrLength && attr[pos] != 0)
+    {
+      uint8_t lengthSize = attr[pos] & 0x0F;
+      uint8_t offsetSize = attr[pos] >> 4;
+      pos++;
+      if (lengthSize == 0 || lengthSize > 8 || offsetSize > 8 ||
+          pos + lengthSize + offsetSize > attrLength)
+        break;
+      uint64_t length = 0;
+      for (uint8_t i = 0; i < lengthSize; ++i)
+        length |= static_cast<uint64_t>(attr[pos + i]) << (8 * i);
+      pos += lengthSize;
+      if (offsetSize == 0)
+      {
+        runs.push_back({-1, length});
+        continue;
+      }
+      int64_t delta = 0;
+      for (uint8_t i = 0; i < offsetSize; ++i)
+        delta |= static_cast<int64_t>(attr[pos + i]) << (8 * i);
+      if (offsetSize < 8 && (attr[pos + offsetSize - 1] & 0x80)) // sign-extend
+        delta -= static_cast<int64_t>(1) << (8 * offsetSize);
+      pos += offsetSize;
+      lcn += delta;
+      runs.push_back({lcn, length});
+    }
+    return runs;
+  }
+
+  vector<DataRun> nonResidentRuns(const vector<unsigned char> &record,
+                                  uint32_t type)
+  {
+    const unsigned char *attr = findAttribute(record, type);
+    if (!attr || attr[8] == 0)
+      return {};
+    return decodeRuns(attr, le32(attr + 4));
+  }
+
+  void addClusters(vector<ScanRange> &ranges, uint64_t firstCluster,
+                   uint64_t count)
+  {
+    size_t start = base + firstCluster * cluster_size;
+    size_t length = count * cluster_size;
+    if (!ranges.empty() && ranges.back().end() == start)
+      ranges.back().length += length;
+    else
+      ranges.push_back({start, length});
+  }
+
+  BlockReader *device = nullptr;
+  uint64_t base = 0;
+  uint32_t cluster_size = 0;
+  uint32_t record_size = 0;
+  uint64_t total_clusters = 0;
+  uint64_t mft_lcn = 0;
+  vector<DataRun> mft_runs;
+  vector<DataRun> bitmap_runs;
+  map<uint64_t, vector<unsigned char>> bitmap_cache;
+};
+
+#endif // NTFS_H
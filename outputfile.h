@@ -0,0 +1,43 @@
+#ifndef OUTPUTFILE_H
+#define OUTPUTFILE_H
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <string>
+
+// Creates `dir/stem + extension` without replacing anything. When the name
+// is taken (an earlier run, or another engine writing to the same
+// directory), "_1", "_2", ... is added to the stem. The file is created here
+// with O_EXCL, so two threads or processes never get the same name. Returns
+// the path, or an empty string when nothing could be created.
+inline std::string claimOutputFile(const std::string &dir,
+                                   const std::string &stem,
+                                   const std::string &extension)
+{
+  for (int n = 0; n < 10000; ++n)
+  {
+    std::string path = dir + "/" + stem +
+                       (n > 0 ? "_" + std::to_string(n) : "") + extension;
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd >= 0)
+    {
+      close(fd);
+      return path;
+    }
+    if (errno != EEXIST)
+      return "";
+  }
+  return "";
+}
+
+// Stem for a file carved at device offset `offset`. Offsets are unique per
+// device, so no counter has to be shared between scanning threads.
+inline std::string carvedFileStem(uint64_t offset)
+{
+  return "RecoveredFile_" + std::to_string(offset);
+}
+
+#endif // OUTPUTFILE_H
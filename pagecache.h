@@ -0,0 +1,117 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "imagereaders.h"
+
+// --- Page cache ---
+// Random reads from a device for viewers (the GUI hex view). Nothing is read
+// up front: reads go through at most `capacity` PAGE_SIZE pages, fetched on
+// first use and dropped least recently used first. Memory stays at
+// PAGE_SIZE * capacity however large the device, and a view scrolled back
+// and forth is served from the cache instead of the disk.
+class PageCache : public BlockReader
+{
+public:
+  static constexpr size_t PAGE_SIZE = 16 * 1024;
+  static constexpr size_t DEFAULT_CAPACITY = 64; // 1 MB
+
+  PageCache(std::unique_ptr<BlockReader> source, uint64_t size,
+            size_t capacity = DEFAULT_CAPACITY)
+      : device(std::move(source)), length(size),
+        capacity(std::max<size_t>(1, capacity))
+  {
+  }
+
+  // Opens a device or any image openImage() reads, with pread. Raw devices
+  // open at once; compressed images are indexed first. Null with `error` set
+  // on failure; a damaged image opens with `error` set to say so.
+  static std::unique_ptr<PageCache> open(const std::string &path,
+                                         std::string &error,
+                                         size_t capacity = DEFAULT_CAPACITY)
+  {
+    uint64_t size = 0;
+    std::unique_ptr<BlockReader> reader =
+        openImage(path, detectImageFormat(path), IoBackend::Pread, size, error);
+    if (!reader)
+      return nullptr;
+    return std::unique_ptr<PageCache>(
+        new PageCache(std::move(reader), size, capacity));
+  }
+
+  uint64_t size() const { return length; }
+
+  size_t readAt(uint64_t offset, unsigned char *dest, size_t size) override
+  {
+    size_t done = 0;
+    while (done < size && offset + done < length)
+    {
+      uint64_t at = offset + done;
+      Page page = loadPage(at / PAGE_SIZE);
+      size_t within = at % PAGE_SIZE;
+      if (!page || within >= page->size())
+        break;
+      size_t n = std::min(size - done, page->size() - within);
+      memcpy(dest + done, page->data() + within, n);
+      done += n;
+    }
+    return done;
+  }
+
+private:
+  using Page = std::shared_ptr<const std::vector<unsigned char>>;
+
+  // The device is read without the lock, so a slow read does not hold up
+  // hits on other pages; two readers of one missing page both read it.
+  Page loadPage(uint64_t index)
+  {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      auto it = cache.find(index);
+      if (it != cache.end())
+      {
+        lru.splice(lru.begin(), lru, it->second.second);
+        return it->second.first;
+      }
+    }
+
+    uint64_t start = index * PAGE_SIZE;
+    auto data = std::make_shared<std::vector<unsigned char>>(
+        std::min<uint64_t>(PAGE_SIZE, length - start));
+    data->resize(device->readAt(start, data->data(), data->size()));
+    if (data->empty())
+      return nullptr;
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (!cache.count(index))
+    {
+      lru.push_front(index);
+      cache[index] = {data, lru.begin()};
+      if (cache.size() > capacity)
+      {
+        cache.erase(lru.back());
+        lru.pop_back();
+      }
+    }
+    return data;
+  }
+
+  std::unique_ptr<BlockReader> device;
+  uint64_t length;
+  size_t capacity;
+
+  std::mutex lock;         // guards the cache
+  std::list<uint64_t> lru; // cached page numbers, most recent first
+  std::unordered_map<uint64_t, std::pair<Page, std::list<uint64_t>::iterator>>
+      cache;
+};
+
+#endif // PAGECACHE_H
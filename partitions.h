@@ -0,0 +1,93 @@
+#ifndef PARTITIONS_H
+#define PARTITIONS_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fsutil.h"
+
+using namespace std;
+
+// A partition found in the MBR or GPT of a whole-disk device, in bytes.
+struct Partition
+{
+  uint64_t offset;
+  uint64_t length;
+};
+
+// Lists the partitions of a whole-disk device (e.g. /dev/sda) so filesystem
+// readers can be pointed at each one. Returns an empty list when the device
+// has no recognisable partition table.
+inline vector<Partition> readPartitionTable(BlockReader &device)
+{
+  const uint32_t SECTOR = 512;
+  vector<Partition> parts;
+  unsigned char mbr[512];
+  if (!readAt(device, 0, mbr, sizeof(mbr)) || mbr[510] != 0x55 ||
+      mbr[511] != 0xAA)
+    return parts;
+
+  // A protective MBR entry (type 0xEE) means the real table is the GPT.
+  if (mbr[446 + 4] == 0xEE)
+  {
+    unsigned char header[92];
+    if (!readAt(device, SECTOR, header, sizeof(header)) ||
+        memcmp(header, "EFI PART", 8) != 0)
+      return parts;
+    uint64_t entryLba = le64(header + 72);
+    uint32_t entryCount = le32(header + 80);
+    uint32_t entrySize = le32(header + 84);
+    if (entrySize < 128 || entryCount > 1024)
+      return parts;
+    vector<unsigned char> entries(static_cast<size_t>(entryCount) * entrySize);
+    if (!readAt(device, entryLba * SECTOR, entries))
+      return parts;
+    static const unsigned char unused[16] = {0};
+    for (uint32_t i = 0; i < entryCount; ++i)
+    {
+      const unsigned char *e = &entries[static_cast<size_t>(i) * entrySize];
+      if (memcmp(e, unused, 16) == 0)
+        continue;
+      uint64_t first = le64(e + 32), last = le64(e + 40);
+      if (last >= first)
+        parts.push_back({first * SECTOR, (last - first + 1) * SECTOR});
+    }
+    return parts;
+  }
+
+  for (int i = 0; i < 4; ++i)
+  {
+    const unsigned char *e = mbr + 446 + i * 16;
+    uint8_t type = e[4];
+    uint64_t start = le32(e + 8), count = le32(e + 12);
+    if (type == 0 || count == 0 || (e[0] & 0x7F) != 0)
+      continue;
+    if (type == 0x05 || type == 0x0F || type == 0x85)
+    {
+      // Extended partition: follow the chain of extended boot records.
+      uint64_t ebrLba = start;
+      for (int guard = 0; guard < 128; ++guard)
+      {
+        unsigned char ebr[512];
+        if (!readAt(device, ebrLba * SECTOR, ebr, sizeof(ebr)) ||
+            ebr[510] != 0x55 || ebr[511] != 0xAA)
+          break;
+        const unsigned char *logical = ebr + 446;
+        const unsigned char *next = ebr + 446 + 16;
+        if (logical[4] != 0 && le32(logical + 12) != 0)
+          parts.push_back({(ebrLba + le32(logical + 8)) * SECTOR,
+                           static_cast<uint64_t>(le32(logical + 12)) * SECTOR});
+        if (next[4] == 0 || le32(next + 8) == 0)
+          break;
+        ebrLba = start + le32(next + 8);
+      }
+      continue;
+    }
+    parts.push_back({start * SECTOR, count * SECTOR});
+  }
+  return parts;
+}
+
+#endif // PARTITIONS_H
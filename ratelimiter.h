@@ -0,0 +1,438 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "blockreader.h"
+#include "iotuning.h"
+
+// --- Token bucket ---
+// Refills at `rate` tokens per second up to `burst`. acquire() blocks until
+// enough tokens are there. The rate may change at any time; a waiting thread
+// sees the new rate within one poll interval. Rate 0 means unlimited.
+class TokenBucket
+{
+public:
+  explicit TokenBucket(double rate = 0, double burst = 0)
+  {
+    setRate(rate, burst);
+  }
+
+  // `burst` 0 keeps a quarter second's worth.
+  void setRate(double newRate, double newBurst = 0)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    refill();
+    rate = std::max(0.0, newRate);
+    burst = newBurst > 0 ? newBurst : rate / 4;
+    tokens = std::min(tokens, burst);
+  }
+
+  double currentRate() const
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return rate;
+  }
+
+  // Takes `count` tokens. A request larger than the burst waits for a full
+  // bucket and then leaves it in debt, so any size eventually goes through.
+  void acquire(double count)
+  {
+    taken.fetch_add(static_cast<uint64_t>(count), std::memory_order_relaxed);
+    while (true)
+    {
+      double wait;
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        if (rate <= 0)
+          return;
+        refill();
+        double needed = std::min(count, burst);
+        if (tokens >= needed)
+        {
+          tokens -= count;
+          return;
+        }
+        wait = (needed - tokens) / rate;
+      }
+      std::this_thread::sleep_for(std::chrono::duration<double>(
+          std::min(wait, MAX_POLL_SECONDS)));
+    }
+  }
+
+  // Tokens taken so far, limited or not.
+  uint64_t consumed() const { return taken.load(std::memory_order_relaxed); }
+
+private:
+  static constexpr double MAX_POLL_SECONDS = 0.05;
+
+  void refill()
+  {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - last).count();
+    last = now;
+    tokens = std::min(burst, tokens + elapsed * rate);
+  }
+
+  mutable std::mutex lock;
+  double rate = 0;
+  double burst = 0;
+  double tokens = 0;
+  std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+  std::atomic<uint64_t> taken{0};
+};
+
+// --- Idle-only reads ---
+// Holds reads back while anything else is using the disk. The disk's sysfs
+// stat is sampled every POLL; the sectors it moved beyond what this gate's
+// own reads account for (with SLACK, and a quarter more for the kernel's
+// read-ahead) are someone else's traffic, and after an interval with any,
+// reads wait for a quiet one. Carved files written to the same disk count as
+// someone else, so idle-only scans want their output on another disk.
+class IdleGate
+{
+public:
+  static constexpr std::chrono::milliseconds POLL{100};
+  static constexpr uint64_t SLACK = 512 * 1024;
+
+  // Null when the disk's statistics cannot be read. A waiting read gives up
+  // waiting once `cancelCheck` says so.
+  static std::shared_ptr<IdleGate> open(const std::string &devicePath,
+                                        std::function<bool()> cancelCheck)
+  {
+    std::string disk = sysfsDiskDirectory(devicePath);
+    if (disk.empty())
+      return nullptr;
+    std::shared_ptr<IdleGate> gate(new IdleGate(disk + "/stat", cancelCheck));
+    if (!gate->readSectors(gate->lastSectors))
+      return nullptr;
+    return gate;
+  }
+
+  void wait()
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+      auto now = std::chrono::steady_clock::now();
+      if (now - lastSample >= POLL)
+        sample(now);
+      if (!busy || (cancelCheck && cancelCheck()))
+        return;
+      guard.unlock();
+      std::this_thread::sleep_for(POLL);
+      guard.lock();
+    }
+  }
+
+  // Bytes a read through the gate has just fetched.
+  void account(uint64_t bytes)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    ownBytes += bytes;
+  }
+
+private:
+  IdleGate(const std::string &statPath, std::function<bool()> cancelCheck)
+      : statPath(statPath), cancelCheck(cancelCheck) {}
+
+  // Sectors read plus sectors written (fields 3 and 7).
+  bool readSectors(uint64_t &sectors) const
+  {
+    std::ifstream in(statPath);
+    uint64_t field[7];
+    for (uint64_t &f : field)
+      if (!(in >> f))
+        return false;
+    sectors = field[2] + field[6];
+    return true;
+  }
+
+  void sample(std::chrono::steady_clock::time_point now)
+  {
+    uint64_t sectors;
+    if (!readSectors(sectors))
+    {
+      busy = false;
+      return;
+    }
+    uint64_t moved = (sectors - lastSectors) * 512;
+    busy = moved > ownBytes + ownBytes / 4 + SLACK;
+    lastSectors = sectors;
+    ownBytes = 0;
+    lastSample = now;
+  }
+
+  std::string statPath;
+  std::function<bool()> cancelCheck;
+  std::mutex lock;
+  std::chrono::steady_clock::time_point lastSample =
+      std::chrono::steady_clock::now();
+  uint64_t lastSectors = 0;
+  uint64_t ownBytes = 0;
+  bool busy = false;
+};
+
+// Charges every read to a bucket of bytes per second and, when given, one of
+// reads per second, after waiting for the disk to go idle when there is an
+// idle gate. Any of them may be null.
+class ThrottledReader : public BlockReader
+{
+public:
+  ThrottledReader(std::unique_ptr<BlockReader> inner,
+                  std::shared_ptr<TokenBucket> bytes,
+                  std::shared_ptr<TokenBucket> reads = nullptr,
+                  std::shared_ptr<IdleGate> idle = nullptr)
+      : inner(std::move(inner)), bytes(std::move(bytes)),
+        reads(std::move(reads)), idle(std::move(idle)) {}
+
+  size_t readAt(uint64_t offset, unsigned char *dest, size_t size) override
+  {
+    if (idle)
+      idle->wait();
+    if (reads)
+      reads->acquire(1);
+    if (bytes)
+      bytes->acquire(size);
+    size_t done = inner->readAt(offset, dest, size);
+    if (idle)
+      idle->account(done);
+    return done;
+  }
+
+  // Read-ahead would get around the limits, so it only goes through while
+  // none applies.
+  void prefetch(uint64_t offset, size_t size) override
+  {
+    if (!limiting())
+      inner->prefetch(offset, size);
+  }
+
+  bool limiting() const
+  {
+    return idle || (bytes && bytes->currentRate() > 0) ||
+           (reads && reads->currentRate() > 0);
+  }
+
+private:
+  std::unique_ptr<BlockReader> inner;
+  std::shared_ptr<TokenBucket> bytes;
+  std::shared_ptr<TokenBucket> reads;
+  std::shared_ptr<IdleGate> idle;
+};
+
+// --- Fair-share bandwidth ---
+// Splits a read budget between devices scanned at the same time (max-min
+// fairness). Each rebalance() gives every device an equal share of the
+// total, but a device that did not use its share last interval (a slow disk
+// that cannot keep up) gets only what it used plus headroom, and the rest
+// goes to the others. A fast NVMe therefore cannot take bandwidth that the
+// SATA disks need, and bandwidth they cannot use is not wasted.
+class BandwidthScheduler
+{
+public:
+  // Bytes per second over all devices; 0 is unlimited.
+  void setTotal(double bytesPerSecond)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    total = bytesPerSecond;
+  }
+
+  // Bytes per second for any single device; 0 is unlimited.
+  void setDeviceCap(double bytesPerSecond)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    cap = bytesPerSecond;
+  }
+
+  std::shared_ptr<TokenBucket> addDevice()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    devices.push_back({std::make_shared<TokenBucket>(), 0, 0, true});
+    apply();
+    return devices.back().bucket;
+  }
+
+  // A finished device gives its share back.
+  void removeDevice(const std::shared_ptr<TokenBucket> &bucket)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for (Device &d : devices)
+      if (d.bucket == bucket)
+        d.active = false;
+    apply();
+  }
+
+  // Recomputes the shares from what each device read over the last
+  // `seconds`.
+  void rebalance(double seconds)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for (Device &d : devices)
+    {
+      uint64_t consumed = d.bucket->consumed();
+      d.lastRate = seconds > 0 ? (consumed - d.lastConsumed) / seconds : 0;
+      d.lastConsumed = consumed;
+    }
+    apply();
+  }
+
+private:
+  struct Device
+  {
+    std::shared_ptr<TokenBucket> bucket;
+    uint64_t lastConsumed;
+    double lastRate; // bytes per second read in the last interval
+    bool active;
+  };
+
+  // A device that used nearly all of its share may want more; any other
+  // wants what it used, with room to grow.
+  double demand(const Device &d) const
+  {
+    double share = d.bucket->currentRate();
+    if (share <= 0 || d.lastRate >= share * 0.9)
+      return std::numeric_limits<double>::infinity();
+    return std::max(d.lastRate * 1.25, MIN_SHARE);
+  }
+
+  void apply()
+  {
+    std::vector<Device *> active;
+    for (Device &d : devices)
+      if (d.active)
+        active.push_back(&d);
+    if (total <= 0)
+    {
+      for (Device *d : active)
+        d->bucket->setRate(cap);
+      return;
+    }
+
+    // Water-filling: serve the smallest demands first, then split what is
+    // left evenly between the rest.
+    std::vector<std::pair<double, Device *>> byDemand;
+    for (Device *d : active)
+      byDemand.push_back({demand(*d), d});
+    std::sort(byDemand.begin(), byDemand.end(),
+              [](const std::pair<double, Device *> &a,
+                 const std::pair<double, Device *> &b)
+              { return a.first < b.first; });
+    double remaining = total;
+    size_t left = byDemand.size();
+    for (auto &entry : byDemand)
+    {
+      double share = remaining / left--;
+      if (cap > 0)
+        share = std::min(share, cap);
+      share = std::min(share, entry.first);
+      entry.second->bucket->setRate(share);
+      remaining -= share;
+    }
+  }
+
+  static constexpr double MIN_SHARE = 1024 * 1024; // bytes per second
+
+  std::mutex lock;
+  double total = 0;
+  double cap = 0;
+  std::vector<Device> devices;
+};
+
+// --- I/O priority ---
+// The kernel's I/O scheduling class (ioprio_set(2)) for the calling thread;
+// threads it starts afterwards inherit it. Only the BFQ and mq-deadline
+// schedulers act on it, and the real-time class needs CAP_SYS_ADMIN. The
+// classes are numbered as the kernel numbers them.
+enum class IoClass
+{
+  None, // the CPU nice level decides
+  RealTime,
+  BestEffort,
+  Idle // served only when no other class wants the disk
+};
+
+struct IoPriority
+{
+  IoClass ioClass = IoClass::None;
+  int level = 4; // 0 (highest) to 7, for RealTime and BestEffort
+};
+
+// "idle", "be", "be:7", "rt:0" or "none"; false for anything else.
+inline bool parseIoPriority(const std::string &text, IoPriority &priority)
+{
+  std::string name = text.substr(0, text.find(':'));
+  IoPriority parsed;
+  if (name == "none")
+    parsed.ioClass = IoClass::None;
+  else if (name == "rt")
+    parsed.ioClass = IoClass::RealTime;
+  else if (name == "be")
+    parsed.ioClass = IoClass::BestEffort;
+  else if (name == "idle")
+    parsed.ioClass = IoClass::Idle;
+  else
+    return false;
+  if (name.size() < text.size())
+  {
+    std::string level = text.substr(name.size() + 1);
+    if (level.size() != 1 || level[0] < '0' || level[0] > '7' ||
+        parsed.ioClass == IoClass::None || parsed.ioClass == IoClass::Idle)
+      return false;
+    parsed.level = level[0] - '0';
+  }
+  priority = parsed;
+  return true;
+}
+
+inline std::string ioPriorityName(const IoPriority &priority)
+{
+  switch (priority.ioClass)
+  {
+  case IoClass::RealTime:
+    return "rt:" + std::to_string(priority.level);
+  case IoClass::BestEffort:
+    return "be:" + std::to_string(priority.level);
+  case IoClass::Idle:
+    return "idle";
+  default:
+    return "none";
+  }
+}
+
+// Sets the calling thread's priority, returning the one it had in
+// `previous` (when given). False when the kernel refuses.
+inline bool setIoPriority(const IoPriority &priority,
+                          IoPriority *previous = nullptr)
+{
+  const int WHO_PROCESS = 1, CLASS_SHIFT = 13; // linux/ioprio.h
+  if (previous)
+  {
+    long value = syscall(SYS_ioprio_get, WHO_PROCESS, 0);
+    if (value >= 0)
+    {
+      previous->ioClass = static_cast<IoClass>(value >> CLASS_SHIFT);
+      previous->level = static_cast<int>(value & 7);
+    }
+  }
+  long value = static_cast<long>(priority.ioClass) << CLASS_SHIFT;
+  if (priority.ioClass != IoClass::None)
+    value |= priority.level;
+  return syscall(SYS_ioprio_set, WHO_PROCESS, 0, value) == 0;
+}
+
+#endif // RATELIMITER_H
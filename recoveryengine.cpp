@@ -1,331 +1,1524 @@
 #include "recoveryengine.h"
 
-#include <QString>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cstdint>
+#include <cstring>
+#include <ctime>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "Mp3.h"
+#include "blockreader.h"
+#include "carvepool.h"
+#include "ext4.h"
+#include "fat.h"
+#include "formats.h"
+#include "imagereaders.h"
 #include "mp4.h"
+#include "outputfile.h"
+#include "ntfs.h"
+#include "partitions.h"
+#include "ratelimiter.h"
+#include "zeroblock.h"
 
 using namespace std;
 namespace fs = std::filesystem;
 
-static const vector<unsigned char> PNG_SIGNATURE = {0x89, 0x50, 0x4E, 0x47,
-                                                    0x0D, 0x0A, 0x1A, 0x0A};
-static const vector<unsigned char> PNG_IEND = {
-    0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4E, 0x44, 0xAE, 0x42, 0x60, 0x82};
-static const vector<unsigned char> JPEG_SIGNATURE = {0xFF, 0xD8, 0xFF};
-static const vector<unsigned char> JPEG_END = {0xFF, 0xD9};
-static const vector<unsigned char> PDF_SIGNATURE = {0x25, 0x50, 0x44, 0x46,
-                                                    0x2D};
-static const vector<unsigned char> PDF_END = {0x25, 0x25, 0x45, 0x4F, 0x46};
-static const vector<unsigned char> ZIP_SIGNATURE = {0x50, 0x4B, 0x03, 0x04};
-static const vector<unsigned char> ZIP_END = {0x50, 0x4B, 0x05, 0x06};
-static const vector<unsigned char> MP3_SIG = {0xFF, 0xE0};
-static const vector<unsigned char> MP3_END = {0x00};
-static const vector<unsigned char> DOC_SIGNATURE = {0xD0, 0xCF, 0x11, 0xE0,
-                                                    0xA1, 0xB1, 0x1A, 0xE1};
-static const vector<unsigned char> DOCX_SIGNATURE = {0x50, 0x4B, 0x03, 0x04};
-static const vector<unsigned char> MP4_SIGNATURE = {0x00, 0x00, 0x00, 0x00,
-                                                    0x66, 0x74, 0x79, 0x70};
-static const vector<unsigned char> EXE_SIGNATURE = {0x4D, 0x5A};
-static const vector<unsigned char> ELF_SIGNATURE = {0x7F, 0x45, 0x4C, 0x46};
-static const vector<unsigned char> GENERIC_END = {0x00};
-
-static const vector<vector<unsigned char>> SIGNATURES = {
-    PNG_SIGNATURE, JPEG_SIGNATURE, PDF_SIGNATURE, ZIP_SIGNATURE, MP3_SIG,
-    DOC_SIGNATURE, DOCX_SIGNATURE, MP4_SIGNATURE, EXE_SIGNATURE, ELF_SIGNATURE};
-vector<int> File_Count = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-static const vector<vector<unsigned char>> END_MARKERS = {
-    PNG_IEND, JPEG_END, PDF_END, ZIP_END, MP3_END,
-    GENERIC_END, GENERIC_END, GENERIC_END, GENERIC_END, GENERIC_END};
-
-static const vector<string> FILE_EXTENSIONS = {".png", ".jpg", ".pdf", ".zip",
-                                               ".mp3", ".doc", ".docx", ".mp4",
-                                               ".exe", ".elf"};
-
-static const vector<string> FILE_NAMES = {"PNG", "JPEG", "PDF", "ZIP", "MP3",
-                                          "DOC", "DOCX", "MP4", "EXE", "ELF"};
-
-static const vector<pair<int, int>> Size_limit = {
-    {512 * 2, 20 * 1024 * 1024}, {512 * 2, 20 * 1024 * 1024}, {1024, 50 * 1024 * 1024}, {1024, 100 * 1024 * 1024}, {1024, 20 * 1024 * 1024}, {1024, 50 * 1024 * 1024}, {1024, 50 * 1024 * 1024}, {1024, 500 * 1024 * 1024}, {1024, 50 * 1024 * 1024}, {1024, 50 * 1024 * 1024}};
-
-static const int SupportedFileCount = 5;
-
-RecoveryEngine::RecoveryEngine(const QString &inputDevice,
-                               const QString &outputDir,
+static_assert(FORMAT_COUNT == metric::FORMATS,
+              "scanmetrics.h counts one slot per registered format");
+
+// Bytes matched at a time. Reads are larger (IoTuner picks their size) but
+// are matched a chunk at a time, so what is found never depends on how the
+// device was read.
+static const size_t CHUNK_SIZE = 4096;
+// A carved candidate's header is checked once this much of it is staged;
+// larger APPn or metadata blocks are taken on trust.
+static const size_t VALIDATE_BYTES = 64 * 1024;
+// Past this, a staged candidate goes to its output file unconfirmed.
+static const size_t STAGE_LIMIT = 4 * 1024 * 1024;
+// Bytes a catalog scan looks at to check and describe a candidate's header.
+static const size_t HEADER_BYTES = 1024;
+
+int RecoveryEngine::formatIndex(const string &name)
+{
+  string upper;
+  for (char c : name)
+    upper += toupper(static_cast<unsigned char>(c));
+  if (upper == "JPG")
+    upper = "JPEG";
+  for (size_t i = 0; i < FORMAT_COUNT; ++i)
+    if (upper == Formats::info[i].name)
+      return i;
+  return -1;
+}
+
+string RecoveryEngine::formatName(int index)
+{
+  if (index < 0 || index >= static_cast<int>(FORMAT_COUNT))
+    return "";
+  return Formats::info[index].name;
+}
+
+size_t RecoveryEngine::signatureLength(int index)
+{
+  if (index < 0 || index >= static_cast<int>(FORMAT_COUNT))
+    return 0;
+  return Formats::signatureSize[index];
+}
+
+// Format index for an output name's extension, or -1.
+static int formatFromExtension(const string &path)
+{
+  string extension = fs::path(path).extension().string();
+  for (size_t i = 0; i < FORMAT_COUNT; ++i)
+    if (extension == Formats::info[i].extension)
+      return i;
+  return -1;
+}
+
+static ScanEvent candidateEvent(uint64_t offset, int formatIndex)
+{
+  ScanEvent event;
+  event.type = ScanEvent::CandidateFound;
+  event.offset = offset;
+  event.format = formatIndex;
+  return event;
+}
+
+static ScanEvent progressEvent(int percent)
+{
+  ScanEvent event;
+  event.type = ScanEvent::Progress;
+  event.percent = percent;
+  return event;
+}
+
+string describeEvent(const ScanEvent &event)
+{
+  string format = RecoveryEngine::formatName(event.format);
+  switch (event.type)
+  {
+  case ScanEvent::CandidateFound:
+    return "[?] " + format + " signature at offset " + to_string(event.offset);
+  case ScanEvent::FileCarved:
+    return "[OK] Recovered: " + event.path + " (" +
+           to_string(event.length / 1024) + " KB, confidence " +
+           to_string(static_cast<int>(event.confidence * 100 + 0.5f)) +
+           "%, " + integrityName(event.integrity) + ")";
+  case ScanEvent::CandidateRejected:
+    return "[SKIP] " + format + " at offset " + to_string(event.offset) +
+           ": " + rejectReasonName(event.reason) + " (" +
+           to_string(event.length) + " bytes)";
+  case ScanEvent::IoError:
+    return "Error: " + event.message;
+  case ScanEvent::Progress:
+    return "Progress: " + to_string(event.percent) + "%";
+  default:
+    return event.message;
+  }
+}
+
+RecoveryEngine::RecoveryEngine(const string &inputDevice,
+                               const string &outputDir,
                                const std::vector<bool> &formats)
     : inputDevicePath(inputDevice),
       outputDirectory(outputDir),
       File_Supported(formats) {}
 
-bool RecoveryEngine::matchesSignature(const vector<unsigned char> &buffer,
-                                      size_t pos,
-                                      const vector<unsigned char> &signature,
-                                      const int formatIndex)
+// Image files may be sparse; holes read back as zeros and can be skipped
+// without touching the disk. Returns the start of the next data region at or
+// after `offset`, or `limit` when only a hole remains. Block devices and
+// filesystems without SEEK_DATA support report everything as data.
+static size_t nextDataOffset(int fd, size_t offset, size_t limit)
+{
+#ifdef SEEK_DATA
+  if (fd < 0)
+    return offset;
+  off_t data = lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+  if (data < 0)
+    return errno == ENXIO ? limit : offset;
+  return min(static_cast<size_t>(data), limit);
+#else
+  return offset;
+#endif
+}
+
+static size_t nextHoleOffset(int fd, size_t offset, size_t limit)
+{
+#ifdef SEEK_HOLE
+  if (fd < 0)
+    return limit;
+  off_t hole = lseek(fd, static_cast<off_t>(offset), SEEK_HOLE);
+  if (hole < 0)
+    return limit;
+  return min(static_cast<size_t>(hole), limit);
+#else
+  return limit;
+#endif
+}
+
+// Looks for a supported filesystem at `offset` of a `deviceSize` byte device
+// and, when one is found, fills `ranges` with its unallocated clusters and
+// `fsName` with its type.
+static bool filesystemFreeRanges(BlockReader &device, uint64_t deviceSize,
+                                 uint64_t offset, vector<ScanRange> &ranges,
+                                 string &fsName,
+                                 std::function<bool()> cancelCheck)
+{
+  Ext4 ext4;
+  if (ext4.open(device, offset, deviceSize))
+  {
+    fsName = "ext4";
+    ranges = ext4.freeRanges(cancelCheck);
+    return true;
+  }
+  Ntfs ntfs;
+  if (ntfs.open(device, offset))
+  {
+    fsName = "NTFS";
+    ranges = ntfs.freeRanges(cancelCheck);
+    return true;
+  }
+  Fat fat;
+  if (fat.open(device, offset))
+  {
+    fsName = fat.typeName();
+    ranges = fat.freeRanges(cancelCheck);
+    return true;
+  }
+  return false;
+}
+
+// Offsets worth probing for a filesystem: the device start, then every
+// partition when the device is a whole disk.
+static vector<uint64_t> volumeOffsets(BlockReader &device)
 {
-  if (pos + signature.size() > buffer.size())
+  vector<uint64_t> offsets = {0};
+  for (const Partition &part : readPartitionTable(device))
+    offsets.push_back(part.offset);
+  return offsets;
+}
+
+// Index of the first format whose signature names the content at `data`,
+// or -1.
+template <class... F>
+static int identifyFormat(FormatList<F...>, const unsigned char *data,
+                          size_t size)
+{
+  int found = -1;
+  ((found < 0 && F::info.identifying && signatureAt<F>(data, size)
+        ? found = formatIndexOf<F>()
+        : 0),
+   ...);
+  return found;
+}
+
+bool RecoveryEngine::writeDeletedFile(BlockReader &device, const DeletedFile &file,
+                                      const string &dirName,
+                                      std::function<void(const ScanEvent &)> eventCallback,
+                                      ScanMetrics::Shard &stats)
+{
+  string dirPath = outputDirectory + "/" + dirName;
+  error_code ec;
+  fs::create_directories(dirPath, ec);
+
+  // Name the file after its content when the metadata gave no extension.
+  string outFileName = dirPath + "/" + file.name;
+  if (fs::path(file.name).extension().empty())
+  {
+    vector<unsigned char> head(16, 0);
+    if (!file.residentData.empty())
+      copy_n(file.residentData.begin(),
+             min(head.size(), file.residentData.size()), head.begin());
+    else if (!file.extents.empty() && file.extents[0].logicalOffset == 0)
+      readAt(device, file.extents[0].deviceOffset, head.data(),
+             min<uint64_t>(head.size(), file.extents[0].length));
+    int format = identifyFormat(Formats(), head.data(), head.size());
+    outFileName += format < 0 ? ".bin" : Formats::info[format].extension;
+  }
+  fs::path wanted(outFileName);
+  outFileName = claimOutputFile(dirPath, wanted.stem().string(),
+                                wanted.extension().string());
+
+  ofstream outFile(outFileName, ios::binary);
+  if (outFileName.empty() || !outFile)
+  {
+    eventCallback(ScanEvent::ioError("Failed to create " + wanted.string()));
     return false;
-  for (size_t i = 0; i < signature.size(); ++i)
+  }
+  uint64_t writeStart = monotonicNanos();
+  uint64_t bytesWritten = 0;
+  if (!file.residentData.empty())
   {
-    if (buffer[pos + i] != signature[i])
-      return false;
+    bytesWritten = min<uint64_t>(file.size, file.residentData.size());
+    outFile.write(reinterpret_cast<const char *>(file.residentData.data()),
+                  bytesWritten);
   }
-  if (formatIndex == 1)
+
+  vector<unsigned char> chunk(1024 * 1024);
+  uint64_t unread = 0; // extent bytes the device did not return
+  for (const FileExtent &extent : file.extents)
   {
-    if (!((buffer[3] & 0xF0) == 0xE0))
-      return false;
+    outFile.seekp(extent.logicalOffset, ios::beg);
+    uint64_t position = extent.deviceOffset;
+    uint64_t remaining = extent.length;
+    while (remaining > 0)
+    {
+      size_t want = min<uint64_t>(remaining, chunk.size());
+      size_t got = device.readAt(position, chunk.data(), want);
+      if (got == 0)
+        break;
+      outFile.write(reinterpret_cast<const char *>(chunk.data()), got);
+      bytesWritten += got;
+      position += got;
+      remaining -= got;
+    }
+    unread += remaining;
   }
+  outFile.close();
+  stats.add(metric::BYTES_WRITTEN, bytesWritten);
+  stats.add(metric::WRITE_NS, monotonicNanos() - writeStart);
+
+  // Zeros in place of the missing bytes would pass for a whole file; the
+  // carver may still find it.
+  if (unread > 0)
+  {
+    remove(outFileName.c_str());
+    stats.add(metric::BYTES_DISCARDED, bytesWritten);
+    eventCallback(ScanEvent::ioError(
+        "Could not read " + to_string(unread) + " of the " +
+        to_string(file.size) + " bytes of deleted file " + file.name));
+    return false;
+  }
+  // Trailing holes are not written above; restore the recorded size.
+  fs::resize_file(outFileName, file.size, ec);
+
+  // Metadata names the file and lists its blocks: nothing is guessed.
+  ScanEvent event;
+  event.type = ScanEvent::FileCarved;
+  event.offset = file.extents.empty() ? 0 : file.extents[0].deviceOffset;
+  event.length = file.size;
+  event.format = formatFromExtension(outFileName);
+  event.confidence = 1.0f;
+  event.path = outFileName;
+  eventCallback(event);
+  metadataFileCount++;
   return true;
 }
 
-void RecoveryEngine::extractFile(const QString &filename, size_t fileStart,
-                                 int &fileCount, int formatIndex,
-                                 std::function<void(QString)> logCallback)
+vector<ScanRange> RecoveryEngine::recoverFromMetadata(
+    BlockReader &device, uint64_t deviceSize,
+    std::function<void(const ScanEvent &)> eventCallback,
+    std::function<bool()> cancelCheck, ScanMetrics::Shard &stats)
 {
-  ifstream file(filename.toStdString(), ios::binary);
-  if (!file)
+  vector<ScanRange> recovered;
+  for (uint64_t offset : volumeOffsets(device))
   {
-    logCallback("Error: Failed to reopen file.");
-    return;
+    if (cancelCheck())
+      break;
+    vector<DeletedFile> files;
+    string dirName;
+    Ext4 ext4;
+    Ntfs ntfs;
+    Fat fat;
+    if (ext4.open(device, offset, deviceSize))
+    {
+      files = ext4.deletedFiles(cancelCheck);
+      dirName = "EXT4";
+      eventCallback(ScanEvent::info("ext4 metadata: " + to_string(files.size()) +
+                  " deleted files with intact extents (" +
+                  to_string(ext4.journalRecoveries()) +
+                  " from the journal)"));
+    }
+    else if (ntfs.open(device, offset))
+    {
+      files = ntfs.deletedFiles(cancelCheck);
+      dirName = "NTFS";
+      eventCallback(ScanEvent::info("NTFS $MFT: " + to_string(files.size()) +
+                  " deleted files with recoverable data"));
+    }
+    else if (fat.open(device, offset))
+    {
+      files = fat.deletedFiles(cancelCheck);
+      dirName = fat.typeName();
+      eventCallback(ScanEvent::info(dirName + " directories: " +
+                  to_string(files.size()) +
+                  " deleted files with free contiguous clusters"));
+    }
+    else
+      continue;
+
+    for (const DeletedFile &file : files)
+    {
+      if (cancelCheck())
+        break;
+      if (!writeDeletedFile(device, file, dirName, eventCallback, stats))
+        continue;
+      for (const FileExtent &extent : file.extents)
+        recovered.push_back({extent.deviceOffset, extent.length});
+    }
+    if (offset == 0)
+      break; // a filesystem on the whole device: no partitions to check
+  }
+  return recovered;
+}
+
+vector<ScanRange> RecoveryEngine::buildScanRanges(
+    BlockReader &device, size_t fileSize,
+    std::function<void(const ScanEvent &)> eventCallback,
+    std::function<bool()> cancelCheck)
+{
+  if (!freeSpaceOnly && !metadataRecovery)
+    return {{0, fileSize}};
+
+  vector<ScanRange> ranges;
+  string fsName;
+  if (filesystemFreeRanges(device, fileSize, 0, ranges, fsName, cancelCheck))
+  {
+    clipRanges(ranges, fileSize);
+    eventCallback(ScanEvent::info(fsName +
+                " filesystem detected: scanning " +
+                to_string(totalLength(ranges)) + " free of " +
+                to_string(fileSize) + " bytes"));
+    return ranges;
   }
-  file.seekg(fileStart, ios::beg);
 
-  size_t minSize = Size_limit[formatIndex].first;
-  size_t maxSize = Size_limit[formatIndex].second;
-  size_t chunkSize = 4 * 1024;
-  vector<unsigned char> readBuffer(chunkSize);
-  string outputDir = outputDirectory.toStdString();
-  string dirPath = outputDir + "/" + FILE_NAMES[formatIndex];
-  if (!fs::exists(dirPath))
+  // Whole-disk devices: check each partition, and always scan space that no
+  // partition covers since it may hold a deleted partition's data.
+  vector<Partition> partitions = readPartitionTable(device);
+  bool anyFilesystem = false;
+  size_t cursor = 0;
+  for (const Partition &part : partitions)
+  {
+    size_t partEnd = min<size_t>(part.offset + part.length, fileSize);
+    if (part.offset >= partEnd)
+      continue;
+    if (part.offset > cursor)
+      ranges.push_back({cursor, part.offset - cursor});
+    cursor = max(cursor, partEnd);
+
+    vector<ScanRange> partRanges;
+    if (filesystemFreeRanges(device, fileSize, part.offset, partRanges, fsName,
+                             cancelCheck))
+    {
+      clipRanges(partRanges, partEnd);
+      eventCallback(ScanEvent::info("Partition at " + to_string(part.offset) + ": " +
+                  fsName + ", " +
+                  to_string(totalLength(partRanges)) + " free bytes"));
+      ranges.insert(ranges.end(), partRanges.begin(), partRanges.end());
+      anyFilesystem = true;
+    }
+    else
+      ranges.push_back({part.offset, partEnd - part.offset});
+  }
+  if (!anyFilesystem)
   {
-    logCallback("Creating directory: " + QString::fromStdString(dirPath));
-    fs::create_directories(dirPath);
+    eventCallback(ScanEvent::info("No supported filesystem found, scanning the whole device."));
+    return {{0, fileSize}};
   }
+  if (cursor < fileSize)
+    ranges.push_back({cursor, fileSize - cursor});
+  mergeRanges(ranges);
+  eventCallback(ScanEvent::info("Scanning " + to_string(totalLength(ranges)) + " of " +
+              to_string(fileSize) + " bytes"));
+  return ranges;
+}
 
-  string outFileName = dirPath + "/RecoveredFile_" +
-                       to_string(++File_Count[formatIndex]) +
-                       FILE_EXTENSIONS[formatIndex];
+static string describeIoSetting(const IoTuner &io)
+{
+  return to_string(io.readSize() / 1024) + " KB reads, " +
+         to_string(io.queueDepth()) + " queued";
+}
 
-  ofstream outFile(outFileName, ios::binary);
-  if (!outFile)
+// Picks the starting read size and queue depth from what sysfs says about
+// the device, and reports both.
+IoTuner *RecoveryEngine::startIoTuning(
+    std::function<void(const ScanEvent &)> eventCallback)
+{
+  IoProfile profile = probeIoProfile(inputDevicePath);
+  ioTuner.reset(new IoTuner(profile));
+  eventCallback(ScanEvent::info("I/O: " + describeIoProfile(profile) +
+                                "; starting with " +
+                                describeIoSetting(*ioTuner)));
+  return ioTuner.get();
+}
+
+bool RecoveryEngine::readsThrottled() const
+{
+  return idleOnly || (readLimiter && readLimiter->currentRate() > 0) ||
+         (iopsLimiter && iopsLimiter->currentRate() > 0);
+}
+
+// Compressed and container images are read in place through their own
+// readers. Every read goes through the read limiters and the idle gate,
+// when there are any.
+unique_ptr<BlockReader> RecoveryEngine::openDevice(
+    ImageFormat imageFormat, uint64_t &fileSize,
+    std::function<void(const ScanEvent &)> eventCallback,
+    std::function<bool()> cancelCheck)
+{
+  if (imageFormat != ImageFormat::Raw)
+    eventCallback(ScanEvent::info(string("Reading a ") +
+                                  imageFormatName(imageFormat) + " image"));
+  string openError;
+  unique_ptr<BlockReader> reader = openImage(
+      inputDevicePath, imageFormat, ioBackend, fileSize, openError, cancelCheck);
+  if (!reader)
+  {
+    eventCallback(ScanEvent::ioError(openError));
+    return nullptr;
+  }
+  if (!openError.empty())
+    eventCallback(ScanEvent::ioError(openError));
+  openedSize = fileSize;
+  shared_ptr<IdleGate> idle;
+  if (idleOnly)
+  {
+    idle = IdleGate::open(inputDevicePath, cancelCheck);
+    eventCallback(ScanEvent::info(
+        idle ? "Idle-only: reads wait while other programs use the disk"
+             : "Idle-only: the disk's activity cannot be read, so reads are "
+               "not held back"));
+  }
+  if (readLimiter || iopsLimiter || idle)
+    reader.reset(new ThrottledReader(std::move(reader), readLimiter,
+                                     iopsLimiter, idle));
+  return reader;
+}
+
+bool RecoveryEngine::run(std::function<void(const ScanEvent &)> eventCallback,
+                         std::function<bool()> cancelCheck)
+{
+  const string filename = inputDevicePath;
+
+  // Filesystem metadata is read through the reader, so every image format
+  // has it; only a raw image has holes to skip.
+  ImageFormat imageFormat = detectImageFormat(filename);
+  bool rawImage = imageFormat == ImageFormat::Raw;
+  uint64_t fileSize = 0;
+  unique_ptr<BlockReader> reader =
+      openDevice(imageFormat, fileSize, eventCallback, cancelCheck);
+  if (!reader)
+    return false;
+
+  eventCallback(ScanEvent::info("File size: " + to_string(fileSize) + " bytes"));
+
+  metrics.reset();
+  ScanMetrics::Shard &stats = metrics.addShard();
+  uint64_t runStart = monotonicNanos();
+
+  // Only regular image files can carry holes; SEEK_DATA is not meaningful on
+  // block devices.
+  int holeFd = -1;
+  struct stat st;
+  if (rawImage && stat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+    holeFd = open(filename.c_str(), O_RDONLY);
+
+  metadataFileCount = 0;
+  vector<ScanRange> recovered;
+  vector<ScanRange> ranges;
+  {
+    // Filesystem structures are read a block at a time, mostly in order;
+    // under a limit, reading them in larger pieces saves most of the reads.
+    ReadAheadReader metadataReader(*reader, VALIDATE_BYTES, VALIDATE_BYTES);
+    BlockReader &device = readsThrottled() ? metadataReader : *reader;
+    if (metadataRecovery)
+      recovered = recoverFromMetadata(device, fileSize, eventCallback,
+                                      cancelCheck, stats);
+    ranges = buildScanRanges(device, fileSize, eventCallback, cancelCheck);
+  }
+  if (!recovered.empty())
+  {
+    subtractRanges(ranges, recovered);
+    eventCallback(ScanEvent::info("Carving the remaining " + to_string(totalLength(ranges)) +
+                " bytes"));
+  }
+
+  ScanShared shared;
+  shared.total = totalLength(ranges);
+  shared.runStart = runStart;
+  shared.eventCallback = eventCallback;
+  shared.io = startIoTuning(eventCallback);
+  vector<vector<ScanRange>> slices = splitRanges(ranges, threadCount, CHUNK_SIZE);
+  if (slices.size() > 1)
+    eventCallback(ScanEvent::info("Scanning with " + to_string(slices.size()) + " threads (" +
+                ioBackendName(ioBackend) + " reads)"));
+
+  // A catalog scan carves nothing, so it needs no pool.
+  vector<vector<CatalogEntry>> catalogs(catalogOnly ? slices.size() : 0);
+  auto sliceCatalog = [&](size_t i)
+  { return catalogOnly ? &catalogs[i] : nullptr; };
+
+  // Declared after the reader so its jobs finish before the reader closes.
+  unique_ptr<CarvePool> ownPool;
+  if (!carvePool && carveThreads > 0 && !catalogOnly)
+  {
+    ownPool.reset(new CarvePool(carveThreads));
+    eventCallback(ScanEvent::info("Carving with " + to_string(ownPool->size()) +
+                                  " worker threads"));
+  }
+  shared.carvePool = catalogOnly ? nullptr
+                    : carvePool  ? carvePool.get()
+                                 : ownPool.get();
+  if (shared.carvePool)
+    for (size_t i = 0; i < shared.carvePool->size(); ++i)
+      shared.carveStats.push_back(&metrics.addShard());
+
+  vector<thread> workers;
+  for (size_t i = 1; i < slices.size(); ++i)
+    workers.emplace_back([&, i]()
+                         { scanSlice(slices[i], *reader, holeFd, shared,
+                                     sliceCatalog(i), eventCallback,
+                                     cancelCheck); });
+  if (!slices.empty())
+    scanSlice(slices[0], *reader, holeFd, shared, sliceCatalog(0),
+              eventCallback, cancelCheck);
+  for (thread &worker : workers)
+    worker.join();
+  shared.carveJobs.wait();
+  if (ioTuner->throughput() > 0)
+    eventCallback(ScanEvent::info(
+        "I/O: finished with " + describeIoSetting(*ioTuner) + " (" +
+        to_string(static_cast<uint64_t>(ioTuner->throughput() / 1e6)) +
+        " MB/s while reading)"));
+
+  if (holeFd >= 0)
+    close(holeFd);
+  if (shared.cancelled)
   {
-    logCallback("Error: Failed to create output file.");
+    eventCallback(ScanEvent::info("[!] Operation cancelled."));
+    writeMetrics(filename, runStart, false, eventCallback);
+    return false;
+  }
+  if (shared.total > 0)
+    eventCallback(progressEvent(100));
+  if (catalogOnly)
+  {
+    bool written = writeCatalogFile(catalogs, fileSize, eventCallback);
+    writeMetrics(filename, runStart, written, eventCallback);
+    return written;
+  }
+
+  ScanStats totals = metrics.snapshot();
+  eventCallback(ScanEvent::summaryLine("File recovery summary:"));
+  eventCallback(ScanEvent::summaryLine(
+      "Total files recovered: " + to_string(totals.total(metric::VALIDATED))));
+  if (metadataRecovery)
+    eventCallback(ScanEvent::summaryLine(
+        "Recovered from filesystem metadata: " + to_string(metadataFileCount) +
+        " files."));
+
+  for (size_t i = 0; i < FORMAT_COUNT; i++)
+  {
+    if (!Formats::info[i].carved || !File_Supported[i])
+      continue;
+    string name = Formats::info[i].name;
+    if (totals[metric::VALIDATED + i] > 0)
+    {
+      string checked;
+      uint64_t verified = totals[metric::VERIFIED + i];
+      uint64_t corrupt = totals[metric::CORRUPT + i];
+      if (verified + corrupt > 0)
+        checked = " (" + to_string(verified) + " verified, " +
+                  to_string(corrupt) + " partially corrupt)";
+      eventCallback(ScanEvent::summaryLine(
+          name + ": " + to_string(totals[metric::VALIDATED + i]) +
+          " files recovered" + checked + "."));
+    }
+    else
+    {
+      eventCallback(ScanEvent::summaryLine(name + ": No files found."));
+    }
+  }
+
+  writeMetrics(filename, runStart, true, eventCallback);
+  return true;
+}
+
+// Adds `bytes` to the scanned total and reports the percentage when it moves.
+// Any scanning thread may call this; the CAS keeps reports in order.
+void RecoveryEngine::advanceProgress(ScanShared &shared, size_t bytes,
+                                     std::function<void(const ScanEvent &)> eventCallback)
+{
+  if (shared.total == 0 || bytes == 0)
     return;
+  size_t scanned = shared.scanned.fetch_add(bytes) + bytes;
+  int progress =
+      static_cast<int>((static_cast<double>(scanned) / shared.total) * 100);
+  // Only report changes: a 4 KB chunk is far finer than a percent.
+  int last = shared.lastProgress.load();
+  while (progress > last)
+  {
+    if (shared.lastProgress.compare_exchange_weak(last, progress))
+    {
+      eventCallback(progressEvent(progress));
+      if (statsCallback)
+      {
+        ScanStats current = metrics.snapshot();
+        current.elapsedNanos = monotonicNanos() - shared.runStart;
+        statsCallback(current);
+      }
+      break;
+    }
   }
+}
 
-  bool xrefFound = false, trailerFound = false, foundEnd = false;
-  size_t totalBytesWritten = 0;
+// --- Carvers ---
+// One specialization per strategy in formats.h. matches() decides whether a
+// candidate starts at `pos`; carve() writes it out (or queues it on the carve
+// pool) and reports the outcome, returning how many bytes after the
+// signature the scan may skip.
 
-  vector<unsigned char> PDF_XREF = {'x', 'r', 'e', 'f'};
-  vector<unsigned char> PDF_TRAILER = {'t', 'r', 'a', 'i', 'l', 'e', 'r'};
+// What a carve writes through. `stats` belongs to the thread doing the work.
+struct CarveOutput
+{
+  BlockReader &reader;
+  const string &outputDirectory;
+  const std::function<void(const ScanEvent &)> &eventCallback;
+  ScanMetrics::Shard &stats;
+  const IoTuner *io = nullptr; // null: CHUNK_SIZE reads
+};
+
+// A scanning thread's state, shared by the carvers it calls.
+struct CarveContext : CarveOutput
+{
+  CarvePool *pool;                              // null: carve inline
+  CarvePool::JobGroup &jobs;                    // this scan's jobs on `pool`
+  const vector<ScanMetrics::Shard *> &poolStats; // one per pool worker
+  const atomic<bool> &cancelled;
+  Mp3 mp3;
+  MP4 mp4;
+  size_t mp3Done = 0; // end of the last MP3 stream, which is not rescanned
+  unique_ptr<ReadAheadReader> mp3Stream; // what the MP3 follower reads
+  // The scan's current read, which the MP3 follower is served from first.
+  const unsigned char *block = nullptr;
+  uint64_t blockStart = 0;
+  size_t blockSize = 0;
+  vector<CatalogEntry> *catalog = nullptr; // set: record, do not carve
+};
+
+// Adds a candidate to a catalog scan's list. `exactLength` is 0 when only
+// the distance to the next candidate will say how long it is.
+static void catalogCandidate(CarveContext &ctx, uint64_t offset, int format,
+                             float confidence, const HeaderInfo &header,
+                             uint64_t exactLength)
+{
+  CatalogEntry entry{};
+  entry.offset = offset;
+  entry.length = exactLength;
+  entry.format = format;
+  entry.confidence = confidence;
+  entry.width = header.width;
+  entry.height = header.height;
+  entry.detail = header.detail;
+  entry.flags =
+      exactLength > 0 ? static_cast<uint32_t>(CatalogEntry::LengthExact) : 0u;
+  ctx.catalog->push_back(entry);
+}
+
+static void rejectCandidate(CarveOutput &ctx, uint64_t offset, int format,
+                            uint64_t length, ScanEvent::Reason reason)
+{
+  ctx.stats.add(metric::REJECTED + format, 1);
+  ScanEvent event = candidateEvent(offset, format);
+  event.type = ScanEvent::CandidateRejected;
+  event.length = length;
+  event.reason = reason;
+  ctx.eventCallback(event);
+}
 
-  while (!foundEnd && (file.read(reinterpret_cast<char *>(readBuffer.data()),
-                                 readBuffer.size()) ||
-                       file.gcount() > 0))
+template <class Strategy>
+struct Carver;
+
+// True when a carved format's signature starts at `data`.
+template <class... F>
+static bool carvedSignatureAt(FormatList<F...>, const unsigned char *data,
+                              size_t size)
+{
+  return ((F::info.carved && signatureAt<F>(data, size)) || ...);
+}
+
+template <>
+struct Carver<CarveToEndMarker>
+{
+  template <class F>
+  static bool matches(CarveContext &, const vector<unsigned char> &buffer,
+                      size_t size, size_t pos, uint64_t)
   {
-    size_t chunkBytes = file.gcount();
-    size_t writeBytes = chunkBytes;
+    return signatureAt<F>(buffer.data() + pos, size - pos);
+  }
+
+  // The copy does not depend on scanner state, so with a pool it runs as a
+  // job and the scan moves on at once.
+  template <class F>
+  static size_t carve(CarveContext &ctx, uint64_t fileStart)
+  {
+    if (!ctx.pool)
+    {
+      extract<F>(ctx, fileStart);
+      return sizeof(F::signature);
+    }
+    CarveOutput output = ctx;
+    const vector<ScanMetrics::Shard *> *poolStats = &ctx.poolStats;
+    const atomic<bool> *cancelled = &ctx.cancelled;
+    ctx.pool->submit(
+        [output, poolStats, cancelled, fileStart](size_t worker)
+        {
+          if (*cancelled)
+            return;
+          CarveOutput job{output.reader, output.outputDirectory,
+                          output.eventCallback, *(*poolStats)[worker],
+                          output.io};
+          extract<F>(job, fileStart);
+        },
+        &ctx.jobs);
+    return sizeof(F::signature);
+  }
+
+  // A catalog scan checks and describes the header with the bytes at hand,
+  // reading a little more only when the signature sits at the end of the
+  // chunk.
+  template <class F>
+  static size_t catalog(CarveContext &ctx, const vector<unsigned char> &buffer,
+                        size_t size, size_t pos, uint64_t fileStart)
+  {
+    constexpr int formatIndex = formatIndexOf<F>();
+    const unsigned char *head = buffer.data() + pos;
+    size_t headSize = size - pos;
+    vector<unsigned char> more;
+    if (headSize < HEADER_BYTES)
+    {
+      more.resize(HEADER_BYTES);
+      headSize = ctx.reader.readAt(fileStart, more.data(), more.size());
+      head = more.data();
+    }
+    if (F::validate(head, headSize, false))
+      catalogCandidate(ctx, fileStart, formatIndex, F::info.confidence,
+                       F::headerInfo(head, headSize), 0);
+    else
+      rejectCandidate(ctx, fileStart, formatIndex, headSize,
+                      ScanEvent::BadHeader);
+    return sizeof(F::signature);
+  }
+
+  // Copies from the signature through the end marker, then keeps the file
+  // only if its header, size and structure check out. Carved bytes are staged
+  // in memory, so the output file is only created once the candidate is
+  // confirmed, or once it outgrows the stage.
+  template <class F>
+  static void extract(CarveOutput &ctx, uint64_t fileStart)
+  {
+    constexpr int formatIndex = formatIndexOf<F>();
+    constexpr FormatInfo info = F::info;
+    constexpr size_t markerSize = std::size(F::endMarker);
+
+    vector<unsigned char> readBuffer;
+    vector<unsigned char> staged;
+    string dirPath = ctx.outputDirectory + "/" + info.name;
+    string outFileName;
+    ofstream outFile;
 
-    if (END_MARKERS[formatIndex] == GENERIC_END)
+    typename F::Structure structure;
+    typename F::Checksum checksum;
+    bool foundEnd = false, tooLarge = false, badHeader = false;
+    bool validated = false;
+    size_t totalBytesCarved = 0, totalBytesWritten = 0;
+    float confidence = info.confidence;
+    uint64_t carveStart = monotonicNanos();
+    uint64_t writeNanos = 0;
+    auto timedWrite = [&](const unsigned char *data, size_t size)
     {
-      for (size_t j = 0; j < SupportedFileCount; j++)
+      uint64_t start = monotonicNanos();
+      outFile.write(reinterpret_cast<const char *>(data), size);
+      writeNanos += monotonicNanos() - start;
+      totalBytesWritten += size;
+    };
+    // Creates the output file and moves the stage into it.
+    auto spill = [&]()
+    {
+      error_code ec;
+      if (fs::create_directories(dirPath, ec))
+        ctx.eventCallback(ScanEvent::info("Created directory: " + dirPath));
+      outFileName =
+          claimOutputFile(dirPath, carvedFileStem(fileStart), info.extension);
+      if (!outFileName.empty())
+        outFile.open(outFileName, ios::binary);
+      if (outFileName.empty() || !outFile)
+      {
+        ctx.eventCallback(
+            ScanEvent::ioError("Failed to create an output file in " + dirPath));
+        return false;
+      }
+      timedWrite(staged.data(), staged.size());
+      staged.clear();
+      staged.shrink_to_fit();
+      return true;
+    };
+    auto stage = [&](const unsigned char *data, size_t size)
+    {
+      totalBytesCarved += size;
+      if (outFile.is_open())
+      {
+        timedWrite(data, size);
+        return true;
+      }
+      staged.insert(staged.end(), data, data + size);
+      if (!validated && staged.size() >= VALIDATE_BYTES)
+      {
+        validated = true;
+        if (!F::validate(staged.data(), staged.size(), false))
+        {
+          badHeader = true;
+          return false;
+        }
+      }
+      return staged.size() < STAGE_LIMIT || spill();
+    };
+
+    // Reads start at the validation window and double up to the tuned read
+    // size, so a rejected candidate costs one read and a large file few.
+    size_t maxRead = ctx.io ? ctx.io->readSize() : CHUNK_SIZE;
+    size_t nextRead = min(VALIDATE_BYTES, maxRead);
+    size_t readBytes = 0, readPos = 0;
+    uint64_t position = fileStart;
+    while (!foundEnd)
+    {
+      if (readPos == readBytes)
+      {
+        readBuffer.resize(nextRead);
+        readBytes = ctx.reader.readAt(position, readBuffer.data(), nextRead);
+        readPos = 0;
+        nextRead = min(nextRead * 2, maxRead);
+        if (readBytes == 0)
+          break;
+      }
+      size_t chunkBytes = min(CHUNK_SIZE, readBytes - readPos);
+      const unsigned char *data = readBuffer.data() + readPos;
+      readPos += chunkBytes;
+      position += chunkBytes;
+      size_t writeBytes = chunkBytes;
+
+      if constexpr (markerSize == 0)
       {
-        for (size_t k = 0; k + SIGNATURES[j].size() <= chunkBytes; k++)
+        // Ends where the next known file begins; the file's own signature
+        // at its first byte does not count.
+        for (size_t k = totalBytesCarved == 0 ? 1 : 0; k < chunkBytes; k++)
         {
-          if (matchesSignature(readBuffer, k, SIGNATURES[j], j))
+          if (carvedSignatureAt(Formats(), data + k, chunkBytes - k))
           {
-            writeBytes = k + SIGNATURES[j].size();
+            writeBytes = k;
             foundEnd = true;
             break;
           }
         }
-        if (foundEnd)
-          break;
       }
-    }
-    else
-    {
-      for (size_t j = 0; j + END_MARKERS[formatIndex].size() <= chunkBytes;
-           j++)
+      else
       {
-        if (formatIndex == 2)
+        const unsigned char *marker =
+            search(data, data + chunkBytes, begin(F::endMarker),
+                   end(F::endMarker));
+        if (marker != data + chunkBytes)
         {
-          if (matchesSignature(readBuffer, j, PDF_XREF, 2))
-            xrefFound = true;
-          if (matchesSignature(readBuffer, j, PDF_TRAILER, 2))
-            trailerFound = true;
-        }
-        if (matchesSignature(readBuffer, j, END_MARKERS[formatIndex],
-                             formatIndex))
-        {
-          writeBytes = j + END_MARKERS[formatIndex].size();
+          writeBytes = marker - data + markerSize;
           foundEnd = true;
-          break;
         }
       }
+
+      structure.scan(data, writeBytes);
+      checksum.scan(data, writeBytes);
+      if (!stage(data, writeBytes))
+      {
+        if (!badHeader)
+          return; // the output could not be created, already reported
+        foundEnd = false;
+        break;
+      }
+      if (totalBytesCarved > info.maxSize)
+      {
+        tooLarge = true;
+        break;
+      }
     }
 
-    outFile.write(reinterpret_cast<char *>(readBuffer.data()), writeBytes);
-    totalBytesWritten += writeBytes;
-    if (totalBytesWritten > maxSize)
+    if constexpr (F::Structure::supplyEndMarker && markerSize > 0)
     {
-      goto DELETE;
+      if (!foundEnd && !tooLarge && !badHeader && structure.complete())
+      {
+        // The end marker was supplied rather than found.
+        checksum.scan(F::endMarker, markerSize);
+        stage(F::endMarker, markerSize);
+        foundEnd = true;
+        confidence = 0.5f;
+      }
     }
+    if (!validated && !badHeader && !outFile.is_open())
+      badHeader = !F::validate(staged.data(), staged.size(), true);
+
+    ScanEvent::Reason reason = ScanEvent::NoReason;
+    if (badHeader)
+      reason = ScanEvent::BadHeader;
+    else if (tooLarge || (foundEnd && totalBytesCarved > info.maxSize))
+      reason = ScanEvent::TooLarge;
+    else if (foundEnd && totalBytesCarved < info.minSize)
+      reason = ScanEvent::TooSmall;
+    else if (!foundEnd)
+      reason = ScanEvent::NoEndMarker;
+    else if (!structure.complete())
+      reason = ScanEvent::MissingStructure;
+    bool kept = reason == ScanEvent::NoReason;
+    if (kept && !outFile.is_open() && !spill())
+      return;
+    if (outFile.is_open())
+      outFile.close();
+    if (!kept && !outFileName.empty())
+      remove(outFileName.c_str());
+
+    ctx.stats.add(metric::BYTES_WRITTEN, totalBytesWritten);
+    if (!kept)
+      ctx.stats.add(metric::BYTES_DISCARDED, totalBytesWritten);
+    ctx.stats.add(kept ? metric::VALIDATED + formatIndex
+                       : metric::REJECTED + formatIndex,
+                  1);
+    ScanEvent::Integrity integrity = checksum.result();
+    if (kept && integrity == ScanEvent::Verified)
+      ctx.stats.add(metric::VERIFIED + formatIndex, 1);
+    else if (kept && integrity == ScanEvent::PartiallyCorrupt)
+      ctx.stats.add(metric::CORRUPT + formatIndex, 1);
+    ctx.stats.add(metric::WRITE_NS, writeNanos);
+    ctx.stats.add(metric::CARVE_NS, monotonicNanos() - carveStart - writeNanos);
+
+    ScanEvent event = candidateEvent(fileStart, formatIndex);
+    event.type = kept ? ScanEvent::FileCarved : ScanEvent::CandidateRejected;
+    event.length = totalBytesCarved;
+    event.reason = reason;
+    if (kept)
+    {
+      event.confidence = confidence;
+      event.integrity = integrity;
+      event.path = outFileName;
+    }
+    ctx.eventCallback(event);
   }
+};
 
-  if (!foundEnd && formatIndex == 2 && xrefFound && trailerFound)
+template <>
+struct Carver<CarveMp3Frames>
+{
+  // The follower reads a few KB at a time; it gets them in reads like the
+  // other carvers', and from the scan's own block as far as that goes.
+  static BlockReader &followReader(CarveContext &ctx)
   {
-    outFile.write(
-        reinterpret_cast<const char *>(END_MARKERS[formatIndex].data()),
-        END_MARKERS[formatIndex].size());
-    foundEnd = true;
+    if (!ctx.mp3Stream)
+      ctx.mp3Stream.reset(new ReadAheadReader(
+          ctx.reader, VALIDATE_BYTES, ctx.io ? ctx.io->readSize() : CHUNK_SIZE));
+    ctx.mp3Stream->restart();
+    ctx.mp3Stream->setWindow(ctx.block, ctx.blockStart, ctx.blockSize);
+    return *ctx.mp3Stream;
   }
 
-  outFile.close();
-  file.close();
-
-  if (foundEnd &&
-      (totalBytesWritten < minSize || totalBytesWritten > maxSize))
+  template <class F>
+  static bool matches(CarveContext &ctx, const vector<unsigned char> &buffer,
+                      size_t, size_t pos, uint64_t fileStart)
   {
-  DELETE:
-    // logCallback("[SKIP] Deleted file with invalid size: " +
-    //             QString::fromStdString(FILE_NAMES[formatIndex]) + " (" + QString::number(totalBytesWritten) + " bytes)");
-    remove(outFileName.c_str());
-    fileCount--;
-    return;
+    return fileStart >= ctx.mp3Done && ctx.mp3.matchesMP3Header(buffer, pos);
   }
 
-  if (!foundEnd || (formatIndex == 2 && (!xrefFound || !trailerFound)))
+  // Runs inline: where a stream ends decides where the scan looks for the
+  // next one. Frames are written as they are followed (once the chain is
+  // long enough to keep), so MP3 write time is part of its carve time.
+  template <class F>
+  static size_t carve(CarveContext &ctx, uint64_t fileStart)
   {
-    logCallback("[SKIP] Deleted incomplete file: " +
-                QString::fromStdString(outFileName));
-    remove(outFileName.c_str());
-    fileCount--;
-    return;
+    constexpr int formatIndex = formatIndexOf<F>();
+    uint64_t carveStart = monotonicNanos();
+    ctx.mp3Done = ctx.mp3.extractMP3File(followReader(ctx), fileStart);
+    ctx.stats.add(metric::BYTES_WRITTEN, ctx.mp3.lastBytesWritten);
+    ScanEvent outcome = candidateEvent(fileStart, formatIndex);
+    outcome.length = ctx.mp3.lastChainBytes;
+    if (!ctx.mp3.lastError.empty())
+    {
+      outcome = ScanEvent::ioError(ctx.mp3.lastError);
+    }
+    else if (ctx.mp3Done > 0)
+    {
+      ctx.stats.add(metric::VALIDATED + formatIndex, 1);
+      outcome.type = ScanEvent::FileCarved;
+      outcome.path = ctx.mp3.lastOutputPath;
+      outcome.confidence = F::info.confidence;
+    }
+    else
+    {
+      ctx.stats.add(metric::REJECTED + formatIndex, 1);
+      ctx.stats.add(metric::BYTES_DISCARDED, ctx.mp3.lastBytesWritten);
+      outcome.type = ScanEvent::CandidateRejected;
+      outcome.reason = ctx.mp3.lastChainBytes < 20 * 1024
+                           ? ScanEvent::TooSmall
+                           : ScanEvent::TooLarge;
+    }
+    ctx.eventCallback(outcome);
+    ctx.stats.add(metric::CARVE_NS, monotonicNanos() - carveStart);
+    return 4;
   }
 
-  logCallback("[OK] Recovered: " + QString::fromStdString(outFileName));
-}
+  // The stream is followed without writing it (Mp3::measureOnly), so its
+  // length is exact and the scan skips it as it would after carving.
+  template <class F>
+  static size_t catalog(CarveContext &ctx, const vector<unsigned char> &,
+                        size_t, size_t, uint64_t fileStart)
+  {
+    constexpr int formatIndex = formatIndexOf<F>();
+    ctx.mp3Done = ctx.mp3.extractMP3File(followReader(ctx), fileStart);
+    if (ctx.mp3Done > 0)
+    {
+      HeaderInfo header;
+      header.detail = ctx.mp3.lastBitrate;
+      catalogCandidate(ctx, fileStart, formatIndex, F::info.confidence, header,
+                       ctx.mp3.lastChainBytes);
+    }
+    else
+      rejectCandidate(ctx, fileStart, formatIndex, ctx.mp3.lastChainBytes,
+                      ctx.mp3.lastChainBytes < 20 * 1024 ? ScanEvent::TooSmall
+                                                         : ScanEvent::TooLarge);
+    return 4;
+  }
+};
 
-bool RecoveryEngine::run(std::function<void(QString)> logCallback,
-                         std::function<void(int)> progressCallback,
-                         std::function<bool()> cancelCheck)
+template <>
+struct Carver<CarveMp4Boxes>
 {
-  const string filename = inputDevicePath.toStdString();
-  const size_t CHUNK_SIZE = 4096;
-
-  ifstream file(filename, ios::binary);
-  if (!file)
+  template <class F>
+  static bool matches(CarveContext &ctx, const vector<unsigned char> &buffer,
+                      size_t, size_t pos, uint64_t)
   {
-    logCallback("Error: Failed to open file.");
-    return false;
+    static const vector<unsigned char> ftyp(begin(F::signature),
+                                            end(F::signature));
+    return ctx.mp4.matchesMP4Header(buffer, ftyp, pos);
   }
 
-  file.seekg(0, ios::end);
-  size_t fileSize = file.tellg();
-  file.seekg(0, ios::beg);
-
-  logCallback("File size: " + QString::number(fileSize) + " bytes");
+  // The box walk runs inline and reads only box headers. The copy of a
+  // file worth keeping, up to maxSize bytes, then goes to the pool like a
+  // CarveToEndMarker copy.
+  template <class F>
+  static size_t carve(CarveContext &ctx, uint64_t fileStart)
+  {
+    uint64_t carveStart = monotonicNanos();
+    bool whole = ctx.mp4.measureMP4File(ctx.reader, fileStart, F::info.minSize,
+                                        F::info.maxSize);
+    uint64_t length = ctx.mp4.lastLength;
+    if (!whole)
+      rejectCandidate(ctx, fileStart, formatIndexOf<F>(), length,
+                      ctx.mp4.lastReason);
+    ctx.stats.add(metric::CARVE_NS, monotonicNanos() - carveStart);
+    if (!whole)
+      return sizeof(F::signature);
 
-  // Mp3 mp3(outputDirectory);
-  Mp3 mp3(outputDirectory.toStdString());
-  MP4 mp4;
-  int fileCount = 0;
-  size_t offset = 0;
-  size_t mp3_offset_done = 0;
-  size_t overlap = 0;
-  vector<unsigned char> buffer(CHUNK_SIZE + overlap);
+    if (!ctx.pool)
+    {
+      copy<F>(ctx, fileStart, length);
+      return sizeof(F::signature);
+    }
+    CarveOutput output = ctx;
+    const vector<ScanMetrics::Shard *> *poolStats = &ctx.poolStats;
+    const atomic<bool> *cancelled = &ctx.cancelled;
+    ctx.pool->submit(
+        [output, poolStats, cancelled, fileStart, length](size_t worker)
+        {
+          if (*cancelled)
+            return;
+          CarveOutput job{output.reader, output.outputDirectory,
+                          output.eventCallback, *(*poolStats)[worker],
+                          output.io};
+          copy<F>(job, fileStart, length);
+        },
+        &ctx.jobs);
+    return sizeof(F::signature);
+  }
 
-  while (file.read(reinterpret_cast<char *>(buffer.data() + overlap),
-                   CHUNK_SIZE) ||
-         file.gcount() > 0)
+  // Copies a measured file out and reports it. Each call has its own MP4,
+  // since pool workers copy several files at once.
+  template <class F>
+  static void copy(CarveOutput &ctx, uint64_t fileStart, uint64_t length)
   {
-    if (cancelCheck())
+    constexpr int formatIndex = formatIndexOf<F>();
+    uint64_t carveStart = monotonicNanos();
+    MP4 mp4(ctx.outputDirectory);
+    bool kept = mp4.copyMP4File(ctx.reader, fileStart, length,
+                                ctx.io ? ctx.io->readSize() : 1024 * 1024);
+    ctx.stats.add(metric::BYTES_WRITTEN, mp4.lastBytesWritten);
+    ScanEvent outcome = candidateEvent(fileStart, formatIndex);
+    outcome.length = mp4.lastLength;
+    if (!mp4.lastError.empty())
     {
-      logCallback("[!] Operation cancelled.");
-      return false;
+      outcome = ScanEvent::ioError(mp4.lastError);
     }
-    size_t bytesRead = file.gcount();
-    for (int formatIndex = 0; formatIndex < SupportedFileCount; formatIndex++)
+    else if (kept)
     {
-      if (!File_Supported[formatIndex])
+      ctx.stats.add(metric::VALIDATED + formatIndex, 1);
+      outcome.type = ScanEvent::FileCarved;
+      outcome.path = mp4.lastOutputPath;
+      outcome.confidence = F::info.confidence;
+    }
+    else
+    {
+      ctx.stats.add(metric::REJECTED + formatIndex, 1);
+      ctx.stats.add(metric::BYTES_DISCARDED, mp4.lastBytesWritten);
+      outcome.type = ScanEvent::CandidateRejected;
+      outcome.reason = mp4.lastReason;
+    }
+    ctx.eventCallback(outcome);
+    ctx.stats.add(metric::CARVE_NS, monotonicNanos() - carveStart);
+  }
+
+  template <class F>
+  static size_t catalog(CarveContext &ctx, const vector<unsigned char> &,
+                        size_t, size_t, uint64_t fileStart)
+  {
+    catalogCandidate(ctx, fileStart, formatIndexOf<F>(), F::info.confidence,
+                     HeaderInfo(), 0);
+    return sizeof(F::signature);
+  }
+};
+
+// Runs one format's matcher over a chunk read at `offset`. Returns the time
+// spent carving, which the caller keeps out of the scan time.
+template <class F>
+static uint64_t scanFormat(CarveContext &ctx, const vector<bool> &enabled,
+                           const vector<unsigned char> &buffer, size_t size,
+                           uint64_t offset)
+{
+  using FormatCarver = Carver<typename F::Carve>;
+  constexpr int formatIndex = formatIndexOf<F>();
+  uint64_t carveNanos = 0;
+  if constexpr (F::info.carved)
+  {
+    if (!enabled[formatIndex])
+      return 0;
+    for (size_t i = 0; i + sizeof(F::signature) <= size; i++)
+    {
+      uint64_t fileStart = offset + i;
+      if (!FormatCarver::template matches<F>(ctx, buffer, size, i, fileStart))
         continue;
-      for (size_t i = 0;
-           i + SIGNATURES[formatIndex].size() <= bytesRead + overlap; i++)
+      uint64_t carveStart = monotonicNanos();
+      ctx.stats.add(metric::CANDIDATES + formatIndex, 1);
+      ctx.eventCallback(candidateEvent(fileStart, formatIndex));
+      if (ctx.catalog)
+        i += FormatCarver::template catalog<F>(ctx, buffer, size, i, fileStart);
+      else
+        i += FormatCarver::template carve<F>(ctx, fileStart);
+      carveNanos += monotonicNanos() - carveStart;
+    }
+  }
+  return carveNanos;
+}
+
+template <class... F>
+static uint64_t scanChunk(FormatList<F...>, CarveContext &ctx,
+                          const vector<bool> &enabled,
+                          const vector<unsigned char> &buffer, size_t size,
+                          uint64_t offset)
+{
+  return (scanFormat<F>(ctx, enabled, buffer, size, offset) + ...);
+}
+
+// Scans one thread's share of the ranges. Each slice has its own buffer, MP3
+// state and metrics shard; only the reader, the I/O tuner and the progress
+// total are shared. An MP3 stream running across a slice boundary is picked
+// up again by the next slice, so it may also come out as a second, shorter
+// file.
+//
+// The device is read in blocks of the tuner's read size, with the next
+// queue-depth blocks announced to the reader ahead of time, and each block is
+// matched CHUNK_SIZE bytes at a time exactly as single-chunk reads would be.
+void RecoveryEngine::scanSlice(const vector<ScanRange> &slice,
+                               BlockReader &reader, int holeFd,
+                               ScanShared &shared,
+                               vector<CatalogEntry> *catalog,
+                               std::function<void(const ScanEvent &)> eventCallback,
+                               std::function<bool()> cancelCheck)
+{
+  ScanMetrics::Shard &stats = metrics.addShard();
+  CarveContext ctx{{reader, outputDirectory, shared.eventCallback, stats},
+                   shared.carvePool,
+                   shared.carveJobs,
+                   shared.carveStats,
+                   shared.cancelled,
+                   Mp3(outputDirectory),
+                   MP4(outputDirectory),
+                   0,
+                   nullptr,
+                   nullptr,
+                   0,
+                   0,
+                   catalog};
+  ctx.io = shared.io;
+  ctx.mp3.measureOnly = catalog != nullptr;
+  vector<unsigned char> buffer(CHUNK_SIZE);
+  vector<unsigned char> block;
+  size_t blockStart = 0, blockEnd = 0; // device range held in `block`
+  size_t prefetched = 0;                // end of the ranges announced so far
+
+  for (const ScanRange &range : slice)
+  {
+    size_t offset = range.start;
+    size_t rangeEnd = range.end();
+    size_t dataEnd = offset;
+
+    while (offset < rangeEnd)
+    {
+      if (shared.cancelled)
+        return;
+      if (holeFd >= 0 && offset >= dataEnd)
       {
-        size_t fileStart = offset + i;
-        if (formatIndex == 4 && mp3.matchesMP3Header(buffer, i) &&
-            offset + i >= mp3_offset_done)
-        {
-          // logCallback("Found MP3 at offset: " + QString::number(fileStart));
-          // cout << "entered mp3 extraction" << endl;
-          mp3_offset_done = mp3.extractMP3File(filename, fileStart,
-                                               ++File_Count[formatIndex], logCallback, cancelCheck);
-          i += 4;
-          // cout << "extracted mp3 file" << endl;
-        }
-        else if (formatIndex == 7 &&
-                 mp4.matchesMP4Header(buffer, MP4_SIGNATURE, i))
-        {
-          // logCallback("Found MP4 at offset: " + QString::number(fileStart));
-          mp4.extractMP4File(filename, fileStart, ++fileCount);
-          i += 8;
-        }
-        else if (formatIndex != 4 && formatIndex != 7 &&
-                 matchesSignature(buffer, i, SIGNATURES[formatIndex],
-                                  formatIndex))
+        size_t dataStart = nextDataOffset(holeFd, offset, rangeEnd);
+        if (dataStart >= rangeEnd)
+          break;
+        // Keep reads chunk aligned so chunk boundaries match a full read.
+        dataStart = max(offset, dataStart - dataStart % CHUNK_SIZE);
+        advanceProgress(shared, dataStart - offset, eventCallback);
+        offset = dataStart;
+        dataEnd = nextHoleOffset(holeFd, dataStart, rangeEnd);
+      }
+
+      if (offset < blockStart || offset >= blockEnd)
+      {
+        // Reads past a data run's end would only fetch the hole after it.
+        size_t readSize = min(shared.io->readSize(), rangeEnd - offset);
+        if (holeFd >= 0 && dataEnd > offset)
+          readSize = min(readSize, (dataEnd - offset + CHUNK_SIZE - 1) /
+                                       CHUNK_SIZE * CHUNK_SIZE);
+        block.resize(max(block.size(), readSize));
+        uint64_t readStart = monotonicNanos();
+        size_t blockBytes = reader.readAt(offset, block.data(), readSize);
+        uint64_t readNanos = monotonicNanos() - readStart;
+        if (blockBytes == 0)
+          break;
+        stats.recordRead(blockBytes, readNanos);
+        if (!readsThrottled())
+          shared.io->record(blockBytes, readNanos);
+        blockStart = offset;
+        blockEnd = offset + blockBytes;
+        ctx.block = block.data();
+        ctx.blockStart = blockStart;
+        ctx.blockSize = blockBytes;
+
+        size_t ahead = min<size_t>(
+            blockEnd + (shared.io->queueDepth() - 1) * shared.io->readSize(),
+            rangeEnd);
+        prefetched = max(prefetched, blockEnd);
+        if (ahead > prefetched)
         {
-          // logCallback("Found Signature at offset: " +
-          //             QString::number(fileStart));
-          extractFile(QString::fromStdString(filename), fileStart, ++fileCount,
-                      formatIndex, logCallback);
-          i += SIGNATURES[formatIndex].size();
+          reader.prefetch(prefetched, ahead - prefetched);
+          prefetched = ahead;
         }
       }
-    }
+      size_t bytesRead = min(CHUNK_SIZE, blockEnd - offset);
+      memcpy(buffer.data(), block.data() + (offset - blockStart), bytesRead);
+      uint64_t scanStart = monotonicNanos();
 
-    offset += bytesRead;
-    if (fileSize > 0)
-    {
-      int progress =
-          static_cast<int>((static_cast<double>(offset) / fileSize) * 100);
-      progressCallback(progress);
+      if (cancelCheck())
+      {
+        shared.cancelled = true;
+        return;
+      }
+      // No signature is all zeros (MP4's starts with four 0x00 bytes, but
+      // needs "ftyp" after them), so zero-filled chunks skip matching.
+      uint64_t carveNanos = 0;
+      if (!isZeroBlock(buffer.data(), bytesRead))
+        carveNanos = scanChunk(Formats(), ctx, File_Supported, buffer,
+                               bytesRead, offset);
+      stats.add(metric::SCAN_NS, monotonicNanos() - scanStart - carveNanos);
+
+      offset += bytesRead;
+      advanceProgress(shared, bytesRead, eventCallback);
     }
-    if (bytesRead == CHUNK_SIZE && overlap > 0)
+    // Holes and anything past the end of the device count as scanned.
+    if (offset < rangeEnd)
+      advanceProgress(shared, rangeEnd - offset, eventCallback);
+  }
+}
+
+// Merges the slices' catalogs, estimates lengths from the distance to the
+// next candidate, and writes catalog.idx with a summary.
+bool RecoveryEngine::writeCatalogFile(
+    vector<vector<CatalogEntry>> &catalogs, uint64_t deviceSize,
+    std::function<void(const ScanEvent &)> eventCallback)
+{
+  vector<CatalogEntry> entries;
+  for (vector<CatalogEntry> &slice : catalogs)
+  {
+    entries.insert(entries.end(), slice.begin(), slice.end());
+    vector<CatalogEntry>().swap(slice);
+  }
+  sort(entries.begin(), entries.end(),
+       [](const CatalogEntry &a, const CatalogEntry &b)
+       { return a.offset < b.offset; });
+  vector<size_t> perFormat(FORMAT_COUNT, 0);
+  for (size_t i = 0; i < entries.size(); ++i)
+  {
+    CatalogEntry &entry = entries[i];
+    perFormat[entry.format]++;
+    if (entry.flags & CatalogEntry::LengthExact)
+      continue;
+    uint64_t next = deviceSize;
+    for (size_t j = i + 1; j < entries.size(); ++j)
     {
-      for (int i = 0; i < overlap; ++i)
+      if (entries[j].offset > entry.offset)
       {
-        buffer[i] = buffer[CHUNK_SIZE + i - overlap];
+        next = entries[j].offset;
+        break;
       }
     }
+    entry.length = min<uint64_t>(next - entry.offset,
+                                 Formats::info[entry.format].maxSize);
+  }
+
+  string path = outputDirectory + "/catalog.idx";
+  error_code ec;
+  fs::create_directories(outputDirectory, ec);
+  string error;
+  if (!writeCatalog(path, inputDevicePath, deviceSize, entries, error))
+  {
+    eventCallback(ScanEvent::ioError(error));
+    return false;
+  }
+  eventCallback(ScanEvent::summaryLine("File recovery summary:"));
+  eventCallback(ScanEvent::summaryLine("Catalogued " +
+                                       to_string(entries.size()) +
+                                       " candidates in " + path));
+  for (size_t i = 0; i < FORMAT_COUNT; i++)
+  {
+    if (Formats::info[i].carved && File_Supported[i])
+      eventCallback(ScanEvent::summaryLine(string(Formats::info[i].name) +
+                                           ": " + to_string(perFormat[i]) +
+                                           " candidates."));
   }
+  return true;
+}
 
-  file.close();
+// Runs the format's carver for one catalog entry.
+template <class... F>
+static void carveEntry(FormatList<F...>, CarveContext &ctx,
+                       const CatalogEntry &entry)
+{
+  ((formatIndexOf<F>() == entry.format
+        ? (void)Carver<typename F::Carve>::template carve<F>(ctx, entry.offset)
+        : (void)0),
+   ...);
+}
 
-  logCallback("File recovery summary:");
-  logCallback("Total files recovered: " + QString::number(fileCount));
+bool RecoveryEngine::extractEntries(
+    const vector<CatalogEntry> &entries,
+    std::function<void(const ScanEvent &)> eventCallback,
+    std::function<bool()> cancelCheck)
+{
+  uint64_t fileSize = 0;
+  unique_ptr<BlockReader> reader = openDevice(
+      detectImageFormat(inputDevicePath), fileSize, eventCallback, cancelCheck);
+  if (!reader)
+    return false;
 
-  for (int i = 0; i < SupportedFileCount; i++)
-  {
-    if (!File_Supported[i])
+  metrics.reset();
+  ScanMetrics::Shard &stats = metrics.addShard();
+  uint64_t runStart = monotonicNanos();
+  CarvePool::JobGroup jobs;
+  vector<ScanMetrics::Shard *> noPoolStats;
+  atomic<bool> cancelled{false};
+  IoTuner *io = startIoTuning(eventCallback);
+  CarveContext ctx{{*reader, outputDirectory, eventCallback, stats, io},
+                   nullptr,
+                   jobs,
+                   noPoolStats,
+                   cancelled,
+                   Mp3(outputDirectory),
+                   MP4(outputDirectory),
+                   0,
+                   nullptr,
+                   nullptr,
+                   0,
+                   0,
+                   nullptr};
 
-      continue;
-    if (File_Count[i] > 0)
+  size_t done = 0;
+  for (const CatalogEntry &entry : entries)
+  {
+    if (cancelCheck())
     {
-      logCallback(QString::fromStdString(FILE_NAMES[i]) + ": " +
-                  QString::number(File_Count[i]) + " files recovered.");
+      eventCallback(ScanEvent::info("[!] Operation cancelled."));
+      writeMetrics(inputDevicePath, runStart, false, eventCallback);
+      return false;
     }
-    else
+    if (entry.format < 0 || entry.format >= static_cast<int>(FORMAT_COUNT) ||
+        entry.offset >= fileSize)
     {
-      logCallback(QString::fromStdString(FILE_NAMES[i]) + ": No files found.");
+      eventCallback(ScanEvent::ioError("Catalog entry at offset " +
+                                       to_string(entry.offset) +
+                                       " does not fit this device"));
+      continue;
     }
+    carveEntry(Formats(), ctx, entry);
+    eventCallback(progressEvent(static_cast<int>(++done * 100 / entries.size())));
   }
 
+  ScanStats totals = metrics.snapshot();
+  eventCallback(ScanEvent::summaryLine("File recovery summary:"));
+  eventCallback(ScanEvent::summaryLine(
+      "Extracted " + to_string(totals.total(metric::VALIDATED)) + " of " +
+      to_string(entries.size()) + " catalogued candidates."));
+  writeMetrics(inputDevicePath, runStart, true, eventCallback);
   return true;
 }
+
+// Saves the run's counters as scan_metrics.json in the output directory so
+// runs on different hosts can be compared.
+void RecoveryEngine::writeMetrics(const string &device, uint64_t startNanos,
+                                  bool completed,
+                                  std::function<void(const ScanEvent &)> eventCallback)
+{
+  ScanStats totals = metrics.snapshot();
+  totals.elapsedNanos = monotonicNanos() - startNanos;
+  if (statsCallback)
+    statsCallback(totals);
+
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+  time_t now = time(nullptr);
+  char finished[32];
+  strftime(finished, sizeof(finished), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  vector<string> names;
+  for (const FormatInfo &info : Formats::info)
+    names.push_back(info.name);
+  map<string, string> info = {{"device", device},
+                               {"host", host},
+                               {"finished", finished},
+                               {"status", completed ? "completed" : "cancelled"}};
+  if (ioTuner)
+  {
+    info["read_size"] = to_string(ioTuner->readSize());
+    info["queue_depth"] = to_string(ioTuner->queueDepth());
+  }
+  string json = totals.toJson(names, info);
+
+  string path = outputDirectory + "/scan_metrics.json";
+  error_code ec;
+  fs::create_directories(outputDirectory, ec);
+  ofstream out(path);
+  out << json;
+  if (out)
+  {
+    // A completed run's metrics line closes its summary.
+    ScanEvent written = ScanEvent::info("Scan metrics written to " + path);
+    written.summary = completed;
+    eventCallback(written);
+  }
+}
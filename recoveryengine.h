@@ -1,30 +1,190 @@
 #ifndef RECOVERYENGINE_H
 #define RECOVERYENGINE_H
 
-#include <QString>
-#include <QStringList>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
 #include <functional>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "blockreader.h"
+#include "carvepool.h"
+#include "catalog.h"
+#include "deletedfile.h"
+#include "iotuning.h"
+#include "ratelimiter.h"
+#include "scanevent.h"
+#include "scanmetrics.h"
+#include "scanrange.h"
+
+enum class ImageFormat; // imagereaders.h
+
+// Engines share no state, so one process may run several at once (for
+// example one per device). Carved files are named after their device offset
+// and created exclusively, so engines may even share an output directory.
 class RecoveryEngine {
  public:
-  RecoveryEngine(const QString &inputDevice, const QString &outputDir,
+  RecoveryEngine(const std::string &inputDevice, const std::string &outputDir,
                  const std::vector<bool> &formats);
 
-  bool run(std::function<void(QString)> logCallback,
-           std::function<void(int)> progressCallback,
+  // Index of a format name ("png", "JPEG", "jpg", ...) in the `formats`
+  // vector, or -1 when the engine does not know it.
+  static int formatIndex(const std::string &name);
+
+  // Display name of a format index ("PNG", "JPEG", ...), empty when unknown.
+  static std::string formatName(int index);
+
+  // Length of a format's signature in bytes, 0 when the index is unknown.
+  static size_t signatureLength(int index);
+
+  // Restrict the scan to blocks the filesystem reports as unallocated.
+  // Devices without a recognised filesystem are still scanned in full.
+  void setFreeSpaceOnly(bool enabled) { freeSpaceOnly = enabled; }
+
+  // Recover deleted files from filesystem metadata (ext4 inode tables and
+  // journal, NTFS $MFT, FAT/exFAT directory entries) before carving. Carving then only covers free space that no
+  // recovered file accounts for.
+  void setMetadataRecovery(bool enabled) { metadataRecovery = enabled; }
+
+  // Number of scanning threads; the scan ranges are split between them.
+  void setThreads(unsigned count) { threadCount = std::max(1u, count); }
+
+  // Threads that copy out carved files while the scan goes on, stealing
+  // work from each other so one large file does not delay the small ones
+  // queued behind it. 0 carves on the scanning threads. Defaults to one per
+  // core. MP3 streams are always carved inline, and MP4 box headers are
+  // walked inline before the file itself is copied on the pool.
+  void setCarveThreads(unsigned count) { carveThreads = count; }
+
+  // Carve on a pool shared with other engines instead of a private one; the
+  // engine then only waits for its own jobs.
+  void setCarvePool(std::shared_ptr<CarvePool> pool) { carvePool = pool; }
+
+  // Charges every device read, by the scan and by the carvers, to `bytes`
+  // (a bucket of bytes per second). Its rate may be changed mid-scan.
+  void setReadLimiter(std::shared_ptr<TokenBucket> bytes)
+  {
+    readLimiter = bytes;
+  }
+
+  // Also charges every device read to `reads`, a bucket of reads per second.
+  void setIopsLimiter(std::shared_ptr<TokenBucket> reads)
+  {
+    iopsLimiter = reads;
+  }
+
+  // Device reads wait while other programs are using the disk (IdleGate).
+  void setIdleOnly(bool enabled) { idleOnly = enabled; }
+
+  void setIoBackend(IoBackend backend) { ioBackend = backend; }
+
+  // Catalog-only scan: run() records every candidate (offset, estimated
+  // length, format, header facts, confidence) in catalog.idx in the output
+  // directory instead of carving it, and writes nothing else but the
+  // metrics. Extract the ones wanted later with extractEntries().
+  void setCatalogOnly(bool enabled) { catalogOnly = enabled; }
+
+  // Called with fresh counters whenever the progress percentage changes, on
+  // a scanning thread.
+  void setStatsCallback(std::function<void(const ScanStats &)> callback)
+  {
+    statsCallback = callback;
+  }
+
+  // Per-stage counters of the current or last run. Safe to call from any
+  // thread while run() is in progress.
+  ScanStats stats() const { return metrics.snapshot(); }
+
+  // Bytes of the device as read (a compressed or container image's disk,
+  // not the file), once run() or extractEntries() has opened it; 0 before.
+  // Safe to call from any thread.
+  uint64_t deviceSize() const { return openedSize.load(); }
+
+  // Reports everything through `eventCallback`, including progress. With
+  // more than one thread, it is called from several scanning threads at once.
+  bool run(std::function<void(const ScanEvent &)> eventCallback,
            std::function<bool()> cancelCheck);
 
+  // Carves the given catalog entries (see CatalogFile) into the output
+  // directory, reading only their byte ranges. Reports like run().
+  bool extractEntries(const std::vector<CatalogEntry> &entries,
+                      std::function<void(const ScanEvent &)> eventCallback,
+                      std::function<bool()> cancelCheck);
+
  private:
-  bool matchesSignature(const std::vector<unsigned char> &buffer, size_t pos,
-                        const std::vector<unsigned char> &signature,
-                        int formatIndex);
-  void extractFile(const QString &filename, size_t fileStart, int &fileCount,
-                   int formatIndex, std::function<void(QString)> logCallback);
-
-  QString inputDevicePath;
-  QString outputDirectory;
+  // State the scanning threads of one run share.
+  struct ScanShared {
+    size_t total = 0;
+    std::atomic<size_t> scanned{0};
+    std::atomic<int> lastProgress{-1};
+    std::atomic<bool> cancelled{false};
+    uint64_t runStart = 0;
+    // Outlives the scanning threads, so queued carve jobs may use it.
+    std::function<void(const ScanEvent &)> eventCallback;
+    CarvePool *carvePool = nullptr;
+    CarvePool::JobGroup carveJobs;
+    std::vector<ScanMetrics::Shard *> carveStats;  // one per pool worker
+    IoTuner *io = nullptr;
+  };
+
+  IoTuner *startIoTuning(std::function<void(const ScanEvent &)> eventCallback);
+  // True while a limit holds reads back; read times then say more about
+  // the limit than about the device.
+  bool readsThrottled() const;
+  std::unique_ptr<BlockReader> openDevice(
+      ImageFormat imageFormat, uint64_t &fileSize,
+      std::function<void(const ScanEvent &)> eventCallback,
+      std::function<bool()> cancelCheck);
+  void scanSlice(const std::vector<ScanRange> &slice, BlockReader &reader,
+                 int holeFd, ScanShared &shared,
+                 std::vector<CatalogEntry> *catalog,
+                 std::function<void(const ScanEvent &)> eventCallback,
+                 std::function<bool()> cancelCheck);
+  void advanceProgress(ScanShared &shared, size_t bytes,
+                       std::function<void(const ScanEvent &)> eventCallback);
+  std::vector<ScanRange> recoverFromMetadata(
+      BlockReader &device, uint64_t deviceSize,
+      std::function<void(const ScanEvent &)> eventCallback,
+      std::function<bool()> cancelCheck, ScanMetrics::Shard &stats);
+  bool writeDeletedFile(BlockReader &device, const DeletedFile &file,
+                        const std::string &dirName,
+                        std::function<void(const ScanEvent &)> eventCallback,
+                        ScanMetrics::Shard &stats);
+  bool writeCatalogFile(std::vector<std::vector<CatalogEntry>> &catalogs,
+                        uint64_t deviceSize,
+                        std::function<void(const ScanEvent &)> eventCallback);
+  void writeMetrics(const std::string &device, uint64_t startNanos,
+                    bool completed,
+                    std::function<void(const ScanEvent &)> eventCallback);
+  std::vector<ScanRange> buildScanRanges(
+      BlockReader &device, size_t fileSize,
+      std::function<void(const ScanEvent &)> eventCallback,
+      std::function<bool()> cancelCheck);
+
+  std::string inputDevicePath;
+  std::string outputDirectory;
   std::vector<bool> File_Supported;
+  bool freeSpaceOnly = false;
+  bool metadataRecovery = false;
+  bool catalogOnly = false;
+  bool idleOnly = false;
+  unsigned threadCount = 1;
+  unsigned carveThreads = std::max(1u, std::thread::hardware_concurrency());
+  IoBackend ioBackend = IoBackend::Stream;
+  std::shared_ptr<CarvePool> carvePool;
+  std::shared_ptr<TokenBucket> readLimiter;
+  std::shared_ptr<TokenBucket> iopsLimiter;
+  std::unique_ptr<IoTuner> ioTuner;  // of the current or last run
+  int metadataFileCount = 0;
+  std::atomic<uint64_t> openedSize{0};
+  ScanMetrics metrics;
+  std::function<void(const ScanStats &)> statsCallback;
 };
 
+// One line of text for an event, as the GUI log and the CLI print it.
+std::string describeEvent(const ScanEvent &event);
+
 #endif  // RECOVERYENGINE_H
@@ -0,0 +1,194 @@
+#include "scanbatch.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// How often the bandwidth shares are recomputed.
+static const chrono::milliseconds REBALANCE_INTERVAL(250);
+
+ScanBatch::ScanBatch(const vector<string> &deviceList, const string &outputRoot,
+                     const vector<bool> &formats)
+    : devices(deviceList), percent(new atomic<int>[deviceList.size()])
+{
+  for (size_t i = 0; i < devices.size(); ++i)
+  {
+    string dir = outputRoot;
+    if (devices.size() > 1)
+    {
+      // Two images may share a file name; number the later ones.
+      string name = fs::path(devices[i]).filename().string();
+      dir = outputRoot + "/" + name;
+      for (int n = 2; find(outputDirs.begin(), outputDirs.end(), dir) !=
+                      outputDirs.end();
+           ++n)
+        dir = outputRoot + "/" + name + "_" + to_string(n);
+    }
+    outputDirs.push_back(dir);
+
+    // Until the engine has opened the device, the file's own size stands
+    // in for the disk's.
+    ifstream in(devices[i], ios::binary | ios::ate);
+    fileSizes.push_back(in ? static_cast<uint64_t>(in.tellg()) : 0);
+    percent[i] = 0;
+    engines.emplace_back(new RecoveryEngine(devices[i], dir, formats));
+    iopsBuckets.push_back(make_shared<TokenBucket>());
+  }
+}
+
+// A quarter second's worth of reads may burst, but never less than one.
+void ScanBatch::setDeviceIops(double readsPerSecond)
+{
+  for (const shared_ptr<TokenBucket> &bucket : iopsBuckets)
+    bucket->setRate(readsPerSecond, max(1.0, readsPerSecond / 4));
+}
+
+int ScanBatch::progress() const
+{
+  double done = 0, total = 0;
+  for (size_t i = 0; i < engines.size(); ++i)
+  {
+    // An empty or unreadable device still counts once. A compressed or
+    // container image counts by the disk inside it.
+    uint64_t size = engines[i]->deviceSize();
+    double weight = max<uint64_t>(size > 0 ? size : fileSizes[i], 1);
+    done += weight * percent[i].load() / 100;
+    total += weight;
+  }
+  return total > 0 ? static_cast<int>(done * 100 / total) : 0;
+}
+
+ScanStats ScanBatch::stats() const
+{
+  ScanStats sum;
+  for (const auto &engine : engines)
+    sum += engine->stats();
+  return sum;
+}
+
+bool ScanBatch::run(std::function<void(const ScanEvent &)> eventCallback,
+                    std::function<bool()> cancelCheck)
+{
+  // Set before any thread starts, so every one of them inherits it.
+  IoPriority callerPriority;
+  bool prioritySet = false;
+  if (ioPriority.ioClass != IoClass::None)
+  {
+    prioritySet = ::setIoPriority(ioPriority, &callerPriority);
+    string name = ioPriorityName(ioPriority);
+    ScanEvent event = prioritySet
+                          ? ScanEvent::info("I/O priority: " + name)
+                          : ScanEvent::ioError("Cannot set I/O priority " + name);
+    event.device = -1;
+    eventCallback(event);
+  }
+
+  shared_ptr<CarvePool> pool;
+  if (carveThreads > 0)
+    pool = make_shared<CarvePool>(carveThreads);
+
+  // Every device is charged to a bucket, limited or not, so a limit can be
+  // set in the middle of a scan.
+  vector<shared_ptr<TokenBucket>> buckets(engines.size());
+  for (size_t i = 0; i < engines.size(); ++i)
+  {
+    RecoveryEngine &engine = *engines[i];
+    percent[i] = 0;
+    engine.setFreeSpaceOnly(freeSpaceOnly);
+    engine.setMetadataRecovery(metadataRecovery);
+    engine.setThreads(threadsPerDevice);
+    engine.setIoBackend(ioBackend);
+    engine.setCatalogOnly(catalogOnly);
+    engine.setCarveThreads(carveThreads);
+    engine.setCarvePool(pool);
+    engine.setIdleOnly(idleOnly);
+    buckets[i] = scheduler.addDevice();
+    engine.setReadLimiter(buckets[i]);
+    engine.setIopsLimiter(iopsBuckets[i]);
+  }
+
+  atomic<int> lastCombined{-1};
+  mutex doneLock;
+  condition_variable doneSignal;
+  size_t finished = 0;
+  vector<char> completed(engines.size(), false);
+  vector<thread> scans;
+  for (size_t i = 0; i < engines.size(); ++i)
+  {
+    scans.emplace_back(
+        [&, i]()
+        {
+          auto forward = [&, i](const ScanEvent &event)
+          {
+            ScanEvent tagged = event;
+            tagged.device = static_cast<int>(i);
+            eventCallback(tagged);
+            if (event.type != ScanEvent::Progress)
+              return;
+            percent[i] = event.percent;
+            int combined = progress();
+            int last = lastCombined.load();
+            while (combined > last)
+            {
+              if (lastCombined.compare_exchange_weak(last, combined))
+              {
+                ScanEvent overall;
+                overall.type = ScanEvent::Progress;
+                overall.percent = combined;
+                overall.device = -1;
+                eventCallback(overall);
+                break;
+              }
+            }
+          };
+          completed[i] = engines[i]->run(forward, cancelCheck);
+          percent[i] = 100;
+          scheduler.removeDevice(buckets[i]);
+          lock_guard<mutex> guard(doneLock);
+          ++finished;
+          doneSignal.notify_all();
+        });
+  }
+
+  // Shares follow what each device managed to read in the last interval.
+  auto last = chrono::steady_clock::now();
+  unique_lock<mutex> lock(doneLock);
+  while (finished < engines.size())
+  {
+    doneSignal.wait_for(lock, REBALANCE_INTERVAL);
+    auto now = chrono::steady_clock::now();
+    scheduler.rebalance(chrono::duration<double>(now - last).count());
+    last = now;
+  }
+  lock.unlock();
+  for (thread &scan : scans)
+    scan.join();
+  if (prioritySet)
+    ::setIoPriority(callerPriority);
+
+  bool allCompleted = true;
+  for (char ok : completed)
+    allCompleted = allCompleted && ok;
+  if (engines.size() > 1)
+  {
+    ScanStats totals = stats();
+    string found =
+        catalogOnly ? to_string(totals.total(metric::CANDIDATES) -
+                                totals.total(metric::REJECTED)) +
+                          " candidates catalogued"
+                    : to_string(totals.total(metric::VALIDATED)) +
+                          " files recovered";
+    ScanEvent summary =
+        ScanEvent::summaryLine("Batch summary: " + found + " from " +
+                               to_string(engines.size()) + " devices.");
+    summary.device = -1;
+    eventCallback(summary);
+  }
+  return allCompleted;
+}
@@ -0,0 +1,91 @@
+#ifndef SCANBATCH_H
+#define SCANBATCH_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "recoveryengine.h"
+
+// Scans several devices at once in one process, e.g. all drives from one
+// incident. Each device gets its own engine and, when there is more than
+// one, its own output subdirectory. The engines share one carve pool, and a
+// BandwidthScheduler splits the read budget between them so a fast device
+// cannot starve slow ones. Events carry the device's position in
+// `device`; progress for the batch as a whole has device -1.
+//
+// The read limits may be changed while run() is going; the scans follow
+// within REBALANCE_INTERVAL.
+class ScanBatch {
+ public:
+  ScanBatch(const std::vector<std::string> &devices,
+            const std::string &outputRoot, const std::vector<bool> &formats);
+
+  size_t size() const { return engines.size(); }
+  const std::string &device(size_t index) const { return devices[index]; }
+  // outputRoot itself for a single device, else outputRoot/<device name>.
+  const std::string &outputDirectory(size_t index) const {
+    return outputDirs[index];
+  }
+
+  void setFreeSpaceOnly(bool enabled) { freeSpaceOnly = enabled; }
+  void setMetadataRecovery(bool enabled) { metadataRecovery = enabled; }
+  void setThreadsPerDevice(unsigned count) { threadsPerDevice = count; }
+  // Size of the carve pool all scans share; 0 carves on the scan threads.
+  void setCarveThreads(unsigned count) { carveThreads = count; }
+  void setIoBackend(IoBackend backend) { ioBackend = backend; }
+  // Each device gets a catalog.idx in its output directory instead of
+  // carved files (see RecoveryEngine::setCatalogOnly).
+  void setCatalogOnly(bool enabled) { catalogOnly = enabled; }
+
+  // Read budget over all devices in bytes per second, shared fairly; 0 is
+  // unlimited.
+  void setTotalBandwidth(double bytesPerSecond) {
+    scheduler.setTotal(bytesPerSecond);
+  }
+  // Upper bound for any one device in bytes per second; 0 is unlimited.
+  void setDeviceBandwidth(double bytesPerSecond) {
+    scheduler.setDeviceCap(bytesPerSecond);
+  }
+  // Reads per second for each device, scan and carvers together; 0 is
+  // unlimited.
+  void setDeviceIops(double readsPerSecond);
+  // Reads wait while other programs use a device's disk (see IdleGate).
+  void setIdleOnly(bool enabled) { idleOnly = enabled; }
+  // The I/O class of every scanning and carving thread, for the length of
+  // run(). IoClass::None leaves the caller's own.
+  void setIoPriority(IoPriority priority) { ioPriority = priority; }
+
+  // Runs all scans; true when every one completed. Callbacks come from the
+  // scanning threads of every device at once.
+  bool run(std::function<void(const ScanEvent &)> eventCallback,
+           std::function<bool()> cancelCheck);
+
+  // Counters summed over all devices. Safe to call while run() is going.
+  ScanStats stats() const;
+  // Per-device progress, 0..100.
+  int progress(size_t index) const { return percent[index].load(); }
+  // All devices together, weighted by their size.
+  int progress() const;
+
+ private:
+  std::vector<std::string> devices;
+  std::vector<std::string> outputDirs;
+  std::vector<uint64_t> fileSizes;  // of the device paths themselves
+  std::vector<std::unique_ptr<RecoveryEngine>> engines;
+  std::unique_ptr<std::atomic<int>[]> percent;
+  std::vector<std::shared_ptr<TokenBucket>> iopsBuckets;  // one per device
+  bool freeSpaceOnly = false;
+  bool metadataRecovery = false;
+  bool catalogOnly = false;
+  bool idleOnly = false;
+  unsigned threadsPerDevice = 1;
+  unsigned carveThreads = std::max(1u, std::thread::hardware_concurrency());
+  IoBackend ioBackend = IoBackend::Stream;
+  IoPriority ioPriority;
+  BandwidthScheduler scheduler;
+};
+
+#endif  // SCANBATCH_H
@@ -0,0 +1,112 @@
+#ifndef SCANEVENT_H
+#define SCANEVENT_H
+
+#include <cstdint>
+#include <string>
+
+// Everything the engine reports during a run. Events carry data only; text
+// is built by consumers that want it (see describeEvent in
+// recoveryengine.h), so the scan loop never formats strings.
+struct ScanEvent
+{
+  enum Type
+  {
+    Info,              // a status line in `message` (not on the hot path)
+    CandidateFound,    // a signature matched at `offset`
+    FileCarved,        // `path` holds `length` bytes starting at `offset`
+    CandidateRejected, // the candidate at `offset` failed `reason`
+    IoError,           // `message` says what failed
+    Progress           // `percent` of the scan ranges done
+  };
+
+  enum Reason
+  {
+    NoReason,
+    TooSmall,         // under the format's minimum size
+    TooLarge,         // ran past the format's maximum size
+    NoEndMarker,      // the device ended before the format's end marker
+    MissingStructure, // required parts absent (PDF xref/trailer)
+    OutputFailed,     // the output file could not be created
+    BadHeader         // the format's header checks failed (see validate)
+  };
+
+  // What a file's own checksums (PNG chunk CRCs, ZIP member CRCs) say
+  // about a carved file.
+  enum Integrity
+  {
+    Unverified,      // the format has none, or none could be checked
+    Verified,        // every checksum matched
+    PartiallyCorrupt // some matched, or the layout broke off part way
+  };
+
+  Type type = Info;
+  uint64_t offset = 0; // device offset of the candidate or file
+  uint64_t length = 0; // bytes carved, or examined before a rejection
+  int format = -1;     // engine format index, -1 when unknown
+  float confidence = 0; // 0..1: how likely a carved file is whole and correct
+  Reason reason = NoReason;
+  Integrity integrity = Unverified; // of a carved file
+  int percent = 0;
+  int device = 0; // position in a ScanBatch's device list
+  bool summary = false; // a line of the end-of-run summary
+  std::string path;
+  std::string message;
+
+  static ScanEvent info(const std::string &text)
+  {
+    ScanEvent event;
+    event.message = text;
+    return event;
+  }
+
+  static ScanEvent summaryLine(const std::string &text)
+  {
+    ScanEvent event = info(text);
+    event.summary = true;
+    return event;
+  }
+
+  static ScanEvent ioError(const std::string &text)
+  {
+    ScanEvent event;
+    event.type = IoError;
+    event.message = text;
+    return event;
+  }
+};
+
+inline const char *rejectReasonName(ScanEvent::Reason reason)
+{
+  switch (reason)
+  {
+  case ScanEvent::TooSmall:
+    return "too small";
+  case ScanEvent::TooLarge:
+    return "too large";
+  case ScanEvent::NoEndMarker:
+    return "no end marker";
+  case ScanEvent::MissingStructure:
+    return "missing structure";
+  case ScanEvent::OutputFailed:
+    return "output failed";
+  case ScanEvent::BadHeader:
+    return "bad header";
+  default:
+    return "";
+  }
+}
+
+inline const char *integrityName(ScanEvent::Integrity integrity)
+{
+  switch (integrity)
+  {
+  case ScanEvent::Verified:
+    return "verified";
+  case ScanEvent::PartiallyCorrupt:
+    return "partially corrupt";
+  default:
+    return "unverified";
+  }
+}
+
+#endif // SCANEVENT_H
@@ -0,0 +1,205 @@
+#ifndef SCANMETRICS_H
+#define SCANMETRICS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Time source for the stage timers.
+inline uint64_t monotonicNanos()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// --- Metric Layout ---
+namespace metric
+{
+  const int FORMATS = 10;         // engine format indices, PNG .. ELF
+  const int LATENCY_BUCKETS = 20; // <1 us, then [2^(i-1), 2^i) us
+
+  enum Counter
+  {
+    BYTES_READ, // by the scan loop
+    READS,
+    BYTES_WRITTEN,   // everything written to the output directory
+    BYTES_DISCARDED, // written, then deleted because validation failed
+    SCAN_NS,         // signature matching
+    CARVE_NS,        // following a candidate to its end, minus writes
+    WRITE_NS,
+    READ_LATENCY,
+    CANDIDATES = READ_LATENCY + LATENCY_BUCKETS,
+    VALIDATED = CANDIDATES + FORMATS,
+    REJECTED = VALIDATED + FORMATS,
+    VERIFIED = REJECTED + FORMATS, // kept files whose checksums all matched
+    CORRUPT = VERIFIED + FORMATS,  // kept files with a failed checksum
+    COUNT = CORRUPT + FORMATS
+  };
+}
+
+// A point-in-time sum of all shards.
+struct ScanStats
+{
+  std::array<uint64_t, metric::COUNT> value{};
+  uint64_t elapsedNanos = 0;
+
+  uint64_t operator[](int counter) const { return value[counter]; }
+
+  // Adds another scan's counters; the elapsed time is the longer one.
+  ScanStats &operator+=(const ScanStats &other)
+  {
+    for (int i = 0; i < metric::COUNT; ++i)
+      value[i] += other.value[i];
+    elapsedNanos = std::max(elapsedNanos, other.elapsedNanos);
+    return *this;
+  }
+
+  uint64_t total(int firstFormatCounter) const
+  {
+    uint64_t sum = 0;
+    for (int i = 0; i < metric::FORMATS; ++i)
+      sum += value[firstFormatCounter + i];
+    return sum;
+  }
+
+  // `info` holds string fields (device, host, ...) emitted ahead of the
+  // counters; formats without candidates are left out.
+  std::string toJson(const std::vector<std::string> &formatNames,
+                     const std::map<std::string, std::string> &info) const
+  {
+    std::string json = "{\n";
+    for (const auto &field : info)
+      json += "  \"" + field.first + "\": \"" + escape(field.second) + "\",\n";
+    json += "  \"elapsed_seconds\": " + seconds(elapsedNanos) + ",\n";
+    json += "  \"bytes_read\": " + std::to_string(value[metric::BYTES_READ]) + ",\n";
+    json += "  \"reads\": " + std::to_string(value[metric::READS]) + ",\n";
+    json += "  \"bytes_written\": " + std::to_string(value[metric::BYTES_WRITTEN]) + ",\n";
+    json += "  \"bytes_discarded\": " +
+            std::to_string(value[metric::BYTES_DISCARDED]) + ",\n";
+    json += "  \"stage_seconds\": {\"scan\": " + seconds(value[metric::SCAN_NS]) +
+            ", \"carve\": " + seconds(value[metric::CARVE_NS]) +
+            ", \"write\": " + seconds(value[metric::WRITE_NS]) + "},\n";
+
+    // Bucket i counts reads faster than 2^i microseconds.
+    json += "  \"read_latency_us\": {\"upper_bounds\": [";
+    for (int i = 0; i < metric::LATENCY_BUCKETS; ++i)
+      json += (i ? ", " : "") + (i + 1 < metric::LATENCY_BUCKETS
+                                     ? std::to_string(1ULL << i)
+                                     : std::string("null"));
+    json += "], \"counts\": [";
+    for (int i = 0; i < metric::LATENCY_BUCKETS; ++i)
+      json += (i ? ", " : "") + std::to_string(value[metric::READ_LATENCY + i]);
+    json += "]},\n";
+
+    json += "  \"formats\": {";
+    bool first = true;
+    for (int i = 0; i < metric::FORMATS && i < (int)formatNames.size(); ++i)
+    {
+      if (value[metric::CANDIDATES + i] == 0)
+        continue;
+      json += std::string(first ? "\n" : ",\n") + "    \"" + formatNames[i] +
+              "\": {\"candidates\": " +
+              std::to_string(value[metric::CANDIDATES + i]) +
+              ", \"validated\": " + std::to_string(value[metric::VALIDATED + i]) +
+              ", \"rejected\": " + std::to_string(value[metric::REJECTED + i]) +
+              ", \"verified\": " + std::to_string(value[metric::VERIFIED + i]) +
+              ", \"partially_corrupt\": " +
+              std::to_string(value[metric::CORRUPT + i]) + "}";
+      first = false;
+    }
+    json += first ? "}\n}\n" : "\n  }\n}\n";
+    return json;
+  }
+
+private:
+  static std::string seconds(uint64_t nanos)
+  {
+    char text[32];
+    snprintf(text, sizeof(text), "%.6f", nanos / 1e9);
+    return text;
+  }
+
+  static std::string escape(const std::string &s)
+  {
+    std::string out;
+    for (char c : s)
+    {
+      if (c == '"' || c == '\\')
+        out += '\\';
+      if (static_cast<unsigned char>(c) < 0x20)
+        continue;
+      out += c;
+    }
+    return out;
+  }
+};
+
+// Counters for one run, sharded per thread. A shard has a single writer, so
+// updates are a relaxed load and store (no locked instruction on the hot
+// path) while readers may sum the shards at any time for live display.
+class ScanMetrics
+{
+public:
+  class Shard
+  {
+  public:
+    void add(int counter, uint64_t n)
+    {
+      value[counter].store(value[counter].load(std::memory_order_relaxed) + n,
+                           std::memory_order_relaxed);
+    }
+
+    void recordRead(uint64_t bytes, uint64_t nanos)
+    {
+      add(metric::BYTES_READ, bytes);
+      add(metric::READS, 1);
+      uint64_t micros = nanos / 1000;
+      int bucket = micros == 0 ? 0 : 64 - __builtin_clzll(micros);
+      add(metric::READ_LATENCY + std::min(bucket, metric::LATENCY_BUCKETS - 1),
+          1);
+    }
+
+  private:
+    friend class ScanMetrics;
+    std::array<std::atomic<uint64_t>, metric::COUNT> value{};
+  };
+
+  // Creates a shard for the calling thread; it lives as long as this object.
+  Shard &addShard()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    shards.emplace_back();
+    return shards.back();
+  }
+
+  ScanStats snapshot() const
+  {
+    ScanStats stats;
+    std::lock_guard<std::mutex> guard(lock);
+    for (const Shard &shard : shards)
+      for (int i = 0; i < metric::COUNT; ++i)
+        stats.value[i] += shard.value[i].load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  void reset()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    shards.clear();
+  }
+
+private:
+  mutable std::mutex lock;
+  std::deque<Shard> shards; // deque: growing never moves existing shards
+};
+
+#endif // SCANMETRICS_H
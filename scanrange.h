@@ -0,0 +1,128 @@
+#ifndef SCANRANGE_H
+#define SCANRANGE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// A byte range of the input device that the scanner should look at.
+struct ScanRange
+{
+  size_t start;
+  size_t length;
+
+  size_t end() const { return start + length; }
+};
+
+// Sorts ranges by start and joins the ones that touch or overlap.
+inline void mergeRanges(std::vector<ScanRange> &ranges)
+{
+  std::sort(ranges.begin(), ranges.end(),
+            [](const ScanRange &a, const ScanRange &b)
+            { return a.start < b.start; });
+  std::vector<ScanRange> merged;
+  for (const ScanRange &r : ranges)
+  {
+    if (r.length == 0)
+      continue;
+    if (!merged.empty() && r.start <= merged.back().end())
+    {
+      size_t end = std::max(merged.back().end(), r.end());
+      merged.back().length = end - merged.back().start;
+    }
+    else
+      merged.push_back(r);
+  }
+  ranges.swap(merged);
+}
+
+// Drops whatever lies past `limit` (e.g. a filesystem larger than its image).
+inline void clipRanges(std::vector<ScanRange> &ranges, size_t limit)
+{
+  std::vector<ScanRange> clipped;
+  for (const ScanRange &r : ranges)
+  {
+    if (r.start >= limit)
+      continue;
+    clipped.push_back({r.start, std::min(r.end(), limit) - r.start});
+  }
+  ranges.swap(clipped);
+}
+
+// Removes every byte covered by `removed` from `ranges`. Both lists may be
+// unsorted; the result is sorted and merged.
+inline void subtractRanges(std::vector<ScanRange> &ranges,
+                           std::vector<ScanRange> removed)
+{
+  mergeRanges(ranges);
+  mergeRanges(removed);
+  std::vector<ScanRange> result;
+  size_t k = 0;
+  for (const ScanRange &r : ranges)
+  {
+    size_t pos = r.start;
+    while (k < removed.size() && removed[k].end() <= pos)
+      k++;
+    for (size_t j = k; j < removed.size() && removed[j].start < r.end(); ++j)
+    {
+      if (removed[j].start > pos)
+        result.push_back({pos, removed[j].start - pos});
+      pos = std::max(pos, removed[j].end());
+    }
+    if (pos < r.end())
+      result.push_back({pos, r.end() - pos});
+  }
+  ranges.swap(result);
+}
+
+inline size_t totalLength(const std::vector<ScanRange> &ranges)
+{
+  size_t total = 0;
+  for (const ScanRange &r : ranges)
+    total += r.length;
+  return total;
+}
+
+// Splits sorted ranges into at most `parts` slices of roughly equal byte
+// count, one per scanning thread. Cuts fall on multiples of `align`, so
+// aligned ranges are read in the same chunks as by a single scan.
+inline std::vector<std::vector<ScanRange>> splitRanges(
+    const std::vector<ScanRange> &ranges, size_t parts, size_t align)
+{
+  std::vector<std::vector<ScanRange>> slices;
+  size_t total = totalLength(ranges);
+  if (parts == 0)
+    parts = 1;
+  size_t share = (total / parts + align - 1) / align * align;
+  if (share == 0)
+    share = align;
+  std::vector<ScanRange> current;
+  size_t currentBytes = 0;
+  for (ScanRange r : ranges)
+  {
+    while (r.length > 0)
+    {
+      bool last = slices.size() + 1 >= parts;
+      size_t take = last ? r.length : std::min(r.length, share - currentBytes);
+      // Move the cut to the next chunk boundary of the device.
+      size_t cut = r.start + take;
+      if (take < r.length && cut % align != 0)
+        take = std::min(r.length, take + (align - cut % align));
+      current.push_back({r.start, take});
+      currentBytes += take;
+      r.start += take;
+      r.length -= take;
+      if (!last && currentBytes >= share)
+      {
+        slices.push_back(current);
+        current.clear();
+        currentBytes = 0;
+      }
+    }
+  }
+  if (!current.empty())
+    slices.push_back(current);
+  return slices;
+}
+
+#endif // SCANRANGE_H
@@ -0,0 +1,85 @@
+#ifndef ZEROBLOCK_H
+#define ZEROBLOCK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define ZEROBLOCK_X86 1
+#endif
+
+// --- All-zero block detection ---
+// Zero-filled (or TRIMmed) regions make up a large share of real devices and
+// can never contain a signature, so the scanner drops them before matching.
+// Every path bails out on the first non-zero lane, so data blocks cost only a
+// few compares.
+
+inline bool isZeroBlockScalar(const unsigned char *data, size_t size)
+{
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32)
+  {
+    uint64_t w[4];
+    memcpy(w, data + i, sizeof(w));
+    if (w[0] | w[1] | w[2] | w[3])
+      return false;
+  }
+  for (; i < size; ++i)
+  {
+    if (data[i])
+      return false;
+  }
+  return true;
+}
+
+#ifdef ZEROBLOCK_X86
+inline bool isZeroBlockSSE2(const unsigned char *data, size_t size)
+{
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64)
+  {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 16));
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 32));
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 48));
+    __m128i acc = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF)
+      return false;
+  }
+  return isZeroBlockScalar(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) inline bool
+isZeroBlockAVX2(const unsigned char *data, size_t size)
+{
+  size_t i = 0;
+  for (; i + 128 <= size; i += 128)
+  {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 32));
+    __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 64));
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 96));
+    __m256i acc = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+    if (!_mm256_testz_si256(acc, acc))
+      return false;
+  }
+  return isZeroBlockScalar(data + i, size - i);
+}
+#endif
+
+// Returns true when every byte in [data, data + size) is zero. The widest
+// instruction set available on the running CPU is picked once.
+inline bool isZeroBlock(const unsigned char *data, size_t size)
+{
+#ifdef ZEROBLOCK_X86
+  static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+  return hasAVX2 ? isZeroBlockAVX2(data, size) : isZeroBlockSSE2(data, size);
+#else
+  return isZeroBlockScalar(data, size);
+#endif
+}
+
+#endif // ZEROBLOCK_H